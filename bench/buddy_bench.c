@@ -0,0 +1,199 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mem/buddy.h"
+#include "mem/utils.h"
+#include "benchmark.h"
+
+// the linear scan buddy allocator BuddyMemory used before per-order free lists, kept as a baseline
+typedef struct __attribute__((aligned(8), packed)) {
+    unsigned int size;
+    unsigned int free;
+} LegacyBuddyBlock;
+
+typedef struct {
+    LegacyBuddyBlock *head;
+    LegacyBuddyBlock *tail;
+    void *memory;
+    unsigned int usage;
+} LegacyBuddy;
+
+static LegacyBuddyBlock *legacy_next(LegacyBuddyBlock *b) {
+    return (LegacyBuddyBlock *) ((size_t) b + b->size);
+}
+
+static LegacyBuddyBlock *legacy_split(LegacyBuddyBlock *block, unsigned int size) {
+    if (block == NULL || size == 0)
+        return NULL;
+
+    while (size < (block->size >> 1)) {
+        size_t sz = block->size >> 1;
+        block->size = sz;
+        block = legacy_next(block);
+        block->size = sz;
+        block->free = 1;
+    }
+
+    if (size > block->size)
+        return NULL;
+
+    return block;
+}
+
+static LegacyBuddyBlock *legacy_best(LegacyBuddyBlock *head, LegacyBuddyBlock *tail, unsigned int size) {
+    LegacyBuddyBlock *best_block = NULL;
+    LegacyBuddyBlock *block = head;
+    LegacyBuddyBlock *buddy = legacy_next(block);
+
+    if (buddy == tail && block->free) return legacy_split(block, size);
+
+    while (block < tail && buddy < tail) {
+        if (block->free && buddy->free && block->size == buddy->size) {
+            block->size <<= 1;
+            if (size <= block->size && (best_block == NULL || block->size <= best_block->size)) best_block = block;
+            block = legacy_next(buddy);
+            if (block < tail) buddy = legacy_next(block);
+            continue;
+        }
+
+        if (block->free && size <= block->size && (best_block == NULL || block->size <= best_block->size)) best_block = block;
+
+        if (buddy->free && size <= buddy->size && (best_block == NULL || buddy->size < best_block->size)) best_block = buddy;
+
+        if (block->size <= buddy->size) {
+            block = legacy_next(buddy);
+            if (block < tail) buddy = legacy_next(block);
+        } else {
+            block = buddy;
+            buddy = legacy_next(buddy);
+        }
+    }
+
+    if (best_block == NULL) return NULL;
+    return legacy_split(best_block, size);
+}
+
+static void legacy_merge(LegacyBuddyBlock *head, LegacyBuddyBlock *tail) {
+    while (1) {
+        LegacyBuddyBlock *block = head;
+        LegacyBuddyBlock *buddy = legacy_next(block);
+        char no_merge = 1;
+        while (block < tail && buddy < tail) {
+            if (block->free && buddy->free && block->size == buddy->size) {
+                block->size <<= 1;
+                block = legacy_next(block);
+                if (block < tail) {
+                    buddy = legacy_next(block);
+                    no_merge = 0;
+                }
+            } else if (block->size < buddy->size) {
+                block = buddy;
+                buddy = legacy_next(buddy);
+            } else {
+                block = legacy_next(buddy);
+                if (block < tail) buddy = legacy_next(block);
+            }
+        }
+        if (no_merge) return;
+    }
+}
+
+static void legacy_create(LegacyBuddy *self, unsigned int order) {
+    self->memory = malloc((1 << order) + sizeof(size_t));
+    self->head = (LegacyBuddyBlock *) ((size_t) self->memory + MEMORY_PADDING_STD((size_t) self->memory));
+    self->head->size = 1 << order;
+    self->head->free = 1;
+    self->tail = legacy_next(self->head);
+    self->usage = 0;
+}
+
+static void *legacy_alloc(LegacyBuddy *self, unsigned int size) {
+    const unsigned int space = MEMORY_SPACE_STD(LegacyBuddyBlock);
+    size += space;
+
+    LegacyBuddyBlock *found = legacy_best(self->head, self->tail, size);
+    if (found == NULL) {
+        legacy_merge(self->head, self->tail);
+        found = legacy_best(self->head, self->tail, size);
+    }
+    if (found == NULL)
+        return NULL;
+
+    found->free = 0;
+    self->usage += found->size;
+    return (void *) ((size_t) found + space);
+}
+
+static void legacy_free(LegacyBuddy *self, void **ptr) {
+    const unsigned int space = MEMORY_SPACE_STD(LegacyBuddyBlock);
+    LegacyBuddyBlock *block = (LegacyBuddyBlock *) ((size_t) (*ptr) - space);
+    block->free = 1;
+    self->usage -= block->size;
+    *ptr = NULL;
+}
+
+enum {
+    ORDER = 23,
+    OPERATIONS = 1000000,
+    SLOTS = 2048,
+};
+
+static void *slots[SLOTS];
+static unsigned int seed;
+
+static unsigned int next_random() {
+    seed = seed * 1664525u + 1013904223u;
+    return seed >> 8;
+}
+
+// mixed workload: a random slot is allocated when empty and released otherwise,
+// sizes are skewed towards small blocks with an occasional large one
+static unsigned int next_size() {
+    unsigned int r = next_random();
+    if ((r & 31) == 0)
+        return 4096 + (r >> 5) % (60 * KILOBYTES);
+    return 16 + (r >> 5) % 1024;
+}
+
+int main() {
+    unsigned int failed;
+
+    LegacyBuddy legacy;
+    legacy_create(&legacy, ORDER);
+    clear(slots, sizeof(slots));
+    seed = 1;
+    failed = 0;
+    start_timer();
+    for (int i = 0; i < OPERATIONS; i++) {
+        unsigned int slot = next_random() % SLOTS;
+        unsigned int size = next_size();
+        if (slots[slot] != NULL) {
+            legacy_free(&legacy, &slots[slot]);
+        } else if ((slots[slot] = legacy_alloc(&legacy, size)) == NULL) {
+            failed++;
+        }
+    }
+    end_timer("buddy (linear scan)");
+    printf("  failed allocations: %u\n", failed);
+    free(legacy.memory);
+
+    BuddyMemory *buddy = make_buddy(ORDER);
+    clear(slots, sizeof(slots));
+    seed = 1;
+    failed = 0;
+    start_timer();
+    for (int i = 0; i < OPERATIONS; i++) {
+        unsigned int slot = next_random() % SLOTS;
+        unsigned int size = next_size();
+        if (slots[slot] != NULL) {
+            buddy_free(buddy, &slots[slot]);
+        } else if ((slots[slot] = buddy_alloc(buddy, size)) == NULL) {
+            failed++;
+        }
+    }
+    end_timer("buddy (free lists)");
+    printf("  failed allocations: %u\n", failed);
+    buddy_destroy(&buddy);
+    return 0;
+}
@@ -0,0 +1,201 @@
+#include <thread>
+#include <chrono>
+#include <tuple>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+extern "C" {
+#include "mem/freelist.h"
+#include "mem/utils.h"
+#include "mathf.h"
+}
+
+#include "engine/ECS.hpp"
+
+// MovementSystem and ParticleSystem from src/Old/TempLevel.hpp without drawing or input, iterated with
+// ParallelEach on 1 to 16 threads. expired particles respawn in place so the entity count stays put
+// usage: ecs_bench [entities] [--csv]
+
+enum {
+    ENTITIES = 100000,
+    FRAMES = 200,
+    WARMUP = 10,
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static const float kDeltaTime = 1.0f / 60.0f;
+static float benchTime = 0;
+
+class BenchMemory {
+public:
+    static inline FreeListMemory *memory = nullptr;
+
+    // TFastMap groups hold an __m128i
+    inline static void *Alloc(size_t size, unsigned int alignment) {
+        return freelist_alloc(memory, size, alignment > 16 ? alignment : 16);
+    }
+
+    inline static void Free(void **ptr) {
+        freelist_free(memory, ptr);
+    }
+};
+
+using TAlloc = BenchMemory;
+
+struct TransformComponent {
+    Vec3 position;
+};
+
+struct MovementComponent : public CComponent<TAlloc> {
+    Vec3 destination{0, 0, 0};
+    float speed{20.0f};
+    float angle{0};
+
+    explicit inline MovementComponent(float speed, float angle) : speed(speed), angle(angle) {}
+};
+
+struct ParticleComponent : public CComponent<TAlloc> {
+    Vec3 position{0.0f, 0.0f, 0.0f};
+    Vec3 velocity{0.0f, 0.0f, 0.0f};
+    float spawnTime{0.0f};
+    float timeSpan{2.0f};
+    float blend{1.0f};
+    float size{12.0f};
+    float damping{0};
+    unsigned int seed{1};
+};
+
+struct MovementSystem : public CSystem<TAlloc, MovementComponent, TransformComponent> {
+    inline void Update() override {
+        // the level picks a new destination on click, here every second frame moves the target
+        const bool retarget = ((int) (benchTime / kDeltaTime) & 1) == 0;
+        const Vec3 target = vec3(cosd(benchTime * 30.0f) * 200.0f, sind(benchTime * 30.0f) * 200.0f, 0);
+        const float time = benchTime;
+        ParallelEach([retarget, target, time](CTuple &bucket) {
+            auto pTransform = Get<TransformComponent>(bucket);
+            auto pMovement = Get<MovementComponent>(bucket);
+            if (retarget) {
+                const float i = time * 200.0f + pMovement->angle;
+                Vec3 rnd = vec3(cosd(i), sind(i), 0);
+                pMovement->destination = vec3_add(target, vec3_mulf(rnd, 30.0f));
+            }
+            pTransform->position = vec3_moveTowards(pTransform->position, pMovement->destination,
+                                                    pMovement->speed * kDeltaTime);
+        });
+    }
+};
+
+static inline float BenchRandom(unsigned int &seed) {
+    seed = seed * 1664525u + 1013904223u;
+    return (float) (seed >> 8) / (float) (1u << 24);
+}
+
+static inline void Respawn(ParticleComponent *particle, float time) {
+    Vec3 rnd = vec3(BenchRandom(particle->seed) * 4.0f - 2.0f, BenchRandom(particle->seed) * 4.0f - 2.0f,
+                    BenchRandom(particle->seed) * 10.0f);
+    particle->size = 10.0f;
+    particle->position = vec3_zero;
+    particle->velocity = vec3_mulf(rnd, 0.5f);
+    particle->spawnTime = time;
+    particle->damping = (BenchRandom(particle->seed) * 0.1f) + 0.1f;
+}
+
+struct ParticleSystem : public CSystem<TAlloc, ParticleComponent> {
+    inline void Update() override {
+        const float time = benchTime;
+        ParallelEach([time](CTuple &bucket) {
+            auto pParticle = Get<ParticleComponent>(bucket);
+            float t = (time - pParticle->spawnTime) / pParticle->timeSpan;
+            pParticle->blend = 1 - t;
+            pParticle->velocity = vec3_lerp(pParticle->velocity, vec3_zero, pParticle->damping);
+            pParticle->position = vec3_add(pParticle->position, pParticle->velocity);
+            pParticle->size = lerp(pParticle->size, 0, pParticle->damping);
+
+            if (t > 1 || pParticle->size < 0.5f)
+                Respawn(pParticle, time);
+        });
+    }
+};
+
+struct BenchResult {
+    double movement;
+    double particles;
+};
+
+static BenchResult Run(unsigned int threads, unsigned int entities) {
+    BenchResult result{0, 0};
+    auto *director = AllocNew<TAlloc, CDirector<TAlloc>>();
+    if (threads > 1) director->SetThreads(threads - 1);
+    else director->SetParallel(false);
+    auto movement = director->AddSystem<MovementSystem>();
+    auto particles = director->AddSystem<ParticleSystem>();
+    director->Create();
+
+    for (unsigned int i = 0; i < entities; i++) {
+        auto entity = director->CreateEntity();
+        director->AddComponent<TransformComponent>(entity, vec3((float) (i % 1000), (float) (i / 1000), 0));
+        director->AddComponent<MovementComponent>(entity, 20.0f + (float) (i % 7), (float) i * 0.36f);
+        director->Commit(entity);
+
+        entity = director->CreateEntity();
+        auto particle = director->AddComponent<ParticleComponent>(entity);
+        particle->seed = i + 1;
+        Respawn(particle, -BenchRandom(particle->seed) * particle->timeSpan);
+        director->Commit(entity);
+    }
+
+    benchTime = 0;
+    for (int frame = 0; frame < WARMUP + FRAMES; frame++) {
+        auto begin = Clock::now();
+        movement->Update();
+        auto middle = Clock::now();
+        particles->Update();
+        auto end = Clock::now();
+        if (frame >= WARMUP) {
+            result.movement += std::chrono::duration<double, std::milli>(middle - begin).count();
+            result.particles += std::chrono::duration<double, std::milli>(end - middle).count();
+        }
+        benchTime += kDeltaTime;
+    }
+    result.movement /= FRAMES;
+    result.particles /= FRAMES;
+
+    Free<TAlloc>(&director);
+    return result;
+}
+
+int main(int argc, const char *argv[]) {
+    bool csv = false;
+    unsigned int entities = ENTITIES;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) csv = true;
+        else entities = (unsigned int) strtoul(argv[i], nullptr, 10);
+    }
+
+    BenchMemory::memory = make_freelist(512 * MEGABYTES);
+    if (BenchMemory::memory == nullptr) {
+        printf("ecs_bench: make_freelist failed, out of memory\n");
+        return 1;
+    }
+
+    if (csv) printf("threads,movement_ms,particles_ms,frame_ms,speedup\n");
+    else
+        printf("%u movers and %u particles, %u hardware threads\n%8s %12s %12s %10s %8s\n", entities, entities,
+               std::thread::hardware_concurrency(), "threads", "movement", "particles", "frame", "speedup");
+
+    double serial = 0;
+    for (unsigned int threads = 1; threads <= 16; threads <<= 1) {
+        BenchResult result = Run(threads, entities);
+        const double frame = result.movement + result.particles;
+        if (threads == 1) serial = frame;
+        if (csv) printf("%u,%.3f,%.3f,%.3f,%.2f\n", threads, result.movement, result.particles, frame, serial / frame);
+        else
+            printf("%8u %10.3fms %10.3fms %8.3fms %7.2fx\n", threads, result.movement, result.particles, frame,
+                   serial / frame);
+    }
+
+    freelist_destroy(&BenchMemory::memory);
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include <array>
+#include <chrono>
+#include <utility>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+extern "C" {
+#include "mem/freelist.h"
+#include "mem/utils.h"
+}
+
+#include "engine/ECS.hpp"
+
+// creates, commits and destroys entities of three components out of 16 types with 64 systems registered, once
+// through the director and once through a command buffer. commits only visit the systems of the entity's archetype,
+// which were matched once by signature when the archetype was made
+// usage: ecs_commit_bench [entities] [--csv]
+
+enum {
+    ENTITIES = 100000,
+    TYPES = 16,
+    SYSTEMS = 64,
+    ROUNDS = 5,
+};
+
+typedef std::chrono::steady_clock Clock;
+
+class BenchMemory {
+public:
+    static inline FreeListMemory *memory = nullptr;
+
+    // TFastMap groups hold an __m128i
+    inline static void *Alloc(size_t size, unsigned int alignment) {
+        return freelist_alloc(memory, size, alignment > 16 ? alignment : 16);
+    }
+
+    inline static void Free(void **ptr) {
+        freelist_free(memory, ptr);
+    }
+};
+
+using TAlloc = BenchMemory;
+
+template<int N>
+struct TagComponent : public CComponent<TAlloc> {
+    float value{(float) N};
+};
+
+// writes one type and reads another, 6N + 3 is odd so the two never match
+template<int N>
+struct TagSystem : public CSystem<TAlloc, TagComponent<N % TYPES>, const TagComponent<(N * 7 + 3) % TYPES>> {
+};
+
+typedef void (*AddFn)(CDirector<TAlloc> *director, CCommandBuffer<TAlloc> *commands, CEntityId entity);
+
+template<int N>
+static void AddTag(CDirector<TAlloc> *director, CCommandBuffer<TAlloc> *commands, CEntityId entity) {
+    if (commands != nullptr) commands->AddComponent<TagComponent<N>>(entity);
+    else director->AddComponent<TagComponent<N>>(entity);
+}
+
+template<int... N>
+static void AddSystems(CDirector<TAlloc> *director, std::integer_sequence<int, N...>) {
+    (director->AddSystem<TagSystem<N>>(), ...);
+}
+
+template<int... N>
+static constexpr auto MakeAdders(std::integer_sequence<int, N...>) {
+    return std::array<AddFn, sizeof...(N)>{AddTag<N>...};
+}
+
+static const auto kAdders = MakeAdders(std::make_integer_sequence<int, TYPES>{});
+
+struct BenchResult {
+    double create;
+    double commit;
+    double destroy;
+    double buffered;
+};
+
+static inline double Millis(Clock::time_point begin, Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+static inline void AddTags(CDirector<TAlloc> *director, CCommandBuffer<TAlloc> *commands, CEntityId entity,
+                           unsigned int i) {
+    const unsigned int a = i % TYPES;
+    const unsigned int b = (a + 1 + (i / TYPES) % (TYPES - 1)) % TYPES;
+    unsigned int c = (i / (TYPES * TYPES)) % TYPES;
+    while (c == a || c == b) c = (c + 1) % TYPES;
+    kAdders[a](director, commands, entity);
+    kAdders[b](director, commands, entity);
+    kAdders[c](director, commands, entity);
+}
+
+static CDirector<TAlloc> *MakeDirector() {
+    auto *director = AllocNew<TAlloc, CDirector<TAlloc>>();
+    director->SetParallel(false);
+    AddSystems(director, std::make_integer_sequence<int, SYSTEMS>{});
+    director->Create();
+    return director;
+}
+
+static BenchResult Run(unsigned int entities, CEntityId *ids) {
+    BenchResult result{0, 0, 0, 0};
+    for (int round = 0; round < ROUNDS; round++) {
+        auto *director = MakeDirector();
+        auto begin = Clock::now();
+        for (unsigned int i = 0; i < entities; i++) {
+            ids[i] = director->CreateEntity();
+            AddTags(director, nullptr, ids[i], i);
+        }
+        auto created = Clock::now();
+        for (unsigned int i = 0; i < entities; i++) director->Commit(ids[i]);
+        auto committed = Clock::now();
+        for (unsigned int i = 0; i < entities; i++) director->DestroyEntity(ids[i]);
+        auto destroyed = Clock::now();
+        Free<TAlloc>(&director);
+
+        // a fresh director, so playback makes the archetypes as the direct run above did
+        director = MakeDirector();
+        auto record = Clock::now();
+        CCommandBuffer<TAlloc> &commands = director->Commands();
+        for (unsigned int i = 0; i < entities; i++) {
+            CEntityId entity = commands.CreateEntity();
+            AddTags(director, &commands, entity, i);
+            commands.Commit(entity);
+        }
+        director->Playback();
+        auto played = Clock::now();
+        Free<TAlloc>(&director);
+
+        result.create += Millis(begin, created);
+        result.commit += Millis(created, committed);
+        result.destroy += Millis(committed, destroyed);
+        result.buffered += Millis(record, played);
+    }
+    result.create /= ROUNDS;
+    result.commit /= ROUNDS;
+    result.destroy /= ROUNDS;
+    result.buffered /= ROUNDS;
+    return result;
+}
+
+int main(int argc, const char *argv[]) {
+    bool csv = false;
+    unsigned int entities = ENTITIES;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) csv = true;
+        else entities = (unsigned int) strtoul(argv[i], nullptr, 10);
+    }
+
+    BenchMemory::memory = make_freelist(512 * MEGABYTES);
+    if (BenchMemory::memory == nullptr) {
+        printf("ecs_commit_bench: make_freelist failed, out of memory\n");
+        return 1;
+    }
+    auto *ids = (CEntityId *) freelist_alloc(BenchMemory::memory, entities * sizeof(CEntityId), 16);
+
+    BenchResult result = Run(entities, ids);
+    if (csv) {
+        printf("entities,systems,create_ms,commit_ms,destroy_ms,buffered_ms,commit_ns\n");
+        printf("%u,%u,%.3f,%.3f,%.3f,%.3f,%.1f\n", entities, SYSTEMS, result.create, result.commit, result.destroy,
+               result.buffered, result.commit * 1e6 / entities);
+    } else {
+        printf("%u entities of 3 out of %u components, %u systems\n", entities, TYPES, SYSTEMS);
+        printf("%-28s %10.3fms\n", "create and add", result.create);
+        printf("%-28s %10.3fms %8.1fns per entity\n", "commit", result.commit, result.commit * 1e6 / entities);
+        printf("%-28s %10.3fms\n", "destroy", result.destroy);
+        printf("%-28s %10.3fms\n", "record, playback and commit", result.buffered);
+    }
+
+    freelist_free(BenchMemory::memory, (void **) &ids);
+    freelist_destroy(&BenchMemory::memory);
+    return 0;
+}
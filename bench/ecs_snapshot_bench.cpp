@@ -0,0 +1,236 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+extern "C" {
+#include "mem/freelist.h"
+#include "mem/utils.h"
+#include "mathf.h"
+}
+
+#include "engine/ECS.hpp"
+
+// saves a world of plain data components with Save and loads it back from the mapped file with Load, once into an
+// empty director and once over the world it was saved from, as a level reload would. the first load is reported on
+// its own, it is the one that faults in the heap pages every later load reuses. --truncate instead loads every
+// truncation of a small world's snapshot, each has to be refused or load the whole world
+// usage: ecs_snapshot_bench [entities] [--csv] [--truncate]
+
+enum {
+    ENTITIES = 1000000,
+    ROUNDS = 5,
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static const char *kPath = "ecs_snapshot.bin";
+
+class BenchMemory {
+public:
+    static inline FreeListMemory *memory = nullptr;
+
+    // TFastMap groups hold an __m128i
+    inline static void *Alloc(size_t size, unsigned int alignment) {
+        return freelist_alloc(memory, size, alignment > 16 ? alignment : 16);
+    }
+
+    inline static void Free(void **ptr) {
+        freelist_free(memory, ptr);
+    }
+};
+
+using TAlloc = BenchMemory;
+
+struct TransformComponent {
+    Vec3 position;
+};
+
+struct VelocityComponent {
+    Vec3 velocity;
+};
+
+struct HealthComponent {
+    float health;
+    unsigned int team;
+};
+
+struct TargetComponent {
+    CEntityId target;
+};
+
+struct MarkerComponent {
+    static constexpr bool kSparse = true;
+    unsigned int id;
+};
+
+struct MovementSystem : public CSystem<TAlloc, TransformComponent, const VelocityComponent> {
+};
+
+struct BenchResult {
+    double save;
+    double first;
+    double load;
+    double reload;
+    double size;
+    bool match;
+};
+
+static inline double Millis(Clock::time_point begin, Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+// entities come from slabs of 1024, a world this size would otherwise allocate a slab every 16 entities
+static CDirector<TAlloc> *MakeDirector() {
+    auto *director = AllocNew<TAlloc, CDirector<TAlloc>>(1024u);
+    director->SetParallel(false);
+    director->AddSystem<MovementSystem>();
+    director->Create();
+    CDirector<TAlloc>::Register<HealthComponent, TargetComponent, MarkerComponent>();
+    return director;
+}
+
+// every entity moves, half of them have health and a quarter a target
+static void Populate(CDirector<TAlloc> *director, unsigned int entities) {
+    CEntityId previous = 0;
+    for (unsigned int i = 0; i < entities; i++) {
+        auto entity = director->CreateEntity();
+        director->AddComponent<TransformComponent>(entity, vec3((float) (i % 1000), (float) (i / 1000), 0));
+        director->AddComponent<VelocityComponent>(entity, vec3(1, (float) (i % 7), 0));
+        if (i % 2 == 0) director->AddComponent<HealthComponent>(entity, 100.0f, i % 4);
+        if (i % 4 == 1) director->AddComponent<TargetComponent>(entity, previous);
+        director->Commit(entity);
+        previous = entity;
+    }
+}
+
+static double Checksum(CDirector<TAlloc> *director) {
+    double sum = 0;
+    for (const auto &tuple: director->View<TransformComponent, VelocityComponent>()) {
+        sum += std::get<TransformComponent *>(tuple)->position.x + std::get<VelocityComponent *>(tuple)->velocity.y;
+    }
+    for (const auto &tuple: director->View<HealthComponent>())
+        sum += std::get<HealthComponent *>(tuple)->team;
+    return sum;
+}
+
+static BenchResult Run(unsigned int entities) {
+    BenchResult result{0, 0, 0, 0, 0, true};
+    auto *source = MakeDirector();
+    Populate(source, entities);
+    const double expected = Checksum(source);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        auto begin = Clock::now();
+        if (!source->Save(kPath)) {
+            result.match = false;
+            break;
+        }
+        auto saved = Clock::now();
+
+        auto *director = MakeDirector();
+        auto start = Clock::now();
+        director->Load(kPath);
+        auto loaded = Clock::now();
+        result.match &= Checksum(director) == expected;
+        Free<TAlloc>(&director);
+
+        auto again = Clock::now();
+        source->Load(kPath);
+        auto reloaded = Clock::now();
+        result.match &= Checksum(source) == expected;
+
+        result.save += Millis(begin, saved);
+        if (round == 0) result.first = Millis(start, loaded);
+        else result.load += Millis(start, loaded);
+        result.reload += Millis(again, reloaded);
+    }
+    result.save /= ROUNDS;
+    result.load /= ROUNDS - 1;
+    result.reload /= ROUNDS;
+
+    FILE *file = fopen(kPath, "rb");
+    if (file != nullptr) {
+        fseek(file, 0, SEEK_END);
+        result.size = (double) ftell(file) / MEGABYTES;
+        fclose(file);
+    }
+    remove(kPath);
+    Free<TAlloc>(&source);
+    return result;
+}
+
+static bool CheckTruncated() {
+    auto *source = MakeDirector();
+    Populate(source, 100);
+    for (unsigned int i = 0; i < 10; i++) {
+        auto entity = source->CreateEntity();
+        source->AddComponent<TransformComponent>(entity, vec3((float) i, 0, 0));
+        source->AddComponent<MarkerComponent>(entity, i);
+        source->Commit(entity);
+    }
+    const double expected = Checksum(source);
+    bool ok = source->Save(kPath);
+    Free<TAlloc>(&source);
+
+    FILE *file = fopen(kPath, "rb");
+    if (file == nullptr) return false;
+    fseek(file, 0, SEEK_END);
+    const size_t size = (size_t) ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *data = (char *) malloc(size);
+    ok &= fread(data, 1, size, file) == size;
+    fclose(file);
+    remove(kPath);
+
+    auto *director = MakeDirector();
+    for (size_t length = 0; length <= size && ok; length++) {
+        // the tail padding of the last section may go without losing anything
+        const bool loaded = director->Load(data, length);
+        ok &= loaded ? Checksum(director) == expected : length < size;
+    }
+    Free<TAlloc>(&director);
+    free(data);
+    return ok;
+}
+
+int main(int argc, const char *argv[]) {
+    bool csv = false, truncate = false;
+    unsigned int entities = ENTITIES;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) csv = true;
+        else if (strcmp(argv[i], "--truncate") == 0) truncate = true;
+        else entities = (unsigned int) strtoul(argv[i], nullptr, 10);
+    }
+
+    BenchMemory::memory = make_freelist_tlsf(1024 * MEGABYTES);
+    if (BenchMemory::memory == nullptr) {
+        printf("ecs_snapshot_bench: make_freelist_tlsf failed, out of memory\n");
+        return 1;
+    }
+
+    if (truncate) {
+        const bool ok = CheckTruncated();
+        printf(ok ? "ecs_snapshot_bench: every truncation refused or loaded whole\n"
+                  : "ecs_snapshot_bench: truncated load failed, a cut snapshot loaded a different world\n");
+        freelist_destroy(&BenchMemory::memory);
+        return ok ? 0 : 1;
+    }
+
+    BenchResult result = Run(entities);
+    if (!result.match) printf("ecs_snapshot_bench: load failed, loaded world differs from the saved one\n");
+    if (csv) {
+        printf("entities,size_mb,save_ms,first_load_ms,load_ms,reload_ms\n");
+        printf("%u,%.2f,%.3f,%.3f,%.3f,%.3f\n", entities, result.size, result.save, result.first, result.load,
+               result.reload);
+    } else {
+        printf("%u entities of 2 to 4 plain components, %.2fMB snapshot\n", entities, result.size);
+        printf("%-28s %10.3fms\n", "save", result.save);
+        printf("%-28s %10.3fms\n", "first load, cold heap", result.first);
+        printf("%-28s %10.3fms\n", "load into an empty world", result.load);
+        printf("%-28s %10.3fms\n", "reload over the saved world", result.reload);
+    }
+
+    freelist_destroy(&BenchMemory::memory);
+    return result.match ? 0 : 1;
+}
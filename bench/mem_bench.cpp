@@ -0,0 +1,630 @@
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#if __linux__
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include "mem/arena.h"
+#include "mem/stack.h"
+#include "mem/freelist.h"
+#include "mem/buddy.h"
+#include "mem/slab.h"
+#include "mem/p2slab.h"
+#include "mem/pool.h"
+#include "mem/utils.h"
+}
+
+// runs the same workloads against every allocator in source/mem and the system malloc
+// usage: mem_bench [--csv]
+
+enum {
+    REGION_ORDER = 26,
+    REGION = 1 << REGION_ORDER,
+    MIN_SIZE = 16,
+    MAX_SIZE = 256,
+    BATCH = 1024,
+    ROUNDS = 200,
+    LIVE = 4096,
+    RANDOM_OPS = 1000000,
+    HANDOFF_OBJECTS = 500000,
+    HANDOFF_RING = 1024,
+    TRACE_FRAMES = 1000,
+    POOL_OBJECTS = 8192,
+};
+
+enum BenchOrder {
+    ORDER_NONE, // frees are no-ops, memory comes back on Reset
+    ORDER_LIFO,
+    ORDER_ANY,
+};
+
+typedef std::chrono::steady_clock Clock;
+
+// cost of the two clock reads around a timed call, taken off every percentile
+static float timerOverhead = 0;
+
+struct ArenaBench {
+    static constexpr const char *kName = "arena";
+    static constexpr BenchOrder kOrder = ORDER_NONE;
+    static constexpr bool kThreadSafe = false;
+    static constexpr unsigned int kMaxSize = 0;
+    static inline ArenaMemory *memory = nullptr;
+
+    static void Create() { memory = make_arena(REGION); }
+
+    static void Destroy() { arena_destroy(&memory); }
+
+    static void *Alloc(unsigned int size) { return arena_alloc(memory, size, sizeof(size_t)); }
+
+    static void Free(void *) {}
+
+    static void Reset() { arena_reset(memory); }
+
+    static void ThreadExit() {}
+
+    static double Fragmentation() { return 0.0; }
+};
+
+struct StackBench {
+    static constexpr const char *kName = "stack";
+    static constexpr BenchOrder kOrder = ORDER_LIFO;
+    static constexpr bool kThreadSafe = false;
+    static constexpr unsigned int kMaxSize = 0;
+    static inline StackMemory *memory = nullptr;
+
+    static void Create() { memory = make_stack(REGION); }
+
+    static void Destroy() { stack_destroy(&memory); }
+
+    static void *Alloc(unsigned int size) { return stack_alloc(memory, size, sizeof(size_t)); }
+
+    static void Free(void *ptr) { stack_free(memory, &ptr); }
+
+    static void Reset() {}
+
+    static void ThreadExit() {}
+
+    static double Fragmentation() { return 0.0; }
+};
+
+template<bool Tlsf>
+struct FreeListBench {
+    static constexpr const char *kName = Tlsf ? "freelist (tlsf)" : "freelist";
+    static constexpr BenchOrder kOrder = ORDER_ANY;
+    static constexpr bool kThreadSafe = false;
+    static constexpr unsigned int kMaxSize = 0;
+    static inline FreeListMemory *memory = nullptr;
+
+    static void Create() { memory = Tlsf ? make_freelist_tlsf(REGION) : make_freelist(REGION); }
+
+    static void Destroy() { freelist_destroy(&memory); }
+
+    static void *Alloc(unsigned int size) { return freelist_alloc(memory, size, sizeof(size_t)); }
+
+    static void Free(void *ptr) { freelist_free(memory, &ptr); }
+
+    static void Reset() {}
+
+    static void ThreadExit() {}
+
+    static double Fragmentation() {
+        unsigned int free = memory->total - memory->usage;
+        return free == 0 ? 0.0 : 1.0 - (double) freelist_largest(memory) / (double) free;
+    }
+};
+
+struct BuddyBench {
+    static constexpr const char *kName = "buddy";
+    static constexpr BenchOrder kOrder = ORDER_ANY;
+    static constexpr bool kThreadSafe = false;
+    static constexpr unsigned int kMaxSize = 0;
+    static inline BuddyMemory *memory = nullptr;
+
+    static void Create() { memory = make_buddy(REGION_ORDER); }
+
+    static void Destroy() { buddy_destroy(&memory); }
+
+    static void *Alloc(unsigned int size) { return buddy_alloc(memory, size); }
+
+    static void Free(void *ptr) { buddy_free(memory, &ptr); }
+
+    static void Reset() {}
+
+    static void ThreadExit() {}
+
+    static double Fragmentation() {
+        unsigned int free = memory->total - memory->usage;
+        return free == 0 ? 0.0 : 1.0 - (double) buddy_largest(memory) / (double) free;
+    }
+};
+
+struct SlabBench {
+    static constexpr const char *kName = "slab";
+    static constexpr BenchOrder kOrder = ORDER_ANY;
+    static constexpr bool kThreadSafe = false;
+    static constexpr unsigned int kMaxSize = MAX_SIZE;
+    static inline SlabMemory *memory = nullptr;
+
+    static void Create() { memory = make_slab(MAX_SIZE * 64, MAX_SIZE); }
+
+    static void Destroy() { slab_destroy(&memory); }
+
+    static void *Alloc(unsigned int) { return slab_alloc(memory); }
+
+    static void Free(void *ptr) { slab_free(memory, &ptr); }
+
+    static void Reset() {}
+
+    static void ThreadExit() {}
+
+    static double Fragmentation() { return 0.0; }
+};
+
+struct P2SlabBench {
+    static constexpr const char *kName = "p2slab (cached)";
+    static constexpr BenchOrder kOrder = ORDER_ANY;
+    static constexpr bool kThreadSafe = true;
+    static constexpr unsigned int kMaxSize = 0;
+    static inline P2SlabMemory *memory = nullptr;
+
+    static void Create() { memory = make_p2slab(64); }
+
+    static void Destroy() {
+        p2slab_cache_flush(memory);
+        p2slab_destroy(&memory);
+    }
+
+    static void *Alloc(unsigned int size) { return p2slab_alloc_cached(memory, size); }
+
+    static void Free(void *ptr) { p2slab_free_cached(memory, &ptr); }
+
+    static void Reset() {}
+
+    static void ThreadExit() { p2slab_cache_flush(memory); }
+
+    static double Fragmentation() { return 0.0; }
+};
+
+template<bool Atomic>
+struct PoolBench {
+    static constexpr const char *kName = Atomic ? "pool (lock-free)" : "pool";
+    static constexpr BenchOrder kOrder = ORDER_ANY;
+    static constexpr bool kThreadSafe = Atomic;
+    static constexpr unsigned int kMaxSize = MAX_SIZE;
+    static inline PoolMemory *memory = nullptr;
+
+    static void Create() {
+        unsigned int size = pool_size(POOL_OBJECTS * MAX_SIZE, MAX_SIZE);
+        memory = Atomic ? make_pool_atomic(size, MAX_SIZE) : make_pool(size, MAX_SIZE);
+    }
+
+    static void Destroy() { pool_destroy(&memory); }
+
+    static void *Alloc(unsigned int) { return Atomic ? pool_alloc_atomic(memory) : pool_alloc(memory); }
+
+    static void Free(void *ptr) {
+        if (Atomic) pool_free_atomic(memory, &ptr);
+        else pool_free(memory, &ptr);
+    }
+
+    static void Reset() {}
+
+    static void ThreadExit() {}
+
+    static double Fragmentation() { return 0.0; }
+};
+
+struct MallocBench {
+    static constexpr const char *kName = "malloc";
+    static constexpr BenchOrder kOrder = ORDER_ANY;
+    static constexpr bool kThreadSafe = true;
+    static constexpr unsigned int kMaxSize = 0;
+
+    static void Create() {}
+
+    static void Destroy() {}
+
+    static void *Alloc(unsigned int size) { return malloc(size); }
+
+    static void Free(void *ptr) { free(ptr); }
+
+    static void Reset() {}
+
+    static void ThreadExit() {}
+
+    static double Fragmentation() { return -1.0; }
+};
+
+static size_t ResidentBytes() {
+#if __linux__
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == nullptr) return 0;
+    unsigned long size = 0, resident = 0;
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(f);
+    return (size_t) resident * (size_t) sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+struct BenchTrace {
+    struct Event {
+        unsigned int slot;
+        unsigned int size; // 0 frees the slot
+    };
+    std::vector<Event> events;
+    unsigned int slots = 0;
+    unsigned int maxSize = 0;
+};
+
+// a frame of the game: lots of short lived strings and draw data released at the end of the frame,
+// a few component sized objects living for up to a second, and the occasional mesh sized buffer
+static BenchTrace GenerateTrace() {
+    BenchTrace trace;
+    std::mt19937 rng(7);
+    std::vector<unsigned int> freeSlots;
+    std::vector<std::pair<unsigned int, unsigned int>> deaths; // frame, slot
+    auto take = [&](unsigned int size) {
+        unsigned int slot;
+        if (freeSlots.empty()) slot = trace.slots++;
+        else {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        trace.events.push_back({slot, size});
+        trace.maxSize = std::max(trace.maxSize, size);
+        return slot;
+    };
+    auto release = [&](unsigned int slot) {
+        trace.events.push_back({slot, 0});
+        freeSlots.push_back(slot);
+    };
+
+    std::vector<unsigned int> frame;
+    for (unsigned int f = 0; f < TRACE_FRAMES; f++) {
+        for (size_t i = 0; i < deaths.size();) {
+            if (deaths[i].first == f) {
+                release(deaths[i].second);
+                deaths[i] = deaths.back();
+                deaths.pop_back();
+            } else i++;
+        }
+        frame.clear();
+        for (int i = 0; i < 150; i++)
+            frame.push_back(take(16 + rng() % 113));
+        for (int i = 0; i < 12; i++)
+            deaths.emplace_back(f + 1 + rng() % 30, take(256 + rng() % 1793));
+        if (f % 8 == 0)
+            deaths.emplace_back(f + 100 + rng() % 300, take(4096 + rng() % 61441));
+        for (unsigned int slot: frame)
+            release(slot);
+    }
+    for (auto &death: deaths)
+        release(death.second);
+    return trace;
+}
+
+struct BenchResult {
+    bool skipped = true;
+    double nsPerOp = 0;
+    double p50 = 0;
+    double p99 = 0;
+    size_t rss = 0;
+    double fragmentation = -1;
+    unsigned int failures = 0;
+};
+
+// Timed adds a clock read around every call so percentiles can be taken, the throughput pass runs without it
+template<class A, bool Timed>
+struct BenchOps {
+    std::vector<float> *latencies = nullptr;
+    unsigned int failures = 0;
+
+    inline void *Alloc(unsigned int size) {
+        void *ptr;
+        if constexpr (Timed) {
+            auto begin = Clock::now();
+            ptr = A::Alloc(size);
+            latencies->push_back(std::chrono::duration<float, std::nano>(Clock::now() - begin).count());
+        } else {
+            ptr = A::Alloc(size);
+        }
+        if (ptr == nullptr) failures++;
+        else *(volatile char *) ptr = 1;
+        return ptr;
+    }
+
+    inline void Free(void *ptr) {
+        if (ptr == nullptr) return;
+        if constexpr (Timed) {
+            auto begin = Clock::now();
+            A::Free(ptr);
+            latencies->push_back(std::chrono::duration<float, std::nano>(Clock::now() - begin).count());
+        } else {
+            A::Free(ptr);
+        }
+    }
+};
+
+struct BenchPeak {
+    size_t rss = 0;
+    double fragmentation = -1;
+};
+
+template<class A, bool Timed>
+static unsigned long long RunBatches(BenchOps<A, Timed> &ops, const std::vector<unsigned int> &sizes, bool lifo,
+                                     BenchPeak &peak) {
+    std::vector<void *> batch(BATCH);
+    size_t k = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < BATCH; i++)
+            batch[i] = ops.Alloc(sizes[k++ % sizes.size()]);
+        if (round == 0) {
+            peak.rss = ResidentBytes();
+            peak.fragmentation = A::Fragmentation();
+        }
+        if (lifo) for (int i = BATCH - 1; i >= 0; i--) ops.Free(batch[i]);
+        else for (int i = 0; i < BATCH; i++) ops.Free(batch[i]);
+        A::Reset();
+    }
+    return 2ULL * ROUNDS * BATCH;
+}
+
+template<class A, bool Timed>
+static unsigned long long RunRandom(BenchOps<A, Timed> &ops, const std::vector<unsigned int> &sizes, BenchPeak &peak) {
+    std::vector<void *> live(LIVE, nullptr);
+    std::mt19937 rng(11);
+    for (int i = 0; i < RANDOM_OPS; i++) {
+        unsigned int slot = rng() % LIVE;
+        if (live[slot] != nullptr) {
+            ops.Free(live[slot]);
+            live[slot] = nullptr;
+        } else {
+            live[slot] = ops.Alloc(sizes[i % sizes.size()]);
+        }
+    }
+    peak.rss = ResidentBytes();
+    peak.fragmentation = A::Fragmentation();
+    for (void *ptr: live) ops.Free(ptr);
+    return RANDOM_OPS + LIVE;
+}
+
+template<class A, bool Timed>
+static unsigned long long RunTrace(BenchOps<A, Timed> &ops, const BenchTrace &trace, BenchPeak &peak) {
+    std::vector<void *> slots(trace.slots, nullptr);
+    size_t half = trace.events.size() / 2;
+    for (size_t i = 0; i < trace.events.size(); i++) {
+        const auto &event = trace.events[i];
+        if (event.size == 0) {
+            ops.Free(slots[event.slot]);
+            slots[event.slot] = nullptr;
+        } else {
+            slots[event.slot] = ops.Alloc(event.size);
+        }
+        if (i == half) {
+            peak.rss = ResidentBytes();
+            peak.fragmentation = A::Fragmentation();
+        }
+    }
+    return trace.events.size();
+}
+
+// one thread allocates, the other frees what comes through a single producer single consumer ring
+template<class A, bool Timed>
+static unsigned long long RunHandoff(BenchOps<A, Timed> &producerOps, BenchOps<A, Timed> &consumerOps,
+                                     const std::vector<unsigned int> &sizes, BenchPeak &peak) {
+    std::vector<void *> ring(HANDOFF_RING);
+    std::atomic<unsigned int> head{0}, tail{0};
+
+    std::thread consumer([&]() {
+        for (unsigned int n = 0; n < HANDOFF_OBJECTS; n++) {
+            unsigned int t = tail.load(std::memory_order_relaxed);
+            while (head.load(std::memory_order_acquire) == t) std::this_thread::yield();
+            consumerOps.Free(ring[t % HANDOFF_RING]);
+            tail.store(t + 1, std::memory_order_release);
+        }
+        A::ThreadExit();
+    });
+    for (unsigned int n = 0; n < HANDOFF_OBJECTS; n++) {
+        unsigned int h = head.load(std::memory_order_relaxed);
+        while (h - tail.load(std::memory_order_acquire) == HANDOFF_RING) std::this_thread::yield();
+        ring[h % HANDOFF_RING] = producerOps.Alloc(sizes[n % sizes.size()]);
+        head.store(h + 1, std::memory_order_release);
+        if (n == HANDOFF_OBJECTS / 2) peak.rss = ResidentBytes();
+    }
+    consumer.join();
+    A::ThreadExit();
+    peak.fragmentation = A::Fragmentation();
+    return 2ULL * HANDOFF_OBJECTS;
+}
+
+enum BenchWorkload {
+    WORKLOAD_LIFO,
+    WORKLOAD_FIFO,
+    WORKLOAD_RANDOM,
+    WORKLOAD_HANDOFF,
+    WORKLOAD_TRACE,
+    WORKLOAD_COUNT,
+};
+
+static const char *workloadNames[WORKLOAD_COUNT] = {"lifo", "fifo", "random", "producer/consumer", "trace"};
+
+template<class A>
+static bool Supports(BenchWorkload workload, const BenchTrace &trace) {
+    switch (workload) {
+        case WORKLOAD_LIFO:
+            return true;
+        case WORKLOAD_FIFO:
+            return A::kOrder != ORDER_LIFO;
+        case WORKLOAD_RANDOM:
+            return A::kOrder == ORDER_ANY;
+        case WORKLOAD_HANDOFF:
+            return A::kThreadSafe;
+        case WORKLOAD_TRACE:
+            return A::kOrder == ORDER_ANY && (A::kMaxSize == 0 || trace.maxSize <= A::kMaxSize);
+        default:
+            return false;
+    }
+}
+
+template<class A, bool Timed>
+static unsigned long long RunOnce(BenchWorkload workload, const std::vector<unsigned int> &sizes,
+                                  const BenchTrace &trace, std::vector<float> *latencies, BenchPeak &peak,
+                                  unsigned int &failures) {
+    BenchOps<A, Timed> ops{latencies};
+    unsigned long long operations = 0;
+    A::Create();
+    switch (workload) {
+        case WORKLOAD_LIFO:
+            operations = RunBatches(ops, sizes, true, peak);
+            break;
+        case WORKLOAD_FIFO:
+            operations = RunBatches(ops, sizes, false, peak);
+            break;
+        case WORKLOAD_RANDOM:
+            operations = RunRandom(ops, sizes, peak);
+            break;
+        case WORKLOAD_HANDOFF: {
+            std::vector<float> consumerLatencies;
+            if (Timed) consumerLatencies.reserve(HANDOFF_OBJECTS);
+            BenchOps<A, Timed> consumerOps{&consumerLatencies};
+            operations = RunHandoff(ops, consumerOps, sizes, peak);
+            if (Timed) latencies->insert(latencies->end(), consumerLatencies.begin(), consumerLatencies.end());
+            failures += consumerOps.failures;
+            break;
+        }
+        case WORKLOAD_TRACE:
+            operations = RunTrace(ops, trace, peak);
+            break;
+        default:
+            break;
+    }
+    A::Destroy();
+    failures += ops.failures;
+    return operations;
+}
+
+template<class A>
+static BenchResult Run(BenchWorkload workload, const std::vector<unsigned int> &sizes, const BenchTrace &trace) {
+    BenchResult result;
+    if (!Supports<A>(workload, trace)) return result;
+    result.skipped = false;
+
+    size_t baseline = ResidentBytes();
+    BenchPeak peak;
+    auto begin = Clock::now();
+    unsigned long long operations = RunOnce<A, false>(workload, sizes, trace, nullptr, peak, result.failures);
+    double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+    result.nsPerOp = elapsed / (double) operations;
+    result.rss = peak.rss > baseline ? peak.rss - baseline : 0;
+    result.fragmentation = peak.fragmentation;
+
+    std::vector<float> latencies;
+    latencies.reserve(operations);
+    BenchPeak ignored;
+    unsigned int timedFailures = 0;
+    RunOnce<A, true>(workload, sizes, trace, &latencies, ignored, timedFailures);
+    if (!latencies.empty()) {
+        size_t p50 = latencies.size() / 2, p99 = latencies.size() * 99 / 100;
+        std::nth_element(latencies.begin(), latencies.begin() + p50, latencies.end());
+        result.p50 = std::max(0.0f, latencies[p50] - timerOverhead);
+        std::nth_element(latencies.begin(), latencies.begin() + p99, latencies.end());
+        result.p99 = std::max(0.0f, latencies[p99] - timerOverhead);
+    }
+    return result;
+}
+
+static void Print(const char *allocator, BenchWorkload workload, const BenchResult &r, bool csv) {
+    if (csv) {
+        if (r.skipped) printf("%s,%s,,,,,,\n", allocator, workloadNames[workload]);
+        else
+            printf("%s,%s,%.1f,%.0f,%.0f,%zu,%.4f,%u\n", allocator, workloadNames[workload], r.nsPerOp, r.p50, r.p99,
+                   r.rss / 1024, r.fragmentation, r.failures);
+        return;
+    }
+    if (r.skipped) {
+        printf("%-18s %-18s %10s\n", allocator, workloadNames[workload], "n/a");
+        return;
+    }
+    char fragmentation[16];
+    if (r.fragmentation < 0) snprintf(fragmentation, sizeof(fragmentation), "-");
+    else snprintf(fragmentation, sizeof(fragmentation), "%.3f", r.fragmentation);
+    printf("%-18s %-18s %10.1f %8.0f %8.0f %10zu %8s", allocator, workloadNames[workload], r.nsPerOp, r.p50, r.p99,
+           r.rss / 1024, fragmentation);
+    if (r.failures) printf("  (%u failed)", r.failures);
+    printf("\n");
+}
+
+template<class A>
+static void RunAll(const std::vector<unsigned int> &sizes, const BenchTrace &trace, bool csv) {
+    for (int w = 0; w < WORKLOAD_COUNT; w++)
+        Print(A::kName, (BenchWorkload) w, Run<A>((BenchWorkload) w, sizes, trace), csv);
+}
+
+// aligned blocks are cut out of a larger free block, freeing them has to merge the gap in front back in so the
+// heap ends up as the single free block it started as
+static bool CheckTlsfAligned() {
+    FreeListMemory *memory = make_freelist_tlsf(REGION);
+    const unsigned int usage = memory->usage;
+    const unsigned int largest = freelist_largest(memory);
+    bool ok = true;
+    for (unsigned int alignment: {32u, 64u, 256u, 4096u}) {
+        void *small = freelist_alloc(memory, MIN_SIZE, sizeof(size_t));
+        void *ptr = freelist_alloc(memory, MAX_SIZE, alignment);
+        ok &= ptr != nullptr && ((size_t) ptr & (alignment - 1)) == 0;
+        freelist_free(memory, &ptr);
+        freelist_free(memory, &small);
+        ok &= memory->usage == usage && freelist_largest(memory) == largest;
+    }
+    freelist_destroy(&memory);
+    return ok;
+}
+
+int main(int argc, const char *argv[]) {
+    bool csv = argc > 1 && strcmp(argv[1], "--csv") == 0;
+
+    if (!CheckTlsfAligned()) {
+        printf("mem_bench: freelist (tlsf) aligned free failed, heap did not merge back into one block\n");
+        return 1;
+    }
+
+    std::vector<unsigned int> sizes(BATCH * 8);
+    std::mt19937 rng(3);
+    for (auto &size: sizes) size = MIN_SIZE + rng() % (MAX_SIZE - MIN_SIZE + 1);
+    BenchTrace trace = GenerateTrace();
+
+    std::vector<float> empty(100000);
+    for (auto &sample: empty) {
+        auto begin = Clock::now();
+        sample = std::chrono::duration<float, std::nano>(Clock::now() - begin).count();
+    }
+    std::nth_element(empty.begin(), empty.begin() + empty.size() / 2, empty.end());
+    timerOverhead = empty[empty.size() / 2];
+
+    if (csv) printf("allocator,workload,ns_op,p50_ns,p99_ns,rss_kb,fragmentation,failures\n");
+    else
+        printf("%-18s %-18s %10s %8s %8s %10s %8s\n", "allocator", "workload", "ns/op", "p50", "p99", "rss KB",
+               "frag");
+
+    RunAll<ArenaBench>(sizes, trace, csv);
+    RunAll<StackBench>(sizes, trace, csv);
+    RunAll<FreeListBench<false>>(sizes, trace, csv);
+    RunAll<FreeListBench<true>>(sizes, trace, csv);
+    RunAll<BuddyBench>(sizes, trace, csv);
+    RunAll<SlabBench>(sizes, trace, csv);
+    RunAll<P2SlabBench>(sizes, trace, csv);
+    RunAll<PoolBench<false>>(sizes, trace, csv);
+    RunAll<PoolBench<true>>(sizes, trace, csv);
+    RunAll<MallocBench>(sizes, trace, csv);
+    return 0;
+}
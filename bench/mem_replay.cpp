@@ -0,0 +1,420 @@
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+
+#if __linux__
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include "mem/arena.h"
+#include "mem/stack.h"
+#include "mem/freelist.h"
+#include "mem/buddy.h"
+#include "mem/p2slab.h"
+#include "mem/trace.h"
+#include "mem/utils.h"
+}
+
+// re-executes a trace written with MEM_TRACE_MODE against any allocator configuration
+// usage: mem_replay <trace> [--all kind] [--as name=kind] [--size name=bytes] [--scale factor]
+// kinds: arena, stack, freelist, tlsf, buddy, p2slab, malloc, sizes take a K, M or G suffix
+
+enum ReplayKind {
+    REPLAY_ARENA,
+    REPLAY_STACK,
+    REPLAY_FREELIST,
+    REPLAY_TLSF,
+    REPLAY_BUDDY,
+    REPLAY_P2SLAB,
+    REPLAY_MALLOC,
+    REPLAY_KINDS
+};
+
+static const char *replayKinds[REPLAY_KINDS] = {"arena", "stack", "freelist", "tlsf", "buddy", "p2slab", "malloc"};
+static const char *recordedKinds[MEM_STATS_KINDS] = {"arena", "stack", "freelist", "buddy", "slab", "p2slab", "pool"};
+
+typedef std::chrono::steady_clock Clock;
+
+enum {
+    MIN_CAPACITY = 1 << 20,
+    RSS_SAMPLE = 4096,
+};
+
+struct ReplayBlock {
+    void *ptr;
+    unsigned int size;
+};
+
+struct ReplayAllocator {
+    std::string name;
+    MemStatsKind recorded = MEM_STATS_ARENA;
+    ReplayKind kind = REPLAY_MALLOC;
+    unsigned int recordedTotal = 0;
+    unsigned int capacity = 0;
+    void *memory = nullptr;
+    std::unordered_map<unsigned long long, ReplayBlock> live;
+    size_t allocs = 0;
+    size_t frees = 0;
+    size_t resets = 0;
+    size_t failures = 0;
+    size_t unknownFrees = 0;
+    double ns = 0;
+    size_t mallocUsage = 0;
+    size_t usage = 0;
+    size_t peak = 0;
+
+    void Create() {
+        switch (kind) {
+            case REPLAY_ARENA:
+                memory = make_arena_virtual(capacity, 0);
+                break;
+            case REPLAY_STACK:
+                memory = make_stack(capacity);
+                break;
+            case REPLAY_FREELIST:
+                memory = make_freelist(capacity);
+                break;
+            case REPLAY_TLSF:
+                memory = make_freelist_tlsf(capacity);
+                break;
+            case REPLAY_BUDDY:
+                memory = make_buddy((unsigned int) std::ceil(std::log2((double) capacity)));
+                break;
+            case REPLAY_P2SLAB:
+                memory = make_p2slab(64);
+                break;
+            default:
+                break;
+        }
+        usage = peak = Usage();
+    }
+
+    void Destroy() {
+        for (auto &block: live)
+            Free(block.second);
+        live.clear();
+        switch (kind) {
+            case REPLAY_ARENA:
+                arena_destroy((ArenaMemory **) &memory);
+                break;
+            case REPLAY_STACK:
+                stack_destroy((StackMemory **) &memory);
+                break;
+            case REPLAY_FREELIST:
+            case REPLAY_TLSF:
+                freelist_destroy((FreeListMemory **) &memory);
+                break;
+            case REPLAY_BUDDY:
+                buddy_destroy((BuddyMemory **) &memory);
+                break;
+            case REPLAY_P2SLAB:
+                p2slab_destroy((P2SlabMemory **) &memory);
+                break;
+            default:
+                break;
+        }
+    }
+
+    size_t Usage() const {
+        switch (kind) {
+            case REPLAY_ARENA:
+                return ((ArenaMemory *) memory)->usage;
+            case REPLAY_STACK:
+                return ((StackMemory *) memory)->usage;
+            case REPLAY_FREELIST:
+            case REPLAY_TLSF:
+                return ((FreeListMemory *) memory)->usage;
+            case REPLAY_BUDDY:
+                return ((BuddyMemory *) memory)->usage;
+            case REPLAY_P2SLAB:
+                return ((P2SlabMemory *) memory)->usage;
+            default:
+                return mallocUsage;
+        }
+    }
+
+    void *Alloc(unsigned int size, unsigned int alignment) {
+        switch (kind) {
+            case REPLAY_ARENA:
+                return arena_alloc((ArenaMemory *) memory, size, alignment);
+            case REPLAY_STACK:
+                return stack_alloc((StackMemory *) memory, size, alignment);
+            case REPLAY_FREELIST:
+            case REPLAY_TLSF:
+                return freelist_alloc((FreeListMemory *) memory, size, alignment);
+            case REPLAY_BUDDY:
+                return buddy_alloc((BuddyMemory *) memory, size);
+            case REPLAY_P2SLAB:
+                return p2slab_alloc((P2SlabMemory *) memory, size);
+            default: {
+                void *ptr = aligned_alloc(alignment, MEMORY_SPACE((size_t) (size), (size_t) (alignment)));
+                if (ptr != nullptr) mallocUsage += size;
+                return ptr;
+            }
+        }
+    }
+
+    bool Free(ReplayBlock block) {
+        switch (kind) {
+            case REPLAY_ARENA:
+                return true;
+            case REPLAY_STACK:
+                return stack_free((StackMemory *) memory, &block.ptr);
+            case REPLAY_FREELIST:
+            case REPLAY_TLSF:
+                return freelist_free((FreeListMemory *) memory, &block.ptr);
+            case REPLAY_BUDDY:
+                return buddy_free((BuddyMemory *) memory, &block.ptr);
+            case REPLAY_P2SLAB:
+                return p2slab_free((P2SlabMemory *) memory, &block.ptr);
+            default:
+                free(block.ptr);
+                mallocUsage -= block.size;
+                return true;
+        }
+    }
+
+    // allocators without a reset of their own give back every live block
+    void Reset() {
+        switch (kind) {
+            case REPLAY_ARENA:
+                arena_reset((ArenaMemory *) memory);
+                break;
+            case REPLAY_STACK:
+                stack_reset((StackMemory *) memory);
+                break;
+            case REPLAY_FREELIST:
+            case REPLAY_TLSF:
+                freelist_reset((FreeListMemory *) memory);
+                break;
+            default:
+                for (auto &block: live)
+                    Free(block.second);
+                break;
+        }
+        live.clear();
+    }
+};
+
+static size_t ResidentBytes() {
+#if __linux__
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == nullptr) return 0;
+    unsigned long size = 0, resident = 0;
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(f);
+    return (size_t) resident * (size_t) sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+static int ParseKind(const char *name) {
+    for (int i = 0; i < REPLAY_KINDS; i++)
+        if (strcmp(name, replayKinds[i]) == 0)
+            return i;
+    printf("replay: unknown allocator kind %s\n", name);
+    return -1;
+}
+
+static unsigned long long ParseBytes(const char *text) {
+    char *end = nullptr;
+    unsigned long long value = strtoull(text, &end, 10);
+    switch (end != nullptr ? *end : 0) {
+        case 'k':
+        case 'K':
+            return value * KILOBYTES;
+        case 'm':
+        case 'M':
+            return value * MEGABYTES;
+        case 'g':
+        case 'G':
+            return value * (unsigned long long) GIGABYTES;
+        default:
+            return value;
+    }
+}
+
+// slab and pool traces carry a single object size, the power of two slab serves them without configuration
+static ReplayKind DefaultKind(MemStatsKind kind) {
+    switch (kind) {
+        case MEM_STATS_ARENA:
+            return REPLAY_ARENA;
+        case MEM_STATS_STACK:
+            return REPLAY_STACK;
+        case MEM_STATS_FREELIST:
+            return REPLAY_TLSF;
+        case MEM_STATS_BUDDY:
+            return REPLAY_BUDDY;
+        default:
+            return REPLAY_P2SLAB;
+    }
+}
+
+static bool LoadTrace(const char *path, std::vector<MemTraceRecord> &records, std::vector<MemTraceAllocator> &table) {
+    FILE *f = fopen(path, "rb");
+    if (f == nullptr) {
+        printf("replay: load failed, can't open %s\n", path);
+        return false;
+    }
+    MemTraceHeader header;
+    MemTraceFooter footer;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 && header.magic == MEM_TRACE_MAGIC &&
+              header.version == MEM_TRACE_VERSION && header.recordSize == sizeof(MemTraceRecord);
+    if (!ok) printf("replay: load failed, %s is not a version %d trace\n", path, MEM_TRACE_VERSION);
+
+    ok = ok && fseek(f, -(long) sizeof(footer), SEEK_END) == 0 && fread(&footer, sizeof(footer), 1, f) == 1 &&
+         footer.magic == MEM_TRACE_MAGIC;
+    if (!ok) printf("replay: load failed, %s has no footer, was mem_trace_stop called?\n", path);
+
+    if (ok) {
+        table.resize(footer.allocators);
+        records.resize(footer.records);
+        const long tableSize = (long) (sizeof(MemTraceAllocator) * table.size() + sizeof(footer));
+        ok = fseek(f, -tableSize, SEEK_END) == 0 &&
+             fread(table.data(), sizeof(MemTraceAllocator), table.size(), f) == table.size() &&
+             fseek(f, sizeof(header), SEEK_SET) == 0 &&
+             fread(records.data(), sizeof(MemTraceRecord), records.size(), f) == records.size();
+        if (!ok) printf("replay: load failed, %s is truncated\n", path);
+    }
+    fclose(f);
+    return ok;
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 2) {
+        printf("usage: mem_replay <trace> [--all kind] [--as name=kind] [--size name=bytes] [--scale factor]\n");
+        return 1;
+    }
+    int all = -1;
+    double scale = 1.0;
+    std::vector<std::pair<std::string, int>> kinds;
+    std::vector<std::pair<std::string, unsigned long long>> sizes;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        const char *value = argv[i + 1];
+        const char *split = strchr(value, '=');
+        if (strcmp(argv[i], "--all") == 0) {
+            if ((all = ParseKind(value)) < 0) return 1;
+        } else if (strcmp(argv[i], "--scale") == 0) {
+            scale = atof(value);
+        } else if (split != nullptr && strcmp(argv[i], "--as") == 0) {
+            int kind = ParseKind(split + 1);
+            if (kind < 0) return 1;
+            kinds.emplace_back(std::string(value, split), kind);
+        } else if (split != nullptr && strcmp(argv[i], "--size") == 0) {
+            sizes.emplace_back(std::string(value, split), ParseBytes(split + 1));
+        } else {
+            printf("replay: unknown option %s %s\n", argv[i], value);
+            return 1;
+        }
+    }
+
+    std::vector<MemTraceRecord> records;
+    std::vector<MemTraceAllocator> table;
+    if (!LoadTrace(argv[1], records, table)) return 1;
+
+    std::vector<ReplayAllocator> allocators(table.size());
+    for (size_t i = 0; i < table.size(); i++) {
+        ReplayAllocator &a = allocators[i];
+        a.recorded = table[i].kind < MEM_STATS_KINDS ? (MemStatsKind) table[i].kind : MEM_STATS_ARENA;
+        a.name = table[i].name[0] ? std::string(table[i].name, strnlen(table[i].name, MEM_TRACE_NAME))
+                                  : std::string(recordedKinds[a.recorded]) + "#" + std::to_string(i);
+        a.recordedTotal = table[i].total;
+        a.kind = all >= 0 ? (ReplayKind) all : DefaultKind(a.recorded);
+        for (auto &kind: kinds)
+            if (kind.first == a.name) a.kind = (ReplayKind) kind.second;
+        unsigned long long capacity = std::max((unsigned long long) ((double) a.recordedTotal * scale),
+                                               (unsigned long long) MIN_CAPACITY);
+        for (auto &size: sizes)
+            if (size.first == a.name) capacity = size.second;
+        a.capacity = (unsigned int) std::min(capacity, 0xFFFFFFFFULL);
+        a.Create();
+    }
+
+    std::vector<float> empty(100000);
+    for (auto &sample: empty) {
+        auto begin = Clock::now();
+        sample = std::chrono::duration<float, std::nano>(Clock::now() - begin).count();
+    }
+    std::nth_element(empty.begin(), empty.begin() + empty.size() / 2, empty.end());
+    const double timerOverhead = empty[empty.size() / 2];
+
+    const size_t rssBase = ResidentBytes();
+    size_t rssPeak = rssBase;
+    size_t footprint = 0, footprintPeak = 0;
+    for (auto &a: allocators)
+        footprint += a.usage;
+    footprintPeak = footprint;
+
+    auto wallBegin = Clock::now();
+    for (size_t i = 0; i < records.size(); i++) {
+        const MemTraceRecord &record = records[i];
+        if (record.allocator >= allocators.size()) continue;
+        ReplayAllocator &a = allocators[record.allocator];
+
+        if (record.op == MEM_TRACE_ALLOC) {
+            // failed in the recorded session, nothing to pair a free with
+            if (record.address == 0) continue;
+            const unsigned int alignment = record.alignment ? record.alignment : sizeof(size_t);
+            auto begin = Clock::now();
+            void *ptr = a.Alloc(record.size, alignment);
+            a.ns += std::chrono::duration<double, std::nano>(Clock::now() - begin).count() - timerOverhead;
+            a.allocs++;
+            if (ptr == nullptr) a.failures++;
+            else a.live[record.address] = {ptr, record.size};
+        } else if (record.op == MEM_TRACE_FREE) {
+            auto block = a.live.find(record.address);
+            if (block == a.live.end()) {
+                a.unknownFrees++;
+                continue;
+            }
+            auto begin = Clock::now();
+            const bool ok = a.Free(block->second);
+            a.ns += std::chrono::duration<double, std::nano>(Clock::now() - begin).count() - timerOverhead;
+            a.frees++;
+            if (!ok) a.failures++;
+            a.live.erase(block);
+        } else if (record.op == MEM_TRACE_RESET) {
+            auto begin = Clock::now();
+            a.Reset();
+            a.ns += std::chrono::duration<double, std::nano>(Clock::now() - begin).count() - timerOverhead;
+            a.resets++;
+        }
+
+        const size_t usage = a.Usage();
+        footprint = footprint + usage - a.usage;
+        a.usage = usage;
+        a.peak = std::max(a.peak, usage);
+        footprintPeak = std::max(footprintPeak, footprint);
+        if (i % RSS_SAMPLE == 0)
+            rssPeak = std::max(rssPeak, ResidentBytes());
+    }
+    const double wall = std::chrono::duration<double, std::milli>(Clock::now() - wallBegin).count();
+    rssPeak = std::max(rssPeak, ResidentBytes());
+
+    const double recorded = records.empty() ? 0.0 : (double) records.back().time / 1e6;
+    printf("trace: %zu records, %zu allocators, %.1f ms recorded\n\n", records.size(), table.size(), recorded);
+    printf("%-16s %-9s %-9s %10s %10s %10s %8s %8s %8s %10s\n", "allocator", "recorded", "replay", "capacity KB",
+           "allocs", "frees", "resets", "failed", "ns/op", "peak KB");
+    double inside = 0;
+    for (auto &a: allocators) {
+        const size_t ops = a.allocs + a.frees + a.resets;
+        inside += a.ns;
+        printf("%-16s %-9s %-9s %10u %10zu %10zu %8zu %8zu %8.1f %10zu\n", a.name.c_str(), recordedKinds[a.recorded],
+               replayKinds[a.kind], a.capacity / KILOBYTES, a.allocs, a.frees, a.resets, a.failures + a.unknownFrees,
+               ops ? std::max(0.0, a.ns) / (double) ops : 0.0, a.peak / KILOBYTES);
+    }
+    printf("\nreplay: %.1f ms total, %.1f ms inside allocators, peak footprint %zu KB, peak rss growth %zu KB\n",
+           wall, std::max(0.0, inside) / 1e6, footprintPeak / KILOBYTES, (rssPeak - rssBase) / KILOBYTES);
+
+    for (auto &a: allocators)
+        a.Destroy();
+    return 0;
+}
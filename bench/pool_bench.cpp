@@ -0,0 +1,66 @@
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+
+extern "C" {
+#include "mem/pool.h"
+#include "mem/utils.h"
+}
+
+// hammers the lock-free pool from every hardware thread, every object is stamped with its
+// owner on alloc so a block handed out twice at the same time is caught
+
+enum {
+    OBJECT_SIZE = 32,
+    BATCH = 64,
+    ROUNDS = 20000,
+};
+
+int main() {
+    unsigned int threads = std::thread::hardware_concurrency();
+    if (threads < 4) threads = 4;
+
+    unsigned int objects = threads * BATCH;
+    PoolMemory *pool = make_pool_atomic(pool_size(objects * OBJECT_SIZE, OBJECT_SIZE), OBJECT_SIZE);
+    unsigned int initialUsage = pool->usage;
+
+    std::atomic<unsigned int> doubleHandouts{0};
+    std::atomic<unsigned int> failedFrees{0};
+    std::vector<std::thread> workers;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (unsigned int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            void *batch[BATCH];
+            int owner = (int) t + 1;
+            for (int round = 0; round < ROUNDS; round++) {
+                int n = 0;
+                for (; n < BATCH; n++) {
+                    batch[n] = pool_alloc_atomic(pool);
+                    if (batch[n] == nullptr) break;
+                    if (__atomic_exchange_n((int *) batch[n], owner, __ATOMIC_RELAXED) != 0)
+                        doubleHandouts++;
+                }
+                for (int i = 0; i < n; i++) {
+                    if (__atomic_exchange_n((int *) batch[i], 0, __ATOMIC_RELAXED) != owner)
+                        doubleHandouts++;
+                    if (!pool_free_atomic(pool, &batch[i]))
+                        failedFrees++;
+                }
+            }
+        });
+    }
+    for (auto &w: workers) w.join();
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+    unsigned long long operations = 2ULL * threads * ROUNDS * BATCH;
+    printf("pool (lock-free): %u threads, %llu ops in %.0fms, %.1f ns/op\n",
+           threads, operations, elapsed, elapsed * 1e6 / (double) operations * threads);
+    printf("  double handouts: %u, failed frees: %u, leaked: %u bytes\n",
+           doubleHandouts.load(), failedFrees.load(), initialUsage - pool->usage);
+
+    pool_destroy(&pool);
+    return doubleHandouts.load() == 0 && failedFrees.load() == 0 ? 0 : 1;
+}
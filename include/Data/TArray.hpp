@@ -73,6 +73,11 @@ public:
         Reserve(8);
     }
 
+    // drops every element but keeps the capacity
+    inline void Reset() {
+        mLength = 0;
+    }
+
     inline void Fit() {
         Reserve(NEXTPOW2(mLength));
     }
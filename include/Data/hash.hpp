@@ -55,6 +55,16 @@ inline uint64_t hash_type<unsigned int>(const unsigned int &key, uint64_t seed)
     return general_hash_function(converter.bytes, 4, seed);
 }
 
+// uint64_t on LP64 targets
+template<>
+inline uint64_t hash_type<unsigned long>(const unsigned long &key, uint64_t seed) {
+    union {
+        unsigned long value;
+        char bytes[sizeof(unsigned long)];
+    } converter{key};
+    return general_hash_function(converter.bytes, sizeof(unsigned long), seed);
+}
+
 template<>
 inline uint64_t hash_type<unsigned long long>(const unsigned long long &key, uint64_t seed) {
     union {
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+// fixed set of worker threads running one batch of indexed jobs at a time, the calling thread takes jobs as well.
+// a worker only claims jobs of the batch it woke up for, so Run can return as soon as every claimed job finished
+class CJobPool {
+public:
+    static constexpr unsigned int kMaxWorkers = 63;
+
+    explicit inline CJobPool() : CJobPool(std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 0) {}
+
+    explicit inline CJobPool(unsigned int workers) : mWorkers(workers < kMaxWorkers ? workers : kMaxWorkers) {
+        for (unsigned int i = 0; i < mWorkers; i++)
+            mThreads[i] = std::thread(&CJobPool::work, this, i + 1);
+    }
+
+    CJobPool(const CJobPool &) = delete;
+
+    CJobPool &operator=(const CJobPool &) = delete;
+
+    inline ~CJobPool() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mWake.notify_all();
+        for (unsigned int i = 0; i < mWorkers; i++)
+            mThreads[i].join();
+    }
+
+    // runs job(index) for every index below count and returns once all of them finished
+    template<class F>
+    inline void Run(unsigned int count, F &&job) {
+        using TJob = std::remove_reference_t<F>;
+        if (count == 0) return;
+        if (mWorkers == 0 || count == 1) {
+            for (unsigned int i = 0; i < count; i++) job(i);
+            return;
+        }
+
+        unsigned int batch;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mInvoke = [](void *context, unsigned int index) { (*(TJob *) context)(index); };
+            mContext = (void *) &job;
+            mCount.store(count, std::memory_order_relaxed);
+            batch = ++mBatch;
+            mNext.store((unsigned long long) batch << 32, std::memory_order_release);
+        }
+        mWake.notify_all();
+        drain(batch);
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mIdle.wait(lock, [this] { return mActive == 0; });
+    }
+
+    // workers plus the calling thread
+    [[nodiscard]]
+    inline unsigned int Threads() const { return mWorkers + 1; }
+
+    // 0 on any thread but a worker, workers count from 1 in the pool that started them
+    static inline unsigned int ThreadIndex() { return sThread; }
+
+private:
+    static inline thread_local unsigned int sThread = 0;
+
+    void (*mInvoke)(void *context, unsigned int index){nullptr};
+    void *mContext{nullptr};
+    std::atomic<unsigned int> mCount{0};
+    unsigned int mBatch{0};
+    unsigned int mActive{0}; // workers inside a batch
+    bool mStop{false};
+    std::atomic<unsigned long long> mNext{0}; // batch in the high 32 bits, next job in the low 32 bits
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mIdle;
+    std::thread mThreads[kMaxWorkers];
+    unsigned int mWorkers;
+
+    inline void drain(unsigned int batch) {
+        for (;;) {
+            unsigned long long next = mNext.load(std::memory_order_acquire);
+            do {
+                if ((unsigned int) (next >> 32) != batch || (unsigned int) next >= mCount.load(std::memory_order_relaxed)) return;
+            } while (!mNext.compare_exchange_weak(next, next + 1, std::memory_order_acq_rel, std::memory_order_acquire));
+            mInvoke(mContext, (unsigned int) next);
+        }
+    }
+
+    inline void work(unsigned int thread) {
+        sThread = thread;
+        unsigned int seen = 0;
+        std::unique_lock<std::mutex> lock(mMutex);
+        for (;;) {
+            mWake.wait(lock, [this, seen] { return mStop || mBatch != seen; });
+            if (mStop) return;
+            seen = mBatch;
+            mActive++;
+            lock.unlock();
+            drain(seen);
+            lock.lock();
+            if (--mActive == 0) mIdle.notify_one();
+        }
+    }
+};
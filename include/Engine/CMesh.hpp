@@ -130,7 +130,11 @@ public:
             TArray<Vec3, TAlloc> positions;
             TArray<Vec3, TAlloc> normals;
             TArray<Vec2, TAlloc> coords;
-            while ((line = readline_stack(f, &cursor)) != nullptr) {
+            while (true) {
+                // everything read and split for one line goes away with it
+                TScratchScope scratch;
+                if ((line = readline_stack(f, &cursor)) == nullptr)
+                    break;
                 auto token = firstToken(line);
                 if (token == "o") {
                     auto name = lastToken(line);
@@ -143,51 +147,40 @@ public:
                     TStringView *split = split_stack(lastToken(line), ' ');
                     unsigned int n = stack_n(alloc->stack) / sizeof(TStringView);
                     if (n == 3) positions.Add(vec3(stof(split[0]), stof(split[1]), stof(split[2])));
-                    stack_free(alloc->stack, (void **) &split);
                 } else if (token == "vn") {
                     TStringView *split = split_stack(lastToken(line), ' ');
                     unsigned int n = stack_n(alloc->stack) / sizeof(TStringView);
                     if (n == 3) normals.Add(vec3(stof(split[0]), stof(split[1]), stof(split[2])));
-                    stack_free(alloc->stack, (void **) &split);
                 } else if (token == "vt") {
                     TStringView *split = split_stack(lastToken(line), ' ');
                     unsigned int n = stack_n(alloc->stack) / sizeof(TStringView);
                     if (n == 2) coords.Add(vec2(stof(split[0]), stof(split[1])));
-                    stack_free(alloc->stack, (void **) &split);
                 } else if (token == "f") {
                     TStringView *faces = split_stack(lastToken(line), ' ');
                     unsigned int nFaces = stack_n(alloc->stack) / sizeof(TStringView);
-                    {
-                        TMeshVertex *vertices;
-                        if (!(vertices = generateVertices_stack(faces, nFaces, positions, normals, coords))) {
-                            stack_free(alloc->stack, (void **) &vertices);
-                            stack_free(alloc->stack, (void **) &faces);
-                            stack_free(alloc->stack, (void **) &line);
-                            Free<TAlloc>(&group);
-                            return nullptr;
-                        }
 
-                        unsigned int nVertices = stack_n(alloc->stack) / sizeof(TMeshVertex);
+                    TMeshVertex *vertices;
+                    if (!(vertices = generateVertices_stack(faces, nFaces, positions, normals, coords))) {
+                        fclose(f);
+                        Free<TAlloc>(&group);
+                        return nullptr;
+                    }
 
-                        for (int i = 0; i < nVertices; i++) {
-                            mesh->Vertices.Add(vertices[i]);
-                        }
+                    unsigned int nVertices = stack_n(alloc->stack) / sizeof(TMeshVertex);
 
-                        int *indices;
-                        if ((indices = triangulate_stack(vertices, nVertices))) {
-                            unsigned int nIndices = stack_n(alloc->stack) / sizeof(int);
-                            for (int i = 0; i < nIndices; i++) {
-                                int ind = (mesh->Vertices.Length() - nVertices) + indices[i];
-                                mesh->Indices.Add(ind);
-                            }
-                            stack_free(alloc->stack, (void **) &indices);
-                        }
+                    for (int i = 0; i < nVertices; i++) {
+                        mesh->Vertices.Add(vertices[i]);
+                    }
 
-                        stack_free(alloc->stack, (void **) &vertices);
+                    int *indices;
+                    if ((indices = triangulate_stack(vertices, nVertices))) {
+                        unsigned int nIndices = stack_n(alloc->stack) / sizeof(int);
+                        for (int i = 0; i < nIndices; i++) {
+                            int ind = (mesh->Vertices.Length() - nVertices) + indices[i];
+                            mesh->Indices.Add(ind);
+                        }
                     }
-                    stack_free(alloc->stack, (void **) &faces);
                 }
-                stack_free(alloc->stack, (void **) &line);
             }
             fclose(f);
         }
@@ -299,21 +292,19 @@ private:
 
         auto buffer = (TStringView *) stack_alloc(alloc->stack, size, sizeof(size_t));
         if (line.empty()) {
-            stack_expand(alloc->stack, n * size);
-            return buffer;
+            return (TStringView *) stack_expand(alloc->stack, n * size);
         }
 
         int prev = 0;
         for (int i = 0; i <= line.length(); i++) {
             if (i == line.length() || line[i] == token) {
-                stack_expand(alloc->stack, (n + 1) * size);
+                buffer = (TStringView *) stack_expand(alloc->stack, (n + 1) * size);
                 buffer[n] = line.substr(prev, i - prev);
                 n++;
                 prev = i + 1;
             }
         }
 
-        stack_expand(alloc->stack, n * size);
-        return buffer;
+        return (TStringView *) stack_expand(alloc->stack, n * size);
     }
 };
\ No newline at end of file
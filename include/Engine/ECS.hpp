@@ -4,15 +4,21 @@
 extern "C" {
 #include "mem/alloc.h"
 #include "mem/slab.h"
+#include "mem/page.h"
 #include "debug.h"
 }
 
+#include <algorithm>
 #include <type_traits>
 #include <typeinfo>
+#include <utility>
+#include <tuple>
 #include <new>
 #include <cassert>
+#include <cstring>
 
 #include "engine/Memory.hpp"
+#include "engine/CJobPool.hpp"
 #include "data/TFastMap.hpp"
 #include "data/TArray.hpp"
 #include "data/TArrayStack.hpp"
@@ -27,9 +33,18 @@ class CComponent;
 template<class TAlloc>
 class CBaseSystem;
 
+template<class TAlloc>
+class CArchetype;
+
 template<class TAlloc>
 class CDirector;
 
+template<class TAlloc>
+class CCommandBuffer;
+
+template<class TAlloc>
+class CComponentPool;
+
 typedef uint64_t CECSIdType;
 
 typedef CECSIdType CComponentId;
@@ -38,22 +53,102 @@ typedef CECSIdType CEntityId;
 
 namespace ECSInternals {
 
+    static constexpr uint32_t kNoIndex = UINT32_MAX;
+
+    static constexpr uint32_t kChunkSize = 16 * KILOBYTES;
+
+    // component ids are handed out densely from 1 and double as bit indices in a signature
+    static constexpr uint32_t kMaxComponents = 256;
+
+    // rows a ParallelEach job takes at least, batches are kept a multiple of kBatchAlign rows
+    static constexpr uint32_t kBatch = 1024;
+    static constexpr uint32_t kBatchAlign = 16;
+
+    // entity handles carry the table slot in the low 32 bits and the slot generation in the high 32 bits
+    static inline uint32_t EntityIndex(CEntityId id) { return (uint32_t) id; }
+
+    static inline uint32_t EntityGeneration(CEntityId id) { return (uint32_t) (id >> 32); }
+
+    static inline CEntityId MakeEntityId(uint32_t index, uint32_t generation) {
+        return ((CEntityId) generation << 32) | index;
+    }
+
+    // generation 0 never names a live slot, command buffers hand it out for entities created before playback
+    static inline bool IsPlaceholder(CEntityId id) { return EntityGeneration(id) == 0; }
+
     static inline CComponentId nextComponentId() {
         static CComponentId lastID{1};
+        assert(lastID < kMaxComponents && "ECS: Too many component types for a signature.\n");
         return lastID++;
     }
 
+    // set of component ids, an archetype holds what a system iterates when its signature contains the system's
+    struct CSignature {
+        uint64_t words[kMaxComponents / 64]{};
+
+        inline void Set(CComponentId id) { words[id >> 6] |= 1ULL << (id & 63); }
+
+        inline void Clear(CComponentId id) { words[id >> 6] &= ~(1ULL << (id & 63)); }
+
+        // fn(id) for every id in the set, lowest first
+        template<class F>
+        inline void Each(F &&fn) const {
+            for (uint32_t i = 0; i < kMaxComponents / 64; i++)
+                for (uint64_t word = words[i]; word != 0; word &= word - 1)
+                    fn((CComponentId) (i * 64 + __builtin_ctzll(word)));
+        }
+
+        [[nodiscard]]
+        inline bool Has(CComponentId id) const { return id < kMaxComponents && (words[id >> 6] >> (id & 63)) & 1; }
+
+        [[nodiscard]]
+        inline bool Contains(const CSignature &other) const {
+            for (uint32_t i = 0; i < kMaxComponents / 64; i++)
+                if ((words[i] & other.words[i]) != other.words[i]) return false;
+            return true;
+        }
+
+        // ids in the set below id, which is the column of id in an archetype with this signature
+        [[nodiscard]]
+        inline uint32_t Rank(CComponentId id) const {
+            uint32_t rank = 0;
+            for (uint32_t i = 0; i < (id >> 6); i++) rank += __builtin_popcountll(words[i]);
+            return rank + __builtin_popcountll(words[id >> 6] & ((1ULL << (id & 63)) - 1));
+        }
+
+        inline bool operator==(const CSignature &other) const {
+            for (uint32_t i = 0; i < kMaxComponents / 64; i++)
+                if (words[i] != other.words[i]) return false;
+            return true;
+        }
+    };
+
     static inline CSystemId nextSystemId() {
         static CSystemId lastID{1};
         return lastID++;
     }
 
-    template<class TAlloc, class T>
-    static inline CComponentId GetComponentTypeId() noexcept {
-        static_assert(std::is_base_of_v<CComponent<TAlloc>, T>, "T must be a base class of Component");
-        static CComponentId id{nextComponentId()};
-        return id;
-    }
+    // T as declared in Types, const when the system only reads it
+    template<class T, class ...Types>
+    struct TDeclared {
+        using type = T;
+    };
+
+    template<class T, class First, class ...Rest>
+    struct TDeclared<T, First, Rest...> {
+        using type = std::conditional_t<std::is_same_v<std::remove_const_t<T>, std::remove_const_t<First>>,
+                First, typename TDeclared<T, Rest...>::type>;
+    };
+
+    // position of T in Types, ignoring const, sizeof...(Types) when missing
+    template<class T, class ...Types>
+    struct TIndex : std::integral_constant<uint32_t, 0> {
+    };
+
+    template<class T, class First, class ...Rest>
+    struct TIndex<T, First, Rest...> : std::integral_constant<uint32_t,
+            std::is_same_v<std::remove_const_t<T>, std::remove_const_t<First>> ? 0 : 1 + TIndex<T, Rest...>::value> {
+    };
 
     template<class TAlloc, class T>
     static inline CSystemId GetSystemTypeId() noexcept {
@@ -62,6 +157,92 @@ namespace ECSInternals {
         return id;
     }
 
+    // a component declaring `static constexpr bool kSparse = true` is kept in a sparse set of its type instead of an
+    // archetype column, adding or removing it never moves the entity's other components
+    template<class T, class = void>
+    struct TSparse : std::false_type {
+    };
+
+    template<class T>
+    struct TSparse<T, std::void_t<decltype(T::kSparse)>> : std::bool_constant<T::kSparse> {
+    };
+
+    template<class T>
+    static constexpr bool IsSparse = TSparse<std::remove_const_t<T>>::value;
+
+    // what an archetype needs to lay out a component column, components are relocated with memcpy
+    struct CComponentInfo {
+        CComponentId id;
+        uint32_t size;
+        uint32_t alignment;
+
+        void (*destroy)(void *component); // nullptr when trivially destructible
+
+        bool sparse;
+        bool plain; // trivially copyable, snapshots can hold it
+        const char *name;
+        uint64_t hash; // names the type in snapshots, see CDirector::Save
+
+        inline void Destroy(void *component) const {
+            if (destroy != nullptr) destroy(component);
+        }
+    };
+
+    template<class T>
+    static inline void DestroyComponent(void *component) { ((T *) component)->~T(); }
+
+    // fnv-1a of the type name mixed with its layout, the name is compiler specific so snapshots are too
+    static inline uint64_t HashComponent(const char *name, uint32_t size, uint32_t alignment, bool sparse) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (const char *c = name; *c != '\0'; c++) hash = (hash ^ (uint8_t) *c) * 1099511628211ULL;
+        const uint64_t layout = ((uint64_t) size << 32) | ((uint64_t) alignment << 1) | (sparse ? 1 : 0);
+        for (uint32_t i = 0; i < 8; i++) hash = (hash ^ (uint8_t) (layout >> (i * 8))) * 1099511628211ULL;
+        return hash;
+    }
+
+    // infos by component id of every type named so far with TAlloc, nullptr for ids of other allocators
+    template<class TAlloc>
+    static inline const CComponentInfo **Components() {
+        static const CComponentInfo *components[kMaxComponents]{};
+        return components;
+    }
+
+    template<class TAlloc>
+    static inline const CComponentInfo *Register(const CComponentInfo *info) {
+        Components<TAlloc>()[info->id] = info;
+        return info;
+    }
+
+    // components derive from CComponent or are plain data, which has no entity pointer or virtual hooks and relies
+    // on CDirector::OnAdd and OnRemove instead. const T is a read only declaration of T and shares its info
+    template<class TAlloc, class T>
+    static inline const CComponentInfo *GetComponentInfo() noexcept {
+        static_assert(std::is_base_of_v<CComponent<TAlloc>, T> || std::is_trivially_copyable_v<T>,
+                      "T must derive from Component or be trivially copyable");
+        if constexpr (std::is_const_v<T>) {
+            return GetComponentInfo<TAlloc, std::remove_const_t<T>>();
+        } else {
+            static const CComponentInfo info{nextComponentId(), sizeof(T), alignof(T),
+                                             std::is_trivially_destructible_v<T> ? nullptr : DestroyComponent<T>,
+                                             IsSparse<T>, std::is_trivially_copyable_v<T>, typeid(T).name(),
+                                             HashComponent(typeid(T).name(), sizeof(T), alignof(T), IsSparse<T>)};
+            static const CComponentInfo *registered{Register<TAlloc>(&info)};
+            return registered;
+        }
+    }
+
+    template<class TAlloc, class T>
+    static inline CComponentId GetComponentTypeId() noexcept {
+        return GetComponentInfo<TAlloc, T>()->id;
+    }
+
+    // plain data without a constructor taking args is built as an aggregate
+    template<class T, class... Args>
+    static inline T *Construct(void *memory, Args &&...args) {
+        if constexpr (std::is_constructible_v<T, Args...>) return new(memory) T(std::forward<Args>(args)...);
+        else return new(memory) T{std::forward<Args>(args)...};
+    }
+
 
     template<class TAlloc>
     inline void *ecs_global_alloc(size_t size) {
@@ -75,55 +256,504 @@ namespace ECSInternals {
 
 }
 
+// entities with the same component set, kept in fixed size chunks laid out as entity ids, row states, the newest
+// ticks of each column, one column per component type and then the added and changed ticks of each column's rows.
+// rows never move inside an archetype so a component stays put until its entity is destroyed or gains another
+// component, freed rows are reused by the next entity moving in
+template<class TAlloc>
+class CArchetype {
+    friend class CDirector<TAlloc>;
+    friend class CEntity<TAlloc>;
+
+    template<class, class...>
+    friend
+    class CArchetypeView;
+
+public:
+    static constexpr uint8_t kRowFree = 0;
+    static constexpr uint8_t kRowPending = 1; // created but not committed, systems skip it
+    static constexpr uint8_t kRowLive = 2;
+
+    struct TChunk {
+        uint32_t count; // rows handed out so far
+        uint32_t used; // pending and live rows
+        uint32_t free; // first free row below count, the next one is kept in its entity id
+        uint32_t _padding;
+    };
+
+private:
+    static constexpr uint32_t kHeader = 64;
+
+    TArray<const ECSInternals::CComponentInfo *, TAlloc> mInfos; // sorted by component id
+    ECSInternals::CSignature mSignature;
+    TArray<uint32_t, TAlloc> mOffsets;
+    TArray<uint32_t, TAlloc> mTicks; // added ticks of a column, its changed ticks follow
+    TArray<TChunk *, TAlloc> mChunks;
+    TArray<CBaseSystem<TAlloc> *, TAlloc> mSystems; // systems matching this component set
+    TFastMap<CComponentId, CArchetype *, TAlloc> mEdges; // archetype reached by adding one component
+    TFastMap<CComponentId, CArchetype *, TAlloc> mRemoves; // and by removing one, nullptr when none is left
+    uint32_t mCapacity{0};
+    uint32_t mStates{0};
+    uint32_t mNewest{0};
+    uint32_t mLength{0};
+    uint32_t mHint{0}; // no chunk before it has a free row
+
+    inline bool full(const TChunk *chunk) const {
+        return chunk->free == ECSInternals::kNoIndex && chunk->count == mCapacity;
+    }
+
+    inline TChunk *grow() {
+        auto *created = (TChunk *) Alloc<TAlloc>(ECSInternals::kChunkSize, 64);
+        assert(created != nullptr && "ECS: Insufficient memory for a chunk.\n");
+        *created = TChunk{0, 0, ECSInternals::kNoIndex, 0};
+        memset(Newest(created), 0, Columns() * 2 * sizeof(uint32_t));
+        mChunks.Add(created);
+        return created;
+    }
+
+    inline uint32_t allocate(CEntityId id, uint8_t state, uint32_t &chunkIndex) {
+        while (mHint < (uint32_t) mChunks.Length() && full(mChunks[mHint]))
+            mHint++;
+        if (mHint == (uint32_t) mChunks.Length()) grow();
+        TChunk *chunk = mChunks[mHint];
+        uint32_t row = chunk->free;
+        if (row != ECSInternals::kNoIndex)
+            chunk->free = (uint32_t) Ids(chunk)[row];
+        else
+            row = chunk->count++;
+        Ids(chunk)[row] = id;
+        States(chunk)[row] = state;
+        chunk->used++;
+        if (state == kRowLive) mLength++;
+        chunkIndex = mHint;
+        return row;
+    }
+
+    inline void release(uint32_t chunkIndex, uint32_t row) {
+        TChunk *chunk = mChunks[chunkIndex];
+        if (States(chunk)[row] == kRowLive) mLength--;
+        States(chunk)[row] = kRowFree;
+        Ids(chunk)[row] = chunk->free;
+        chunk->free = row;
+        chunk->used--;
+        if (chunkIndex < mHint) mHint = chunkIndex;
+    }
+
+    inline void destroy(uint32_t chunkIndex, uint32_t row) {
+        for (uint32_t column = 0; column < Columns(); column++)
+            mInfos[column]->Destroy(Component(chunkIndex, column, row));
+        release(chunkIndex, row);
+    }
+
+    // the chunk's newest ticks are stored relaxed, ParallelEach jobs may mark rows of one chunk at the same time
+    inline void touch(TChunk *chunk, uint32_t column, uint32_t row, uint32_t added, uint32_t changed) {
+        uint32_t *newest = Newest(chunk) + column * 2;
+        if (added != 0) {
+            Added(chunk, column)[row] = added;
+            if (__atomic_load_n(&newest[0], __ATOMIC_RELAXED) < added) __atomic_store_n(&newest[0], added, __ATOMIC_RELAXED);
+        }
+        Changed(chunk, column)[row] = changed;
+        if (__atomic_load_n(&newest[1], __ATOMIC_RELAXED) < changed) __atomic_store_n(&newest[1], changed, __ATOMIC_RELAXED);
+    }
+
+    inline void touch(uint32_t chunkIndex, uint32_t column, uint32_t row, uint32_t added, uint32_t changed) {
+        touch(mChunks[chunkIndex], column, row, added, changed);
+    }
+
+    inline void commit(uint32_t chunkIndex, uint32_t row) {
+        uint8_t &state = States(mChunks[chunkIndex])[row];
+        if (state == kRowPending) {
+            state = kRowLive;
+            mLength++;
+        }
+    }
+
+    // drops every row and chunk, the components must have been destroyed
+    inline void clear() {
+        while (!mChunks.Empty()) {
+            TChunk *chunk = mChunks.Pop();
+            Free<TAlloc>((void **) &chunk);
+        }
+        mLength = 0;
+        mHint = 0;
+    }
+
+    inline void Fit() {
+        while (!mChunks.Empty() && mChunks[mChunks.Length() - 1]->used == 0) {
+            TChunk *chunk = mChunks.Pop();
+            Free<TAlloc>((void **) &chunk);
+        }
+        if (mHint > (uint32_t) mChunks.Length()) mHint = mChunks.Length();
+        mChunks.Fit();
+        mSystems.Fit();
+        mEdges.Fit();
+        mRemoves.Fit();
+    }
+
+public:
+    explicit inline CArchetype(const ECSInternals::CComponentInfo *const *infos, uint32_t length) {
+        uint32_t rowSize = sizeof(CEntityId) + sizeof(uint8_t);
+        uint32_t slack = sizeof(uint32_t) * (1 + length * 2);
+        for (uint32_t i = 0; i < length; i++) {
+            mInfos.Add(infos[i]);
+            mSignature.Set(infos[i]->id);
+            rowSize += infos[i]->size + 2 * sizeof(uint32_t);
+            slack += infos[i]->alignment;
+        }
+        mCapacity = (ECSInternals::kChunkSize - kHeader - slack) / rowSize;
+        assert(mCapacity > 0 && "ECS: Component set does not fit in a chunk.\n");
+
+        uint32_t offset = kHeader + mCapacity * sizeof(CEntityId);
+        mStates = offset;
+        offset += mCapacity;
+        mNewest = MEMORY_SPACE(offset, sizeof(uint32_t));
+        offset = mNewest + length * 2 * sizeof(uint32_t);
+        for (uint32_t i = 0; i < length; i++) {
+            offset = MEMORY_SPACE(offset, infos[i]->alignment);
+            mOffsets.Add(offset);
+            offset += mCapacity * infos[i]->size;
+        }
+        offset = MEMORY_SPACE(offset, sizeof(uint32_t));
+        for (uint32_t i = 0; i < length; i++) {
+            mTicks.Add(offset);
+            offset += mCapacity * 2 * sizeof(uint32_t);
+        }
+    }
+
+    explicit inline CArchetype(const CArchetype &) = delete;
+
+    inline ~CArchetype() {
+        for (uint32_t c = 0; c < (uint32_t) mChunks.Length(); c++) {
+            TChunk *chunk = mChunks[c];
+            for (uint32_t row = 0; row < chunk->count; row++)
+                if (States(chunk)[row] != kRowFree)
+                    for (uint32_t column = 0; column < Columns(); column++)
+                        mInfos[column]->Destroy(Component(c, column, row));
+            Free<TAlloc>((void **) &chunk);
+        }
+    }
+
+    inline const ECSInternals::CSignature &Signature() const { return mSignature; }
+
+    inline int Column(CComponentId id) {
+        return mSignature.Has(id) ? (int) mSignature.Rank(id) : -1;
+    }
+
+    inline const ECSInternals::CComponentInfo *Info(uint32_t column) { return mInfos[column]; }
+
+    inline uint32_t Columns() { return mInfos.Length(); }
+
+    inline uint32_t Chunks() { return mChunks.Length(); }
+
+    inline TChunk *Chunk(uint32_t index) { return mChunks[index]; }
+
+    inline CEntityId *Ids(TChunk *chunk) { return (CEntityId *) ((char *) chunk + kHeader); }
+
+    inline uint8_t *States(TChunk *chunk) { return (uint8_t *) chunk + mStates; }
+
+    inline char *Column(TChunk *chunk, uint32_t column) { return (char *) chunk + mOffsets[column]; }
+
+    // tick the director had when the row's component of the column was added or last marked changed
+    inline uint32_t *Added(TChunk *chunk, uint32_t column) { return (uint32_t *) ((char *) chunk + mTicks[column]); }
+
+    inline uint32_t *Changed(TChunk *chunk, uint32_t column) { return Added(chunk, column) + mCapacity; }
+
+    // newest added and changed tick of each column in the chunk, chunks older than a system's last run are skipped
+    inline uint32_t *Newest(TChunk *chunk) { return (uint32_t *) ((char *) chunk + mNewest); }
+
+    inline void *Component(uint32_t chunkIndex, uint32_t column, uint32_t row) {
+        return Column(mChunks[chunkIndex], column) + (size_t) row * mInfos[column]->size;
+    }
+
+    // committed entities
+    [[nodiscard]]
+    inline uint32_t Length() const { return mLength; }
+
+    // rows per chunk
+    [[nodiscard]]
+    inline uint32_t Capacity() const { return mCapacity; }
+};
+
 template<class TAlloc>
 class CEntity {
     friend class CDirector<TAlloc>;
 
 private:
-    using ComponentMap = TFastMap<CComponentId, CComponent<TAlloc> *, TAlloc>;
-    ComponentMap mComponents;
     CEntityId mEntityId;
+    CDirector<TAlloc> *mDirector;
+    CArchetype<TAlloc> *mArchetype{nullptr};
+    uint32_t mChunk{0};
+    uint32_t mRow{0};
+    bool mCommitted{false};
+    ECSInternals::CSignature mSparse; // sparse components the entity holds
 
 public:
-    explicit inline CEntity(CEntityId id) : mEntityId(id) {}
+    explicit inline CEntity(CDirector<TAlloc> *director, CEntityId id) : mEntityId(id), mDirector(director) {}
 
     explicit inline CEntity(const CEntity &) = delete;
 
     virtual ~CEntity() = default;
 
-    template<class T>
-    inline void AddComponent(T *component) {
-        CComponentId id = ECSInternals::GetComponentTypeId<TAlloc, T>();
-        if (mComponents.Contains(id)) {
-            printf("Entity: Component %s already assigned to entity.\n", typeid(T).name());
-            return;
-        }
-        mComponents.Set(id, component);
+    // component of type id in the archetype row or in its sparse set, nullptr when the entity has none
+    inline void *Component(CComponentId id) {
+        if (mSparse.Has(id)) return mDirector->mPools[id]->Get(mEntityId);
+        const int column = mArchetype != nullptr ? mArchetype->Column(id) : -1;
+        return column >= 0 ? mArchetype->Component(mChunk, column, mRow) : nullptr;
     }
 
     template<class T>
     inline T *GetComponent() {
-        CComponentId id = ECSInternals::GetComponentTypeId<TAlloc, T>();
-        const auto &component = mComponents.Get(id);
-        if (component == nullptr) {
+        void *component = Component(ECSInternals::GetComponentTypeId<TAlloc, T>());
+        if (component == nullptr)
             printf("Entity: Component %s not found.\n", typeid(T).name());
-            return nullptr;
-        }
-        return (T *) (*component);
+        return (T *) component;
     }
 
     template<class T>
     inline bool HasComponent() {
-        CComponentId id = ECSInternals::GetComponentTypeId<TAlloc, T>();
-        return mComponents.Contains(id);
+        const CComponentId id = ECSInternals::GetComponentTypeId<TAlloc, T>();
+        return mSparse.Has(id) || (mArchetype != nullptr && mArchetype->Column(id) >= 0);
     }
 
-    inline ComponentMap *Components() { return &mComponents; }
+    // shows the component to systems walking Changed on its type, sparse components are not tracked
+    inline void MarkChanged(CComponentId id) {
+        const int column = mArchetype != nullptr ? mArchetype->Column(id) : -1;
+        if (column >= 0) mArchetype->touch(mChunk, column, mRow, 0, mDirector->mTick);
+    }
+
+    template<class T>
+    inline void MarkChanged() { MarkChanged(ECSInternals::GetComponentTypeId<TAlloc, T>()); }
+
+    inline CArchetype<TAlloc> *Archetype() { return mArchetype; }
+
+    [[nodiscard]]
+    inline bool Committed() const { return mCommitted; }
 
     [[nodiscard]]
     inline const CEntityId &Id() const { return mEntityId; }
 };
 
+// dense entity table, destroying an entity bumps the generation of its slot so stale handles stop resolving
+// and the slot goes on a free list to be recycled, lookups are an index and a compare
+template<class TAlloc>
+class CEntityTable {
+private:
+    struct TSlot {
+        CEntity<TAlloc> *entity;
+        uint32_t generation;
+        uint32_t next; // next free slot while this one is unused
+    };
+
+    TArray<TSlot, TAlloc> mSlots;
+    uint32_t mFree{ECSInternals::kNoIndex};
+    uint32_t mLength{0};
+
+public:
+    explicit inline CEntityTable() = default;
+
+    explicit inline CEntityTable(const CEntityTable &) = delete;
+
+    inline CEntityId Acquire() {
+        uint32_t index = mFree;
+        if (index != ECSInternals::kNoIndex) {
+            mFree = mSlots[index].next;
+        } else {
+            index = mSlots.Length();
+            mSlots.Add(TSlot{nullptr, 1, ECSInternals::kNoIndex});
+        }
+        mLength++;
+        return ECSInternals::MakeEntityId(index, mSlots[index].generation);
+    }
+
+    inline void Set(CEntityId id, CEntity<TAlloc> *entity) {
+        mSlots[ECSInternals::EntityIndex(id)].entity = entity;
+    }
+
+    inline CEntity<TAlloc> *Get(CEntityId id) {
+        const uint32_t index = ECSInternals::EntityIndex(id);
+        if (index >= (uint32_t) mSlots.Length())
+            return nullptr;
+        const TSlot &slot = mSlots[index];
+        return slot.generation == ECSInternals::EntityGeneration(id) ? slot.entity : nullptr;
+    }
+
+    inline bool Contains(CEntityId id) { return Get(id) != nullptr; }
+
+    inline void Release(CEntityId id) {
+        const uint32_t index = ECSInternals::EntityIndex(id);
+        TSlot &slot = mSlots[index];
+        slot.entity = nullptr;
+        if (++slot.generation == 0) slot.generation = 1;
+        slot.next = mFree;
+        mFree = index;
+        mLength--;
+    }
+
+    // slots in index order, unused ones hold nullptr
+    inline CEntity<TAlloc> *At(uint32_t index) { return mSlots[index].entity; }
+
+    inline uint32_t Generation(uint32_t index) { return mSlots[index].generation; }
+
+    // drops every slot for size unused ones, Restore fills them from a snapshot and Link frees what is left
+    inline void Reset(uint32_t size) {
+        mSlots.Reset();
+        mSlots.Reserve((int) size + 1);
+        for (uint32_t i = 0; i < size; i++) mSlots.Add(TSlot{nullptr, 1, ECSInternals::kNoIndex});
+        mFree = ECSInternals::kNoIndex;
+        mLength = 0;
+    }
+
+    inline void Restore(uint32_t index, uint32_t generation, CEntity<TAlloc> *entity) {
+        mSlots[index].generation = generation;
+        mSlots[index].entity = entity;
+    }
+
+    // puts the slots without an entity on the free list, lowest first
+    inline void Link() {
+        mFree = ECSInternals::kNoIndex;
+        mLength = 0;
+        for (uint32_t i = mSlots.Length(); i-- > 0;) {
+            if (mSlots[i].entity != nullptr) {
+                mLength++;
+            } else {
+                mSlots[i].next = mFree;
+                mFree = i;
+            }
+        }
+    }
+
+    inline uint32_t Size() { return mSlots.Length(); }
+
+    inline uint32_t Length() const { return mLength; }
+
+    inline uint32_t Capacity() { return mSlots.Capacity(); }
+
+    inline void Fit() { mSlots.Fit(); }
+};
+
+// components of one sparse type packed next to their entity ids, pages indexed by entity slot hold the dense index.
+// removing one moves the last component into the hole, so pointers into the pool only last until the next add or
+// remove of the type
+template<class TAlloc>
+class CComponentPool {
+private:
+    static constexpr uint32_t kPage = 1024; // entity slots per page
+
+    const ECSInternals::CComponentInfo *mInfo;
+    TArray<CEntityId, TAlloc> mIds;
+    TArray<uint32_t *, TAlloc> mPages; // nullptr until one of its slots is used
+    char *mDense{nullptr};
+    uint32_t mCapacity{0};
+
+    inline uint32_t &slot(CEntityId id) {
+        const uint32_t index = ECSInternals::EntityIndex(id);
+        const uint32_t page = index / kPage;
+        while ((uint32_t) mPages.Length() <= page) mPages.Add(nullptr);
+        if (mPages[page] == nullptr) {
+            mPages[page] = Alloc<TAlloc, uint32_t>(kPage);
+            memset(mPages[page], 0xff, kPage * sizeof(uint32_t));
+        }
+        return mPages[page][index % kPage];
+    }
+
+    inline void reserve(uint32_t capacity) {
+        char *dense = capacity > 0 ? (char *) Alloc<TAlloc>((size_t) capacity * mInfo->size, mInfo->alignment) : nullptr;
+        assert((capacity == 0 || dense != nullptr) && "ECS: Insufficient memory for a component pool.\n");
+        if (mDense != nullptr) {
+            memcpy(dense, mDense, (size_t) Length() * mInfo->size);
+            Free<TAlloc>((void **) &mDense);
+        }
+        mDense = dense;
+        mCapacity = capacity;
+    }
+
+public:
+    explicit inline CComponentPool(const ECSInternals::CComponentInfo *info) : mInfo(info) {}
+
+    explicit inline CComponentPool(const CComponentPool &) = delete;
+
+    inline ~CComponentPool() {
+        for (uint32_t i = 0; i < Length(); i++) mInfo->Destroy(At(i));
+        if (mDense != nullptr) Free<TAlloc>((void **) &mDense);
+        for (auto page: mPages)
+            if (page != nullptr) Free<TAlloc>((void **) &page);
+    }
+
+    // dense index of the entity's component, kNoIndex when it has none
+    inline uint32_t Index(CEntityId id) {
+        const uint32_t index = ECSInternals::EntityIndex(id);
+        const uint32_t page = index / kPage;
+        if (page >= (uint32_t) mPages.Length() || mPages[page] == nullptr) return ECSInternals::kNoIndex;
+        const uint32_t dense = mPages[page][index % kPage];
+        return dense != ECSInternals::kNoIndex && mIds[dense] == id ? dense : ECSInternals::kNoIndex;
+    }
+
+    inline void *Get(CEntityId id) {
+        const uint32_t index = Index(id);
+        return index != ECSInternals::kNoIndex ? At(index) : nullptr;
+    }
+
+    // room for the entity's component at the end of the dense array, left unconstructed
+    inline void *Emplace(CEntityId id) {
+        assert(Index(id) == ECSInternals::kNoIndex && "ECS: entity already holds the component");
+        if (Length() == mCapacity) reserve(mCapacity > 0 ? mCapacity << 1 : 16);
+        slot(id) = Length();
+        mIds.Add(id);
+        return At(Length() - 1);
+    }
+
+    inline bool Remove(CEntityId id) {
+        const uint32_t index = Index(id);
+        if (index == ECSInternals::kNoIndex) return false;
+        mInfo->Destroy(At(index));
+        const uint32_t last = Length() - 1;
+        if (index != last) {
+            memcpy(At(index), At(last), mInfo->size);
+            mIds[index] = mIds[last];
+            slot(mIds[index]) = index;
+        }
+        mIds.Pop();
+        slot(id) = ECSInternals::kNoIndex;
+        return true;
+    }
+
+    // orders the dense array by entity slot, so walking it visits the entity table and other pools front to back
+    inline void Sort() {
+        const uint32_t length = Length();
+        TArray<uint32_t, TAlloc> order(length > 8 ? length : 8);
+        for (uint32_t i = 0; i < length; i++) order.Add(i);
+        std::sort(order.Ptr(), order.Ptr() + length, [this](uint32_t a, uint32_t b) {
+            return ECSInternals::EntityIndex(mIds[a]) < ECSInternals::EntityIndex(mIds[b]);
+        });
+        TArray<CEntityId, TAlloc> ids(mIds.Capacity());
+        char *dense = length > 0 ? (char *) Alloc<TAlloc>((size_t) mCapacity * mInfo->size, mInfo->alignment) : nullptr;
+        for (uint32_t i = 0; i < length; i++) {
+            memcpy(dense + (size_t) i * mInfo->size, At(order[i]), mInfo->size);
+            ids.Add(mIds[order[i]]);
+            slot(mIds[order[i]]) = i;
+        }
+        if (dense == nullptr) return;
+        Free<TAlloc>((void **) &mDense);
+        mDense = dense;
+        mIds.Reset();
+        for (uint32_t i = 0; i < length; i++) mIds.Add(ids[i]);
+    }
+
+    inline const ECSInternals::CComponentInfo *Info() { return mInfo; }
+
+    inline CEntityId *Ids() { return mIds.Ptr(); }
+
+    inline void *At(uint32_t index) { return mDense + (size_t) index * mInfo->size; }
+
+    inline uint32_t Length() { return mIds.Length(); }
+
+    inline void Fit() {
+        reserve(Length());
+        mIds.Fit();
+        mPages.Fit();
+    }
+};
+
 template<class TAlloc>
 class CComponent {
     friend class CDirector<TAlloc>;
@@ -138,8 +768,11 @@ public:
 
     virtual void Create() {};
 
-    template<class T>
-    inline void AddComponent(T *component) { mEntity->template AddComponent<T>(component); }
+    // moves the entity to another archetype unless T is sparse, this component is relocated and must not be used afterwards
+    template<class T, class... Args>
+    inline T *AddComponent(Args &&...args) {
+        return mDirector->template AddComponent<T>(mEntityId, std::forward<Args>(args)...);
+    }
 
     template<class T>
     inline T *GetComponent() { return mEntity->template GetComponent<T>(); }
@@ -150,21 +783,454 @@ public:
     [[nodiscard]]
     inline const CEntityId &EntityId() const { return mEntityId; }
 
-    inline const CEntity<TAlloc> *Entity() { return mEntity; }
+    inline const CEntity<TAlloc> *Entity() { return mEntity; }
+
+    inline const CDirector<TAlloc> *Director() { return mDirector; }
+
+protected:
+    CEntityId mEntityId{0};
+    CEntity<TAlloc> *mEntity{nullptr};
+    CDirector<TAlloc> *mDirector{nullptr};
+
+    inline void SetEntity(CDirector<TAlloc> *director, const CEntityId &id, CEntity<TAlloc> *entity) {
+        mEntityId = id;
+        mEntity = entity;
+        mDirector = director;
+        Create();
+    }
+};
+
+// committed rows of every archetype holding all of Types, walked chunk by chunk
+template<class TAlloc, class ...Types>
+class CArchetypeView {
+public:
+    // where the tuple's components sit, so plain data components can be marked changed
+    struct TRow {
+        CArchetype<TAlloc> *archetype;
+        typename CArchetype<TAlloc>::TChunk *chunk;
+        uint32_t row;
+    };
+
+    using CTuple = std::tuple<std::add_pointer_t<Types>..., TRow>;
+
+private:
+    static_assert(!(ECSInternals::IsSparse<Types> || ...), "sparse components are walked with CDirector::View");
+
+    static constexpr uint32_t kTypes = sizeof...(Types);
+
+    struct TMatch {
+        CArchetype<TAlloc> *archetype;
+        uint32_t columns[kTypes];
+    };
+
+    TArray<TMatch, TAlloc> mMatches;
+    ECSInternals::CSignature mSignature;
+
+    template<size_t... I>
+    static inline CTuple at(CArchetype<TAlloc> *archetype, typename CArchetype<TAlloc>::TChunk *chunk,
+                            char *const *columns, uint32_t row, std::index_sequence<I...>) {
+        return CTuple(((std::add_pointer_t<Types>) columns[I] + row)..., TRow{archetype, chunk, row});
+    }
+
+public:
+    // rows of one matched archetype, counted across its chunks, chunks before the last one are always full
+    struct TBatch {
+        uint32_t match;
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    class Iterator {
+    private:
+        CArchetypeView *mView;
+        uint32_t mMatch;
+        uint32_t mEnd;
+        uint32_t mChunk{0};
+        uint32_t mRow{0};
+        typename CArchetype<TAlloc>::TChunk *mCurrent{nullptr};
+        const uint8_t *mStates{nullptr};
+        char *mColumns[kTypes]{};
+        CTuple mTuple;
+
+        // stops on the first live row at or after the current position
+        inline void seek() {
+            while (mMatch < mEnd) {
+                TMatch &match = mView->mMatches[mMatch];
+                CArchetype<TAlloc> *archetype = match.archetype;
+                if (mChunk < archetype->Chunks()) {
+                    if (mCurrent == nullptr) {
+                        mCurrent = archetype->Chunk(mChunk);
+                        mStates = archetype->States(mCurrent);
+                        for (uint32_t i = 0; i < kTypes; i++)
+                            mColumns[i] = archetype->Column(mCurrent, match.columns[i]);
+                    }
+                    for (; mRow < mCurrent->count; mRow++)
+                        if (mStates[mRow] == CArchetype<TAlloc>::kRowLive) return;
+                    mChunk++;
+                } else {
+                    mMatch++;
+                    mChunk = 0;
+                }
+                mRow = 0;
+                mCurrent = nullptr;
+            }
+        }
+
+
+    public:
+        explicit inline Iterator(CArchetypeView *view, uint32_t match, uint32_t end)
+                : mView(view), mMatch(match), mEnd(end) { seek(); }
+
+        inline Iterator &operator++() {
+            ++mRow;
+            seek();
+            return *this;
+        }
+
+        inline bool operator!=(const Iterator &other) const {
+            return mMatch != other.mMatch || mChunk != other.mChunk || mRow != other.mRow;
+        }
+
+        inline CTuple &operator*() {
+            mTuple = at(mView->mMatches[mMatch].archetype, mCurrent, mColumns, mRow, std::index_sequence_for<Types...>{});
+            return mTuple;
+        }
+    };
+
+    explicit inline CArchetypeView() {
+        (mSignature.Set(ECSInternals::GetComponentTypeId<TAlloc, Types>()), ...);
+    }
+
+    explicit inline CArchetypeView(TArray<CArchetype<TAlloc> *, TAlloc> &archetypes) : CArchetypeView() {
+        for (auto archetype: archetypes) Match(archetype);
+    }
+
+    explicit inline CArchetypeView(const CArchetypeView &) = delete;
+
+    // adds the archetype when it holds every type of the view
+    inline bool Match(CArchetype<TAlloc> *archetype) {
+        if (!archetype->Signature().Contains(mSignature)) return false;
+        const CComponentId ids[kTypes] = {ECSInternals::GetComponentTypeId<TAlloc, Types>()...};
+        TMatch match{archetype, {}};
+        for (uint32_t i = 0; i < kTypes; i++) match.columns[i] = archetype->Column(ids[i]);
+        mMatches.Add(match);
+        return true;
+    }
+
+    inline Iterator begin() { return Iterator(this, 0, mMatches.Length()); }
+
+    inline Iterator end() { return Iterator(this, mMatches.Length(), mMatches.Length()); }
+
+    inline int Length() {
+        int length = 0;
+        for (const auto &match: mMatches) length += (int) match.archetype->Length();
+        return length;
+    }
+
+    // cuts the rows handed out so far into ranges of batch rows
+    inline void Split(uint32_t batch, TArray<TBatch, TAlloc> &batches) {
+        batches.Reset();
+        for (uint32_t m = 0; m < (uint32_t) mMatches.Length(); m++) {
+            CArchetype<TAlloc> *archetype = mMatches[m].archetype;
+            const uint32_t chunks = archetype->Chunks();
+            if (archetype->Length() == 0 || chunks == 0) continue;
+            const uint32_t rows = (chunks - 1) * archetype->Capacity() + archetype->Chunk(chunks - 1)->count;
+            for (uint32_t begin = 0; begin < rows; begin += batch)
+                batches.Add(TBatch{m, begin, begin + batch < rows ? begin + batch : rows});
+        }
+    }
+
+    // calls fn with every committed row of the batch
+    template<class F>
+    inline void Each(const TBatch &batch, F &fn) {
+        TMatch &match = mMatches[batch.match];
+        CArchetype<TAlloc> *archetype = match.archetype;
+        const uint32_t capacity = archetype->Capacity();
+        char *columns[kTypes];
+        for (uint32_t row = batch.begin; row < batch.end;) {
+            auto *chunk = archetype->Chunk(row / capacity);
+            const uint8_t *states = archetype->States(chunk);
+            for (uint32_t i = 0; i < kTypes; i++)
+                columns[i] = archetype->Column(chunk, match.columns[i]);
+            const uint32_t base = row - row % capacity;
+            const uint32_t end = batch.end < base + capacity ? batch.end : base + capacity;
+            for (; row < end; row++) {
+                if (states[row - base] != CArchetype<TAlloc>::kRowLive) continue;
+                CTuple tuple = at(archetype, chunk, columns, row - base, std::index_sequence_for<Types...>{});
+                fn(tuple);
+            }
+        }
+    }
+
+    // stamps the tuple's T as changed on tick
+    template<class T>
+    static inline void Touch(const CTuple &tuple, uint32_t tick) {
+        const TRow &at = std::get<TRow>(tuple);
+        const int column = at.archetype->Column(ECSInternals::GetComponentTypeId<TAlloc, T>());
+        at.archetype->touch(at.chunk, column, at.row, 0, tick);
+    }
+
+    // calls fn with every committed row whose component of Types[type] was added, or changed, after tick
+    template<class F>
+    inline void EachSince(uint32_t type, uint32_t tick, bool added, F &fn) {
+        char *columns[kTypes];
+        for (auto &match: mMatches) {
+            CArchetype<TAlloc> *archetype = match.archetype;
+            const uint32_t column = match.columns[type];
+            for (uint32_t c = 0; c < archetype->Chunks(); c++) {
+                auto *chunk = archetype->Chunk(c);
+                if (archetype->Newest(chunk)[column * 2 + (added ? 0 : 1)] <= tick) continue;
+                const uint32_t *ticks = added ? archetype->Added(chunk, column) : archetype->Changed(chunk, column);
+                const uint8_t *states = archetype->States(chunk);
+                for (uint32_t i = 0; i < kTypes; i++)
+                    columns[i] = archetype->Column(chunk, match.columns[i]);
+                for (uint32_t row = 0; row < chunk->count; row++) {
+                    if (states[row] != CArchetype<TAlloc>::kRowLive || ticks[row] <= tick) continue;
+                    CTuple tuple = at(archetype, chunk, columns, row, std::index_sequence_for<Types...>{});
+                    fn(tuple);
+                }
+            }
+        }
+    }
+
+    inline void Fit() { mMatches.Fit(); }
+};
+
+// committed entities holding all of Types where at least one type is sparse. walks the smallest sparse set of them
+// and looks the other types up per entity, in the other pools or the entity's archetype row
+template<class TAlloc, class ...Types>
+class CSparseView {
+public:
+    using CTuple = std::tuple<std::add_pointer_t<Types>...>;
+
+private:
+    static constexpr uint32_t kTypes = sizeof...(Types);
+
+    CDirector<TAlloc> *mDirector;
+    CComponentPool<TAlloc> *mPools[kTypes]{}; // nullptr for types kept in archetypes
+    CComponentPool<TAlloc> *mDriver{nullptr};
+    bool mEmpty{false}; // a sparse type nobody holds yet
+
+    // false when the entity at index of the driver lacks a type or is not committed
+    template<size_t... I>
+    inline bool at(uint32_t index, CTuple &tuple, std::index_sequence<I...>) {
+        static const CComponentId ids[kTypes] = {ECSInternals::GetComponentTypeId<TAlloc, Types>()...};
+        const CEntityId id = mDriver->Ids()[index];
+        CEntity<TAlloc> *entity = mDirector->mEntities.Get(id);
+        if (entity == nullptr || !entity->Committed()) return false;
+        void *components[kTypes];
+        for (uint32_t i = 0; i < kTypes; i++) {
+            if (mPools[i] == mDriver) components[i] = mDriver->At(index);
+            else if (mPools[i] != nullptr) components[i] = mPools[i]->Get(id);
+            else components[i] = entity->Component(ids[i]);
+            if (components[i] == nullptr) return false;
+        }
+        tuple = CTuple((std::add_pointer_t<Types>) components[I]...);
+        return true;
+    }
+
+public:
+    class Iterator {
+    private:
+        CSparseView *mView;
+        uint32_t mIndex;
+        CTuple mTuple;
+
+        inline void seek() {
+            const uint32_t length = mView->mEmpty ? 0 : mView->mDriver->Length();
+            while (mIndex < length && !mView->at(mIndex, mTuple, std::index_sequence_for<Types...>{})) mIndex++;
+        }
+
+    public:
+        explicit inline Iterator(CSparseView *view, uint32_t index) : mView(view), mIndex(index) { seek(); }
+
+        inline Iterator &operator++() {
+            ++mIndex;
+            seek();
+            return *this;
+        }
+
+        inline bool operator!=(const Iterator &other) const { return mIndex != other.mIndex; }
+
+        inline CTuple &operator*() { return mTuple; }
+    };
+
+    explicit inline CSparseView(CDirector<TAlloc> *director) : mDirector(director) {
+        const CComponentId ids[kTypes] = {ECSInternals::GetComponentTypeId<TAlloc, Types>()...};
+        const bool sparse[kTypes] = {ECSInternals::IsSparse<Types>...};
+        for (uint32_t i = 0; i < kTypes; i++) {
+            if (!sparse[i]) continue;
+            mPools[i] = director->mPools[ids[i]];
+            if (mPools[i] == nullptr) mEmpty = true;
+            else if (mDriver == nullptr || mPools[i]->Length() < mDriver->Length()) mDriver = mPools[i];
+        }
+    }
+
+    explicit inline CSparseView(const CSparseView &) = delete;
+
+    inline Iterator begin() { return Iterator(this, 0); }
+
+    inline Iterator end() { return Iterator(this, mEmpty ? 0 : mDriver->Length()); }
+
+    // entities the view yields, counted by walking it
+    inline int Length() {
+        int length = 0;
+        for (auto it = begin(); it != end(); ++it) length++;
+        return length;
+    }
+};
+
+// creates, destroys and component changes recorded while systems run, the director plays them back after the phase
+// they were recorded in. every thread of the job pool records into its own buffer. entities created here carry a
+// placeholder id that only this buffer's commands resolve, they get their real id and archetype on playback
+template<class TAlloc>
+class CCommandBuffer {
+    friend class CDirector<TAlloc>;
+
+private:
+    static constexpr uint32_t kCreate = 0;
+    static constexpr uint32_t kDestroy = 1;
+    static constexpr uint32_t kAdd = 2;
+    static constexpr uint32_t kRemove = 3;
+    static constexpr uint32_t kCommit = 4;
+
+    static constexpr uint32_t kBatched = 1; // placed with the created entity's first row
+    static constexpr uint32_t kSkip = 2; // the entity already holds the type, the copy is only destroyed
+
+    static constexpr uint32_t kAlignment = 64;
+
+    struct TBlock {
+        uint32_t used;
+        uint32_t size;
+    };
+
+    struct TCommand {
+        uint32_t type;
+        uint32_t flags;
+        uint32_t next; // offset of the following command in the block
+        uint32_t payload; // offset of the component from the command
+        uint32_t base; // offset of the CComponent base in the component, kNoIndex for plain data
+        CEntityId entity;
+        const ECSInternals::CComponentInfo *info;
+    };
+
+    // blocks come from TAlloc, which pool threads must not call at the same time
+    static inline std::mutex sMemory;
+
+    TArray<TBlock *, TAlloc> mBlocks;
+    uint32_t mBlock{0}; // block being recorded into, the ones after it are empty
+    uint32_t mLength{0};
+    uint32_t mCreated{0};
+
+    inline TBlock *grow(uint32_t bytes) {
+        const uint32_t size = bytes > ECSInternals::kChunkSize ? bytes : ECSInternals::kChunkSize;
+        std::lock_guard<std::mutex> lock(sMemory);
+        auto *block = (TBlock *) Alloc<TAlloc>(size, kAlignment);
+        assert(block != nullptr && "ECS: Insufficient memory for a command block.\n");
+        *block = TBlock{sizeof(TBlock), size};
+        mBlocks.Add(block);
+        return block;
+    }
+
+    inline TCommand *record(uint32_t type, CEntityId entity, const ECSInternals::CComponentInfo *info,
+                            uint32_t size = 0, uint32_t alignment = 8) {
+        assert(alignment <= kAlignment && "ECS: Component alignment is above a command block's.\n");
+        for (;;) {
+            TBlock *block = mBlock < (uint32_t) mBlocks.Length() ? mBlocks[mBlock]
+                                                                 : grow(sizeof(TBlock) + sizeof(TCommand) + size + alignment);
+            const auto at = (uint32_t) MEMORY_SPACE(block->used, 8UL);
+            const auto payload = (uint32_t) MEMORY_SPACE(at + sizeof(TCommand), alignment);
+            const uint32_t end = payload + size;
+            if (end <= block->size) {
+                auto *command = (TCommand *) ((char *) block + at);
+                *command = TCommand{type, 0, (uint32_t) MEMORY_SPACE(end, 8UL), payload - at, 0, entity, info};
+                block->used = end;
+                mLength++;
+                return command;
+            }
+            mBlock++;
+        }
+    }
+
+    static inline void *payload(TCommand *command) { return (char *) command + command->payload; }
+
+    // fn(command) in recording order
+    template<class F>
+    inline void each(F &&fn) {
+        for (auto block: mBlocks)
+            for (uint32_t at = sizeof(TBlock); at < block->used;) {
+                auto *command = (TCommand *) ((char *) block + at);
+                at = command->next;
+                fn(command);
+            }
+    }
+
+    inline void Reset() {
+        for (auto block: mBlocks) block->used = sizeof(TBlock);
+        mBlock = 0;
+        mLength = 0;
+        mCreated = 0;
+    }
+
+    inline void Fit() {
+        if (!Empty()) return;
+        while (!mBlocks.Empty()) {
+            TBlock *block = mBlocks.Pop();
+            Free<TAlloc>((void **) &block);
+        }
+        mBlocks.Fit();
+    }
+
+public:
+    explicit inline CCommandBuffer() = default;
+
+    explicit inline CCommandBuffer(const CCommandBuffer &) = delete;
+
+    inline ~CCommandBuffer() {
+        each([](TCommand *command) {
+            if (command->type == kAdd) command->info->Destroy(payload(command));
+        });
+        Reset();
+        Fit();
+    }
+
+    // placeholder id, valid in this buffer until playback
+    inline CEntityId CreateEntity() {
+        record(kCreate, 0, nullptr);
+        return ECSInternals::MakeEntityId(mCreated++, 0);
+    }
+
+    inline void DestroyEntity(CEntityId entityId) {
+        record(kDestroy, entityId, nullptr);
+    }
+
+    // the component is built in the buffer and moved into the entity on playback, the pointer is valid until then
+    template<class T, class... Args>
+    inline T *AddComponent(CEntityId entityId, Args &&...args) {
+        const ECSInternals::CComponentInfo *info = ECSInternals::GetComponentInfo<TAlloc, T>();
+        TCommand *command = record(kAdd, entityId, info, info->size, info->alignment > 8 ? info->alignment : 8);
+        T *component = ECSInternals::Construct<T>(payload(command), std::forward<Args>(args)...);
+        if constexpr (std::is_base_of_v<CComponent<TAlloc>, T>)
+            command->base = (uint32_t) ((char *) static_cast<CComponent<TAlloc> *>(component) - (char *) component);
+        else command->base = ECSInternals::kNoIndex;
+        return component;
+    }
+
+    template<class T>
+    inline void RemoveComponent(CEntityId entityId) {
+        record(kRemove, entityId, ECSInternals::GetComponentInfo<TAlloc, T>());
+    }
 
-    inline const CDirector<TAlloc> *Director() { return mDirector; }
+    inline void Commit(CEntityId entityId) {
+        record(kCommit, entityId, nullptr);
+    }
 
-protected:
-    CEntityId mEntityId{0};
-    CEntity<TAlloc> *mEntity{nullptr};
-    CDirector<TAlloc> *mDirector{nullptr};
+    // commands waiting for playback
+    [[nodiscard]]
+    inline uint32_t Length() const { return mLength; }
 
-    inline void SetEntity(CDirector<TAlloc> *director, const CEntityId &id, CEntity<TAlloc> *entity) {
-        mEntityId = id;
-        mEntity = entity;
-        mDirector = director;
-        Create();
-    }
+    [[nodiscard]]
+    inline bool Empty() const { return mLength == 0; }
 };
 
 template<class TAlloc>
@@ -182,121 +1248,241 @@ public:
 
 protected:
     friend class CDirector<TAlloc>;
-    using EntityIndexMap = TFastMap<CEntityId, int, TAlloc>;
     CDirector<TAlloc> *mDirector{nullptr};
-    EntityIndexMap mEntityIndex;
+    TArray<CComponentId, TAlloc> mReads;
+    TArray<CComponentId, TAlloc> mWrites;
+    ECSInternals::CSignature mSignature; // every type the system iterates
+    uint32_t mLastRun{0}; // director tick of the phase the system last ran in
     bool mShouldUpdate = false;
     bool mLocked = false;
+    bool mMainThread = true;
 
     virtual void Fit() {
-        mEntityIndex.Fit();
+        mReads.Fit();
+        mWrites.Fit();
+    }
+
+    // systems that draw or change entities directly have to stay on the main thread, where they run alone.
+    // the others run on the job pool next to any system whose component access does not conflict with theirs
+    inline void SetMainThread(bool mainThread) {
+        mMainThread = mainThread;
+        if (mDirector != nullptr) mDirector->mScheduled = false;
+    }
+
+    // the director's job pool, held for one ParallelEach. nullptr when running serially or inside a pool phase
+    inline CJobPool *acquirePool() {
+        if (mDirector == nullptr || !mDirector->mParallel || mDirector->mRunning || mDirector->mPool == nullptr)
+            return nullptr;
+        mDirector->mRunning = true;
+        return mDirector->mPool;
+    }
+
+    inline void releasePool() {
+        mDirector->mRunning = false;
+    }
+
+    // command buffer of the calling thread, the only way to change entities from a system running on the pool
+    inline CCommandBuffer<TAlloc> &Commands() { return mDirector->Commands(); }
+
+    inline bool Conflicts(CBaseSystem *other) {
+        if (mMainThread || other->mMainThread) return true;
+        for (const auto &id: mWrites)
+            if (other->mWrites.Find(id) >= 0 || other->mReads.Find(id) >= 0) return true;
+        for (const auto &id: mReads)
+            if (other->mWrites.Find(id) >= 0) return true;
+        return false;
     }
 
-    virtual void OnEntityCreated(CEntity<TAlloc> *entity) = 0;
+    // returns whether the system iterates the archetype
+    virtual bool OnArchetypeCreated(CArchetype<TAlloc> *archetype) = 0;
 
-    virtual void OnEntityDestroyed(CEntityId entityId) = 0;
+    // an archetype the system iterates gained or lost committed entities
+    virtual void OnLengthChanged() = 0;
 };
 
+// a const type in Types declares read only access, systems running next to each other may read the same types
 template<class TAlloc, class ...Types>
 class CSystem : public CBaseSystem<TAlloc> {
 protected:
-    using CTuple = std::tuple<std::add_pointer_t<Types>...>;
-    TArray<CTuple, TAlloc> mComponents;
+    using CView = CArchetypeView<TAlloc, Types...>;
+    using CTuple = typename CView::CTuple;
+    CView mComponents;
+    TArray<typename CView::TBatch, TAlloc> mBatches;
+    uint32_t mBatchSize{ECSInternals::kBatch};
 
-    template<int Index, class Type, class... Args>
-    inline bool hasComponent(CComponentId id, CComponent<TAlloc> *component, CTuple &tuple) {
-        if (ECSInternals::GetComponentTypeId<TAlloc, Type>() == id) {
-            std::get<Index>(tuple) = static_cast<Type *>(component);
-            return true;
-        }
-        return hasComponent<Index + 1, Args...>(id, component, tuple);
-    }
-
-    template<int Index>
-    inline bool hasComponent([[maybe_unused]] CComponentId id, [[maybe_unused]]  CComponent<TAlloc> *component, [[maybe_unused]]  CTuple &tuple) {
-        return false;
+    template<class T>
+    inline void declare() {
+        const CComponentId id = ECSInternals::GetComponentTypeId<TAlloc, T>();
+        this->mSignature.Set(id);
+        if constexpr (std::is_const_v<T>) this->mReads.Add(id);
+        else this->mWrites.Add(id);
     }
 
     inline void Fit() override {
         CBaseSystem<TAlloc>::Fit();
         mComponents.Fit();
+        mBatches.Fit();
     }
 
-    inline void SetTick(bool shouldUpdate) {
-        this->mShouldUpdate = shouldUpdate;
-        this->mLocked = !shouldUpdate;
+    // least rows handed to one ParallelEach job, rounded up to a multiple of kBatchAlign
+    inline void SetBatch(uint32_t rows) {
+        mBatchSize = MEMORY_SPACE((rows > 0 ? rows : 1), ECSInternals::kBatchAlign);
     }
 
-    inline void OnEntityCreated(CEntity<TAlloc> *entity) override {
-        CTuple tuple;
-        int matches = 0;
-        for (const auto &component: *(entity->Components())) {
-            if (hasComponent<0, Types...>(component->key, component->value, tuple)) {
-                ++matches;
-                if (matches == sizeof...(Types)) {
-                    mComponents.Add(std::move(tuple));
-                    this->mEntityIndex.Set(entity->Id(), mComponents.Length() - 1);
-                    this->mShouldUpdate = mComponents.Length() > 0 && !this->mLocked;
-                    break;
-                }
-            }
+    // fn(tuple) for every entity like a range for over Components(), spread over the job pool in batches.
+    // fn may only touch the components it is handed, entities are created, changed or destroyed through Commands()
+    template<class F>
+    inline void ParallelEach(F &&fn) {
+        CJobPool *pool = mComponents.Length() > (int) mBatchSize ? this->acquirePool() : nullptr;
+        if (pool == nullptr) {
+            for (auto &tuple: mComponents) fn(tuple);
+            return;
         }
+        mComponents.Split(mBatchSize, mBatches);
+        pool->Run(mBatches.Length(), [this, &fn](unsigned int i) { mComponents.Each(mBatches[i], fn); });
+        this->releasePool();
     }
 
-    inline void OnEntityDestroyed(CEntityId entityId) override {
-        const auto &index = this->mEntityIndex.Get(entityId);
-        if (index != nullptr) {
-            const auto entityToMoveIndex = mComponents.Length() - 1;
-            const auto movedEntity = std::get<0>(mComponents[entityToMoveIndex]);
+    // fn(tuple) for every entity whose T was marked changed or added since the system last ran, chunks holding
+    // nothing newer are skipped whole
+    template<class T, class F>
+    inline void Changed(F &&fn) {
+        static_assert(ECSInternals::TIndex<T, Types...>::value < sizeof...(Types), "T is not iterated by the system");
+        mComponents.EachSince(ECSInternals::TIndex<T, Types...>::value, this->mLastRun, false, fn);
+    }
 
-            if (*index < mComponents.Length()) {
-                mComponents[*index] = std::move(mComponents[entityToMoveIndex]);
-                mComponents.Pop();
+    // fn(tuple) for every entity that gained T or was committed since the system last ran
+    template<class T, class F>
+    inline void Added(F &&fn) {
+        static_assert(ECSInternals::TIndex<T, Types...>::value < sizeof...(Types), "T is not iterated by the system");
+        mComponents.EachSince(ECSInternals::TIndex<T, Types...>::value, this->mLastRun, true, fn);
+    }
 
-                const auto &movedEntityId = movedEntity->EntityId();
-                const auto &movedEntityIndex = this->mEntityIndex.Get(movedEntityId);
-                if (movedEntityIndex != nullptr) {
-                    *movedEntityIndex = *index;
-                    this->mShouldUpdate = mComponents.Length() > 0 && !this->mLocked;
-                }
-            }
-            this->mEntityIndex.Remove(entityId);
-        }
+    // fn(entityId) for every committed entity that lost T or was destroyed with it since the system last ran.
+    // removals are logged from the first call on and kept for one Update
+    template<class T, class F>
+    inline void Removed(F &&fn) {
+        this->mDirector->template Removed<T>(this->mLastRun, fn);
+    }
+
+    // shows the tuple's T, which the system wrote, to systems walking Changed on its type
+    template<class T>
+    inline void MarkChanged(const CTuple &tuple) {
+        static_assert(!std::is_const_v<typename ECSInternals::TDeclared<T, Types...>::type>, "T is declared read only");
+        CView::template Touch<T>(tuple, this->mDirector->Tick());
+    }
+
+    template<class T>
+    inline void MarkChanged(T *component) {
+        static_assert(!std::is_const_v<T>, "T is declared read only");
+        this->mDirector->MarkChanged(component);
+    }
+
+    inline void SetTick(bool shouldUpdate) {
+        this->mShouldUpdate = shouldUpdate;
+        this->mLocked = !shouldUpdate;
+    }
+
+    inline bool OnArchetypeCreated(CArchetype<TAlloc> *archetype) override {
+        return mComponents.Match(archetype);
+    }
+
+    inline void OnLengthChanged() override {
+        this->mShouldUpdate = mComponents.Length() > 0 && !this->mLocked;
     }
 
 public:
-    explicit inline CSystem() = default;
+    explicit inline CSystem() {
+        (declare<Types>(), ...);
+    }
 
     explicit inline CSystem(const CSystem &) = delete;
 
     template<class T>
-    inline static T *Get(const CTuple &tuple) { return std::get<T *>(tuple); };
+    inline static auto Get(const CTuple &tuple) {
+        return std::get<typename ECSInternals::TDeclared<T, Types...>::type *>(tuple);
+    };
 
-    inline TArray<CTuple, TAlloc> &Components() { return mComponents; }
+    inline CView &Components() { return mComponents; }
 };
 
 template<class TAlloc>
 class CDirector {
 private:
     friend class CBaseSystem<TAlloc>;
+    friend class CEntity<TAlloc>;
+
+    template<class, class...>
+    friend
+    class CSparseView;
 
-    using EntityMap = TFastMap<CEntityId, CEntity<TAlloc> *, TAlloc>;
     using SystemMap = TFastMap<CSystemId, CBaseSystem<TAlloc> *, TAlloc>;
-    using EntityComponentMap = TFastMap<CEntityId, CComponent<TAlloc> *, TAlloc>;
-    using ComponentEntityComponentMap = TFastMap<CComponentId, EntityComponentMap *, TAlloc>;
+    using ArchetypeMap = TFastMap<CComponentId, CArchetype<TAlloc> *, TAlloc>;
     using PartialSlabMemory = TFastMap<CECSIdType, SlabMemory *, TAlloc>;
 
 
-    CEntityId mEntityCounter{1};
-    EntityMap mEntities;
+    CEntityTable<TAlloc> mEntities;
     SystemMap mSystems;
-    ComponentEntityComponentMap mComponents;
+    TArray<CArchetype<TAlloc> *, TAlloc> mArchetypes;
+    ArchetypeMap mRoots; // archetypes of a single component
+    CComponentPool<TAlloc> *mPools[ECSInternals::kMaxComponents]{}; // sparse sets by component id
 
     SlabMemory *mEntitySlab{nullptr};
-    PartialSlabMemory mComponentsSlab;
     PartialSlabMemory mSystemsSlab;
     unsigned int mSlabCount = 16;
 
+    TArray<CBaseSystem<TAlloc> *, TAlloc> mOrder; // systems in the order they were added
+    TArray<CBaseSystem<TAlloc> *, TAlloc> mSchedule; // systems grouped by phase
+    TArray<uint32_t, TAlloc> mPhases; // first system of each phase in mSchedule, plus the end
+    CJobPool *mPool{nullptr};
+    unsigned int mThreads{0};
+    bool mScheduled = false;
+    bool mParallel = true;
+    bool mRunning = false; // a phase runs on the job pool, structural changes are not allowed
+
+    struct TPlaced {
+        CEntity<TAlloc> *entity;
+        CArchetype<TAlloc> *archetype; // holding every component added so far
+        bool open; // no remove or destroy seen yet, adds still go to the first row
+    };
+
+    // ticks stamp component adds and changes. every phase of Update runs on a tick of its own and the tick moves on
+    // again before playback, so changes made after a system ran are always newer than its last run
+    uint32_t mTick{1};
+    uint32_t mFrame{0}; // tick the last Update started on
+
+    struct TRemoved {
+        CComponentId component;
+        CEntityId entity;
+        uint32_t tick;
+    };
+
+    TArray<TRemoved, TAlloc> mRemoved;
+    ECSInternals::CSignature mTracked; // types something asked for removals of
+
+    // lifecycle hooks by component id, plain data has no virtual Create to stand in for them
+    struct THook {
+        void (*invoke)(void (*hook)(), CDirector *director, CEntityId entity, void *component){nullptr};
+        void (*hook)(){nullptr};
+
+        inline void operator()(CDirector *director, CEntityId entity, void *component) const {
+            if (invoke != nullptr) invoke(hook, director, entity, component);
+        }
+    };
+
+    THook mOnAdd[ECSInternals::kMaxComponents];
+    THook mOnRemove[ECSInternals::kMaxComponents];
+
+    template<class T>
+    static inline THook makeHook(void (*hook)(CDirector *director, CEntityId entity, T *component)) {
+        if (hook == nullptr) return THook{};
+        return THook{[](void (*erased)(), CDirector *director, CEntityId entity, void *component) {
+            ((void (*)(CDirector *, CEntityId, T *)) erased)(director, entity, (T *) component);
+        }, (void (*)()) hook};
+    }
+
+    TArray<CCommandBuffer<TAlloc> *, TAlloc> mCommands; // one per job pool thread, the calling thread's first
+    TArray<TPlaced, TAlloc> mPlaced; // entities created by the buffer being played back
 
     template<class T>
     inline SlabMemory *makeSlab(int length) {
@@ -306,16 +1492,6 @@ private:
         return slab_create_alloc(pAlloc, sizeof(T) * length, sizeof(T));
     }
 
-    template<class T>
-    inline SlabMemory *getComponentSlab() {
-        CComponentId id = ECSInternals::GetComponentTypeId<TAlloc, T>();
-        auto componentSlab = mComponentsSlab.Get(id);
-        if (componentSlab != nullptr) return *componentSlab;
-        SlabMemory *slab = makeSlab<T>(mSlabCount);
-        mComponentsSlab.Set(id, slab);
-        return slab;
-    }
-
     template<class T>
     inline SlabMemory *getSystemSlab() {
         CSystemId id = ECSInternals::GetSystemTypeId<TAlloc, T>();
@@ -326,31 +1502,627 @@ private:
         return slab;
     }
 
-    inline SlabMemory *getComponentSlab(CComponentId id) {
-        const auto &slab = mComponentsSlab.Get(id);
-        if (slab != nullptr) return *slab;
-        return nullptr;
+    inline bool matches(CBaseSystem<TAlloc> *sys, CArchetype<TAlloc> *archetype) {
+        return archetype->Signature().Contains(sys->mSignature) && sys->OnArchetypeCreated(archetype);
+    }
+
+    inline CArchetype<TAlloc> *findArchetype(TArray<const ECSInternals::CComponentInfo *, TAlloc> &infos) {
+        ECSInternals::CSignature signature;
+        for (auto info: infos) signature.Set(info->id);
+        for (auto candidate: mArchetypes)
+            if (candidate->Signature() == signature) return candidate;
+        auto *archetype = AllocNew<TAlloc, CArchetype<TAlloc>>(infos.Ptr(), (uint32_t) infos.Length());
+        mArchetypes.Add(archetype);
+        for (const auto &sys: mSystems)
+            if (matches(sys->value, archetype)) archetype->mSystems.Add(sys->value);
+        return archetype;
+    }
+
+    // archetype of the component set of from plus info, created on first use and cached on the edge
+    inline CArchetype<TAlloc> *getArchetype(CArchetype<TAlloc> *from, const ECSInternals::CComponentInfo *info) {
+        ArchetypeMap &edges = from != nullptr ? from->mEdges : mRoots;
+        const auto &found = edges.Get(info->id);
+        if (found != nullptr) return *found;
+
+        TArray<const ECSInternals::CComponentInfo *, TAlloc> infos;
+        const uint32_t columns = from != nullptr ? from->Columns() : 0;
+        for (uint32_t i = 0; i < columns; i++) infos.Add(from->Info(i));
+        int at = 0;
+        while (at < infos.Length() && infos[at]->id < info->id) at++;
+        infos.Insert(info, at);
+
+        CArchetype<TAlloc> *archetype = findArchetype(infos);
+        edges.Set(info->id, archetype);
+        return archetype;
+    }
+
+    // archetype of the component set of from without info, nullptr when nothing is left
+    inline CArchetype<TAlloc> *getArchetypeWithout(CArchetype<TAlloc> *from, const ECSInternals::CComponentInfo *info) {
+        const auto &found = from->mRemoves.Get(info->id);
+        if (found != nullptr) return *found;
+
+        TArray<const ECSInternals::CComponentInfo *, TAlloc> infos;
+        for (uint32_t i = 0; i < from->Columns(); i++)
+            if (from->Info(i) != info) infos.Add(from->Info(i));
+
+        CArchetype<TAlloc> *archetype = infos.Empty() ? nullptr : findArchetype(infos);
+        from->mRemoves.Set(info->id, archetype);
+        return archetype;
+    }
+
+    // a system goes one phase after the last earlier system it conflicts with, so any two conflicting systems keep
+    // the order they were added in and systems sharing a phase can run in any order or at the same time
+    inline void schedule() {
+        const uint32_t length = mOrder.Length();
+        TArray<uint32_t, TAlloc> phaseOf(length > 8 ? length : 8);
+        uint32_t phases = 0;
+        for (uint32_t i = 0; i < length; i++) {
+            uint32_t phase = 0;
+            for (uint32_t j = 0; j < i; j++)
+                if (phaseOf[j] >= phase && mOrder[i]->Conflicts(mOrder[j])) phase = phaseOf[j] + 1;
+            phaseOf.Add(phase);
+            if (phase >= phases) phases = phase + 1;
+        }
+
+        mSchedule.Clear();
+        mPhases.Clear();
+        for (uint32_t phase = 0; phase < phases; phase++) {
+            mPhases.Add(mSchedule.Length());
+            for (uint32_t i = 0; i < length; i++)
+                if (phaseOf[i] == phase) mSchedule.Add(mOrder[i]);
+        }
+        mPhases.Add(mSchedule.Length());
+        mScheduled = true;
+    }
+
+    inline void runPhase(uint32_t phase) {
+        CBaseSystem<TAlloc> **systems = mSchedule.Ptr() + mPhases[phase];
+        const uint32_t length = mPhases[phase + 1] - mPhases[phase];
+        if (!mParallel || mPool == nullptr || length == 1 || systems[0]->mMainThread) {
+            for (uint32_t i = 0; i < length; i++)
+                if (systems[i]->mShouldUpdate) systems[i]->Update();
+        } else {
+            mRunning = true;
+            mPool->Run(length, [systems](unsigned int i) {
+                if (systems[i]->mShouldUpdate) systems[i]->Update();
+            });
+            mRunning = false;
+        }
+        for (uint32_t i = 0; i < length; i++)
+            if (systems[i]->mShouldUpdate) systems[i]->mLastRun = mTick;
+    }
+
+    inline void logRemoved(CComponentId id, CEntity<TAlloc> *entity) {
+        if (entity->mCommitted && mTracked.Has(id)) mRemoved.Add(TRemoved{id, entity->mEntityId, mTick});
+    }
+
+    inline CEntity<TAlloc> *resolve(CEntityId entityId) {
+        if (!ECSInternals::IsPlaceholder(entityId)) return mEntities.Get(entityId);
+        assert(ECSInternals::EntityIndex(entityId) < (uint32_t) mPlaced.Length() && "ECS: entity of another command buffer");
+        return mPlaced[ECSInternals::EntityIndex(entityId)].entity;
+    }
+
+    // room for a sparse component of the entity, left unconstructed
+    inline void *emplace(CEntity<TAlloc> *entity, const ECSInternals::CComponentInfo *info) {
+        CComponentPool<TAlloc> *&pool = mPools[info->id];
+        if (pool == nullptr) pool = AllocNew<TAlloc, CComponentPool<TAlloc>>(info);
+        entity->mSparse.Set(info->id);
+        return pool->Emplace(entity->mEntityId);
+    }
+
+    // room for a component the entity does not hold yet, moving it to the next archetype unless the type is sparse
+    inline void *place(CEntity<TAlloc> *entity, const ECSInternals::CComponentInfo *info) {
+        if (info->sparse) return emplace(entity, info);
+        CArchetype<TAlloc> *archetype = getArchetype(entity->mArchetype, info);
+        moveEntity(entity, archetype);
+        const uint32_t column = archetype->Column(info->id);
+        archetype->touch(entity->mChunk, column, entity->mRow, mTick, mTick);
+        return archetype->Component(entity->mChunk, column, entity->mRow);
+    }
+
+    // gives a component moved into the entity its entity
+    inline void bind(CEntity<TAlloc> *entity, const ECSInternals::CComponentInfo *info, uint32_t base) {
+        auto *memory = (char *) entity->Component(info->id);
+        if (base != ECSInternals::kNoIndex)
+            ((CComponent<TAlloc> *) (memory + base))->SetEntity(this, entity->mEntityId, entity);
+        mOnAdd[info->id](this, entity->mEntityId, memory);
+    }
+
+    // a recorded component moves in like AddComponent, or is dropped when the entity already holds its type
+    inline void attach(CEntity<TAlloc> *entity, const ECSInternals::CComponentInfo *info, void *component, uint32_t base) {
+        if (entity->Component(info->id) != nullptr) {
+            info->Destroy(component);
+            return;
+        }
+        memcpy(place(entity, info), component, info->size);
+        bind(entity, info, base);
+    }
+
+    // entities created in the buffer are given the archetype of all the components added to them in one move, their
+    // components are copied in before any of them is bound so Create sees its siblings. every other command then
+    // applies in recording order
+    inline void play(CCommandBuffer<TAlloc> *commands) {
+        using TCommand = typename CCommandBuffer<TAlloc>::TCommand;
+        using CBuffer = CCommandBuffer<TAlloc>;
+
+        mPlaced.Reset();
+        commands->each([this](TCommand *command) {
+            if (command->type == CBuffer::kCreate) {
+                mPlaced.Add(TPlaced{mEntities.Get(CreateEntity()), nullptr, true});
+                return;
+            }
+            if (!ECSInternals::IsPlaceholder(command->entity)) return;
+            assert(ECSInternals::EntityIndex(command->entity) < (uint32_t) mPlaced.Length() && "ECS: entity of another command buffer");
+            TPlaced &placed = mPlaced[ECSInternals::EntityIndex(command->entity)];
+            if (command->type == CBuffer::kRemove || command->type == CBuffer::kDestroy) placed.open = false;
+            if (command->type != CBuffer::kAdd || !placed.open || command->info->sparse) return;
+            if (placed.archetype != nullptr && placed.archetype->Column(command->info->id) >= 0) {
+                command->flags = CBuffer::kSkip;
+            } else {
+                placed.archetype = getArchetype(placed.archetype, command->info);
+                command->flags = CBuffer::kBatched;
+            }
+        });
+
+        for (const auto &placed: mPlaced)
+            if (placed.archetype != nullptr) moveEntity(placed.entity, placed.archetype);
+        commands->each([this](TCommand *command) {
+            if (command->flags != CBuffer::kBatched) return;
+            CEntity<TAlloc> *entity = resolve(command->entity);
+            CArchetype<TAlloc> *archetype = entity->mArchetype;
+            memcpy(archetype->Component(entity->mChunk, archetype->Column(command->info->id), entity->mRow),
+                   CBuffer::payload(command), command->info->size);
+        });
+
+        commands->each([this](TCommand *command) {
+            CEntity<TAlloc> *entity = command->type != CBuffer::kCreate ? resolve(command->entity) : nullptr;
+            switch (command->type) {
+                case CBuffer::kAdd:
+                    if (command->flags == CBuffer::kBatched) bind(entity, command->info, command->base);
+                    else if (entity == nullptr || command->flags == CBuffer::kSkip) command->info->Destroy(CBuffer::payload(command));
+                    else attach(entity, command->info, CBuffer::payload(command), command->base);
+                    break;
+                case CBuffer::kRemove:
+                    if (entity != nullptr) removeComponent(entity, command->info);
+                    break;
+                case CBuffer::kDestroy:
+                    if (entity != nullptr) {
+                        if (ECSInternals::IsPlaceholder(command->entity))
+                            mPlaced[ECSInternals::EntityIndex(command->entity)].entity = nullptr;
+                        performDelete(entity->mEntityId);
+                    }
+                    break;
+                case CBuffer::kCommit:
+                    if (entity != nullptr) commit(entity);
+                    break;
+                default:
+                    break;
+            }
+        });
+        commands->Reset();
+    }
+
+    inline void notify(CArchetype<TAlloc> *archetype) {
+        for (auto sys: archetype->mSystems) sys->OnLengthChanged();
+    }
+
+    // relocates the components of entity into a row of archetype, the new columns are left unconstructed and the
+    // components archetype lacks must have been destroyed. a nullptr archetype leaves the entity without a row
+    inline void moveEntity(CEntity<TAlloc> *entity, CArchetype<TAlloc> *archetype) {
+        CArchetype<TAlloc> *from = entity->mArchetype;
+        uint32_t chunk = 0;
+        uint32_t row = 0;
+        if (archetype != nullptr) {
+            const uint8_t state = entity->mCommitted ? CArchetype<TAlloc>::kRowLive : CArchetype<TAlloc>::kRowPending;
+            row = archetype->allocate(entity->mEntityId, state, chunk);
+        }
+        if (from != nullptr) {
+            for (uint32_t column = 0; archetype != nullptr && column < from->Columns(); column++) {
+                const ECSInternals::CComponentInfo *info = from->Info(column);
+                const int to = archetype->Column(info->id);
+                if (to < 0) continue;
+                memcpy(archetype->Component(chunk, to, row), from->Component(entity->mChunk, column, entity->mRow),
+                       info->size);
+                auto *fromChunk = from->Chunk(entity->mChunk);
+                archetype->touch(chunk, to, row, from->Added(fromChunk, column)[entity->mRow],
+                                 from->Changed(fromChunk, column)[entity->mRow]);
+            }
+            from->release(entity->mChunk, entity->mRow);
+        }
+        entity->mArchetype = archetype;
+        entity->mChunk = chunk;
+        entity->mRow = row;
+        if (entity->mCommitted) {
+            if (from != nullptr) notify(from);
+            if (archetype != nullptr) notify(archetype);
+        }
+    }
+
+    inline bool removeComponent(CEntity<TAlloc> *entity, const ECSInternals::CComponentInfo *info) {
+        if (info->sparse) {
+            if (!entity->mSparse.Has(info->id)) return false;
+            logRemoved(info->id, entity);
+            mOnRemove[info->id](this, entity->mEntityId, mPools[info->id]->Get(entity->mEntityId));
+            mPools[info->id]->Remove(entity->mEntityId);
+            entity->mSparse.Clear(info->id);
+            return true;
+        }
+        CArchetype<TAlloc> *from = entity->mArchetype;
+        const int column = from != nullptr ? from->Column(info->id) : -1;
+        if (column < 0) return false;
+        logRemoved(info->id, entity);
+        void *component = from->Component(entity->mChunk, column, entity->mRow);
+        mOnRemove[info->id](this, entity->mEntityId, component);
+        info->Destroy(component);
+        moveEntity(entity, getArchetypeWithout(from, info));
+        return true;
+    }
+
+    inline void commit(CEntity<TAlloc> *entity) {
+        if (entity->mCommitted) return;
+        entity->mCommitted = true;
+        CArchetype<TAlloc> *archetype = entity->mArchetype;
+        if (archetype != nullptr) {
+            archetype->commit(entity->mChunk, entity->mRow);
+            for (uint32_t column = 0; column < archetype->Columns(); column++)
+                archetype->touch(entity->mChunk, column, entity->mRow, mTick, mTick);
+            notify(archetype);
+        }
     }
 
     inline void performDelete(CEntityId entityId) {
-        const auto &entity = mEntities.Get(entityId);
+        CEntity<TAlloc> *entity = mEntities.Get(entityId);
 
         if (entity == nullptr)
             return;
 
-        for (const auto &p: mComponents) {
-            CComponentId componentId = p->key;
-            const auto &component = p->value->Get(entityId);
-            if (component != nullptr) {
-                (*component)->~CComponent<TAlloc>();
-                auto slab = getComponentSlab(componentId);
-                slab_free(slab, (void **) component);
-                p->value->Remove(entityId);
+        CArchetype<TAlloc> *archetype = entity->mArchetype;
+        if (archetype != nullptr) {
+            for (uint32_t column = 0; column < archetype->Columns(); column++) {
+                const CComponentId id = archetype->Info(column)->id;
+                logRemoved(id, entity);
+                mOnRemove[id](this, entityId, archetype->Component(entity->mChunk, column, entity->mRow));
+            }
+            archetype->destroy(entity->mChunk, entity->mRow);
+            if (entity->mCommitted) notify(archetype);
+        }
+        entity->mSparse.Each([this, entity, entityId](CComponentId id) {
+            logRemoved(id, entity);
+            mOnRemove[id](this, entityId, mPools[id]->Get(entityId));
+            mPools[id]->Remove(entityId);
+        });
+        entity->~CEntity<TAlloc>();
+        slab_free(mEntitySlab, (void **) &entity);
+        mEntities.Release(entityId);
+    }
+
+
+    // snapshot layout, every section starts 8 byte aligned: the header, the type table, one slot per entity table
+    // slot, then per archetype its column types and each of its chunks as the chunk header, ids, row states and one
+    // array per column, then per sparse set its ids and components
+    static constexpr uint32_t kSnapshotMagic = 0x53534345; // "ECSS"
+    static constexpr uint32_t kSnapshotVersion = 1;
+
+    struct TSnapshotHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t schema; // hash of the type table
+        uint32_t chunkSize; // rows per chunk follow from it
+        uint32_t types;
+        uint32_t slots;
+        uint32_t archetypes;
+        uint32_t pools;
+        uint32_t _padding;
+    };
+
+    struct TSnapshotType {
+        uint64_t hash;
+        uint32_t size;
+        uint32_t alignment;
+    };
+
+    struct TSnapshotSlot {
+        uint32_t generation;
+        uint32_t state; // kRowFree for unused slots, an entity without a row keeps its commit state here as well
+    };
+
+    struct TSnapshotArchetype {
+        uint32_t columns;
+        uint32_t chunks;
+    };
+
+    struct TSnapshotPool {
+        uint32_t type;
+        uint32_t length;
+    };
+
+    struct TWriter {
+        FILE *file;
+        bool failed;
+
+        inline void Put(const void *data, size_t size) {
+            static const char zero[8]{};
+            if (size == 0 || failed) return;
+            failed = fwrite(data, 1, size, file) != size;
+            if (!failed && (size & 7) != 0) failed = fwrite(zero, 1, 8 - (size & 7), file) != 8 - (size & 7);
+        }
+    };
+
+    struct TReader {
+        const char *data;
+        size_t size;
+        size_t cursor;
+
+        // count items at the cursor, nullptr when the snapshot ends before them
+        template<class T>
+        inline const T *Take(size_t count) {
+            const size_t bytes = count * sizeof(T);
+            if (count > size || bytes > size - cursor) return nullptr;
+            const T *items = (const T *) (data + cursor);
+            cursor = MEMORY_SPACE(cursor + bytes, (size_t) 8);
+            if (cursor > size) cursor = size;
+            return items;
+        }
+    };
+
+    static inline uint64_t schemaOf(const TSnapshotType *types, uint32_t length) {
+        uint64_t schema = 14695981039346656037ULL;
+        for (uint32_t i = 0; i < length; i++) schema = (schema ^ types[i].hash) * 1099511628211ULL;
+        return schema;
+    }
+
+    // replaces the world with a snapshot. the header, type table and entity table are checked before the world is
+    // touched, everything after them while it is copied, so damage found there leaves the world empty
+    inline bool readSnapshot(const void *data, size_t size) {
+        TReader reader{(const char *) data, size, 0};
+        const TSnapshotHeader *header = reader.Take<TSnapshotHeader>(1);
+        if (header == nullptr || header->magic != kSnapshotMagic || header->version != kSnapshotVersion) {
+            printf("ECS: load failed, not a snapshot of this version\n");
+            return false;
+        }
+        if (header->chunkSize != ECSInternals::kChunkSize) {
+            printf("ECS: load failed, snapshot made with another chunk size\n");
+            return false;
+        }
+
+        const TSnapshotType *types = reader.Take<TSnapshotType>(header->types);
+        if (types == nullptr || header->types > ECSInternals::kMaxComponents ||
+            schemaOf(types, header->types) != header->schema) {
+            printf("ECS: load failed, type table is damaged\n");
+            return false;
+        }
+        const ECSInternals::CComponentInfo *infos[ECSInternals::kMaxComponents]{};
+        const ECSInternals::CComponentInfo **registered = ECSInternals::Components<TAlloc>();
+        for (uint32_t i = 0; i < header->types; i++) {
+            for (uint32_t id = 0; id < ECSInternals::kMaxComponents && infos[i] == nullptr; id++)
+                if (registered[id] != nullptr && registered[id]->hash == types[i].hash) infos[i] = registered[id];
+            if (infos[i] == nullptr || !infos[i]->plain) {
+                printf("ECS: load failed, component type %016llx is not registered, see Register\n",
+                       (unsigned long long) types[i].hash);
+                return false;
+            }
+        }
+
+        const TSnapshotSlot *table = reader.Take<TSnapshotSlot>(header->slots);
+        if (table == nullptr) {
+            printf("ECS: load failed, snapshot is truncated\n");
+            return false;
+        }
+        for (uint32_t i = 0; i < header->slots; i++) {
+            if (table[i].generation == 0 || table[i].state > CArchetype<TAlloc>::kRowLive) {
+                printf("ECS: load failed, entity table is damaged\n");
+                return false;
+            }
+        }
+
+        clear();
+        mEntities.Reset(header->slots);
+        if (fillSnapshot(reader, header, infos, table)) return true;
+        discard();
+        return false;
+    }
+
+    // copies the archetypes and sparse sets of a snapshot into the cleared world, false at the first damaged record
+    inline bool fillSnapshot(TReader &reader, const TSnapshotHeader *header,
+                             const ECSInternals::CComponentInfo *const *infos, const TSnapshotSlot *table) {
+        const uint32_t slots = header->slots;
+        // entities are made as their rows are copied so the slab hands them out in row order, the ones without a
+        // row follow the archetypes
+        auto make = [this, table](uint32_t index) {
+            const CEntityId id = ECSInternals::MakeEntityId(index, table[index].generation);
+            auto *entity = new(slab_alloc(mEntitySlab)) CEntity<TAlloc>(this, id);
+            entity->mCommitted = table[index].state == CArchetype<TAlloc>::kRowLive;
+            mEntities.Restore(index, table[index].generation, entity);
+            return entity;
+        };
+        // the slot of a row's entity, kNoIndex when the row is not the entity the table holds or already has one
+        auto owner = [this, table, slots](CEntityId id, uint8_t state) {
+            const uint32_t index = ECSInternals::EntityIndex(id);
+            if (index >= slots || table[index].generation != ECSInternals::EntityGeneration(id) ||
+                table[index].state != state || mEntities.At(index) != nullptr)
+                return ECSInternals::kNoIndex;
+            return index;
+        };
+
+        for (uint32_t a = 0; a < header->archetypes; a++) {
+            const TSnapshotArchetype *record = reader.Take<TSnapshotArchetype>(1);
+            const uint32_t *columns = record != nullptr ? reader.Take<uint32_t>(record->columns) : nullptr;
+            if (columns == nullptr || record->columns == 0 || record->columns > header->types) {
+                printf("ECS: load failed, archetype %u is damaged\n", a);
+                return false;
+            }
+            ECSInternals::CSignature signature;
+            TArray<const ECSInternals::CComponentInfo *, TAlloc> sorted;
+            for (uint32_t i = 0; i < record->columns; i++) {
+                const ECSInternals::CComponentInfo *info = columns[i] < header->types ? infos[columns[i]] : nullptr;
+                if (info == nullptr || info->sparse || signature.Has(info->id)) {
+                    printf("ECS: load failed, archetype %u is damaged\n", a);
+                    return false;
+                }
+                signature.Set(info->id);
+                int at = 0;
+                while (at < sorted.Length() && sorted[at]->id < info->id) at++;
+                sorted.Insert(info, at);
+            }
+            CArchetype<TAlloc> *archetype = findArchetype(sorted);
+
+            for (uint32_t c = 0; c < record->chunks; c++) {
+                const auto *chunk = reader.Take<typename CArchetype<TAlloc>::TChunk>(1);
+                const uint32_t count = chunk != nullptr ? chunk->count : 0;
+                const CEntityId *ids = chunk != nullptr ? reader.Take<CEntityId>(count) : nullptr;
+                const uint8_t *states = ids != nullptr ? reader.Take<uint8_t>(count) : nullptr;
+                const char *data[ECSInternals::kMaxComponents]{};
+                // a wide column cut short can leave room for a narrower one after it, every column has to be whole
+                bool whole = states != nullptr;
+                for (uint32_t i = 0; i < record->columns && whole; i++)
+                    whole = (data[i] = reader.Take<char>((size_t) count * infos[columns[i]]->size)) != nullptr;
+                if (!whole || count > archetype->Capacity() || chunk->used > count ||
+                    (chunk->free >= count && chunk->free != ECSInternals::kNoIndex)) {
+                    printf("ECS: load failed, chunk %u of archetype %u is damaged\n", c, a);
+                    return false;
+                }
+
+                typename CArchetype<TAlloc>::TChunk *target = archetype->grow();
+                const uint32_t chunkIndex = archetype->Chunks() - 1;
+                *target = *chunk;
+                memcpy(archetype->Ids(target), ids, count * sizeof(CEntityId));
+                memcpy(archetype->States(target), states, count);
+                for (uint32_t i = 0; i < record->columns; i++) {
+                    const ECSInternals::CComponentInfo *info = infos[columns[i]];
+                    const uint32_t column = archetype->Column(info->id);
+                    memcpy(archetype->Column(target, column), data[i], (size_t) count * info->size);
+                    std::fill(archetype->Added(target, column), archetype->Added(target, column) + count, mTick);
+                    std::fill(archetype->Changed(target, column), archetype->Changed(target, column) + count, mTick);
+                    archetype->Newest(target)[column * 2] = mTick;
+                    archetype->Newest(target)[column * 2 + 1] = mTick;
+                }
+                uint32_t used = 0;
+                for (uint32_t row = 0; row < count; row++) {
+                    const uint8_t state = states[row];
+                    // free rows chain through their id to the next free row
+                    const uint32_t index = state == CArchetype<TAlloc>::kRowFree ? (uint32_t) ids[row]
+                                                                                 : owner(ids[row], state);
+                    if (state == CArchetype<TAlloc>::kRowFree ? index >= count && index != ECSInternals::kNoIndex
+                                                              : index == ECSInternals::kNoIndex) {
+                        printf("ECS: load failed, chunk %u of archetype %u is damaged\n", c, a);
+                        return false;
+                    }
+                    if (state == CArchetype<TAlloc>::kRowFree) continue;
+                    if (state == CArchetype<TAlloc>::kRowLive) archetype->mLength++;
+                    used++;
+                    CEntity<TAlloc> *entity = make(index);
+                    entity->mArchetype = archetype;
+                    entity->mChunk = chunkIndex;
+                    entity->mRow = row;
+                }
+                if (used != chunk->used) {
+                    printf("ECS: load failed, chunk %u of archetype %u is damaged\n", c, a);
+                    return false;
+                }
+            }
+        }
+
+        for (uint32_t i = 0; i < slots; i++) {
+            if (table[i].state == CArchetype<TAlloc>::kRowFree) mEntities.Restore(i, table[i].generation, nullptr);
+            else if (mEntities.At(i) == nullptr) make(i);
+        }
+        mEntities.Link();
+
+        for (uint32_t p = 0; p < header->pools; p++) {
+            const TSnapshotPool *record = reader.Take<TSnapshotPool>(1);
+            const ECSInternals::CComponentInfo *info =
+                    record != nullptr && record->type < header->types ? infos[record->type] : nullptr;
+            const CEntityId *ids = info != nullptr ? reader.Take<CEntityId>(record->length) : nullptr;
+            const char *components = ids != nullptr ? reader.Take<char>((size_t) record->length * info->size) : nullptr;
+            if (components == nullptr || !info->sparse) {
+                printf("ECS: load failed, sparse set %u is damaged\n", p);
+                return false;
+            }
+            for (uint32_t i = 0; i < record->length; i++) {
+                CEntity<TAlloc> *entity = mEntities.Get(ids[i]);
+                if (entity == nullptr) {
+                    printf("ECS: load failed, sparse set %u is damaged\n", p);
+                    return false;
+                }
+                if (entity->mSparse.Has(info->id)) continue;
+                memcpy(emplace(entity, info), components + (size_t) i * info->size, info->size);
+            }
+        }
+        return true;
+    }
+
+    // destroys every entity at once, with the hooks and removal log performDelete runs for each
+    inline void clear() {
+        for (auto archetype: mArchetypes) {
+            for (uint32_t column = 0; column < archetype->Columns(); column++) {
+                const ECSInternals::CComponentInfo *info = archetype->Info(column);
+                const bool tracked = mTracked.Has(info->id);
+                if (!tracked && mOnRemove[info->id].invoke == nullptr && info->destroy == nullptr) continue;
+                for (uint32_t c = 0; c < archetype->Chunks(); c++) {
+                    typename CArchetype<TAlloc>::TChunk *chunk = archetype->Chunk(c);
+                    for (uint32_t row = 0; row < chunk->count; row++) {
+                        const uint8_t state = archetype->States(chunk)[row];
+                        if (state == CArchetype<TAlloc>::kRowFree) continue;
+                        const CEntityId entity = archetype->Ids(chunk)[row];
+                        void *component = archetype->Component(c, column, row);
+                        if (tracked && state == CArchetype<TAlloc>::kRowLive)
+                            mRemoved.Add(TRemoved{info->id, entity, mTick});
+                        mOnRemove[info->id](this, entity, component);
+                        info->Destroy(component);
+                    }
+                }
+            }
+        }
+        for (CComponentId id = 0; id < ECSInternals::kMaxComponents; id++) {
+            CComponentPool<TAlloc> *pool = mPools[id];
+            if (pool == nullptr) continue;
+            for (uint32_t i = 0; i < pool->Length(); i++) {
+                logRemoved(id, mEntities.Get(pool->Ids()[i]));
+                mOnRemove[id](this, pool->Ids()[i], pool->At(i));
+            }
+        }
+        discard();
+    }
+
+    // drops every row, sparse set and entity without running hooks, after clear or for a half loaded snapshot
+    inline void discard() {
+        for (auto archetype: mArchetypes) {
+            archetype->clear();
+            notify(archetype);
+        }
+        for (CComponentId id = 0; id < ECSInternals::kMaxComponents; id++) {
+            if (mPools[id] == nullptr) continue;
+            Free<TAlloc>(&mPools[id]);
+            mPools[id] = nullptr;
+        }
+        for (uint32_t i = 0; i < mEntities.Size(); i++)
+            if (mEntities.At(i) != nullptr) mEntities.At(i)->~CEntity<TAlloc>();
+        slab_destroy(&mEntitySlab);
+        mEntitySlab = makeSlab<CEntity<TAlloc>>(mSlabCount);
+        mEntities.Reset(0);
+        mEntities.Link();
+    }
+
+    // OnAdd for every component of the loaded world whose type has a hook, then systems see the new lengths
+    inline void loaded() {
+        for (auto archetype: mArchetypes) {
+            for (uint32_t column = 0; column < archetype->Columns(); column++) {
+                const CComponentId id = archetype->Info(column)->id;
+                if (mOnAdd[id].invoke == nullptr) continue;
+                for (uint32_t c = 0; c < archetype->Chunks(); c++) {
+                    typename CArchetype<TAlloc>::TChunk *chunk = archetype->Chunk(c);
+                    for (uint32_t row = 0; row < chunk->count; row++)
+                        if (archetype->States(chunk)[row] != CArchetype<TAlloc>::kRowFree)
+                            mOnAdd[id](this, archetype->Ids(chunk)[row], archetype->Component(c, column, row));
+                }
             }
+            notify(archetype);
+        }
+        for (CComponentId id = 0; id < ECSInternals::kMaxComponents; id++) {
+            CComponentPool<TAlloc> *pool = mPools[id];
+            if (pool == nullptr || mOnAdd[id].invoke == nullptr) continue;
+            for (uint32_t i = 0; i < pool->Length(); i++) mOnAdd[id](this, pool->Ids()[i], pool->At(i));
         }
-        (*entity)->~CEntity<TAlloc>();
-        slab_free(mEntitySlab, (void **) entity);
-        mEntities.Remove(entityId);
     }
 
 public:
@@ -364,89 +2136,289 @@ public:
     explicit inline CDirector(const CDirector &) = delete;
 
     inline ~CDirector() {
-        for (const auto &entity: mEntities) (entity->value)->~CEntity<TAlloc>();
+        for (uint32_t i = 0; i < mEntities.Size(); i++)
+            if (mEntities.At(i) != nullptr) mEntities.At(i)->~CEntity<TAlloc>();
 
-        for (const auto &p: mComponents) {
-            for (const auto &c: *(p->value))
-                c->value->~CComponent<TAlloc>();
-            Free<TAlloc>(&p->value);
-        }
+        for (auto commands: mCommands) Free<TAlloc>(&commands);
+
+        for (auto archetype: mArchetypes) Free<TAlloc>(&archetype);
+        for (auto pool: mPools)
+            if (pool != nullptr) Free<TAlloc>(&pool);
 
         for (const auto &entity: mSystems) (entity->value)->~CBaseSystem<TAlloc>();
 
+        if (mPool != nullptr) Free<TAlloc>(&mPool);
         slab_destroy(&mEntitySlab);
-        for (const auto &p: mComponentsSlab) slab_destroy(&(p->value));
         for (const auto &p: mSystemsSlab) slab_destroy(&(p->value));
 
     }
 
     inline CEntityId CreateEntity() {
-        auto entity = new(slab_alloc(mEntitySlab)) CEntity<TAlloc>(mEntityCounter++);
-        mEntities.Set(entity->Id(), entity);
-        return entity->Id();
+        assert(!mRunning && "ECS: entities can only be created on the main thread");
+        const CEntityId id = mEntities.Acquire();
+        mEntities.Set(id, new(slab_alloc(mEntitySlab)) CEntity<TAlloc>(this, id));
+        return id;
     }
 
     inline void DestroyEntity(CEntityId entityId) {
-        if (!mEntities.Contains(entityId))
-            return;
+        assert(!mRunning && "ECS: entities can only be destroyed on the main thread");
+        performDelete(entityId);
+    }
 
-        for (auto system: mSystems)
-            system->value->OnEntityDestroyed(entityId);
+    // every committed entity holding all of Types, a CSparseView when one of them is sparse
+    template<class ...Types>
+    inline auto View() {
+        if constexpr ((ECSInternals::IsSparse<Types> || ...)) return CSparseView<TAlloc, Types...>(this);
+        else return CArchetypeView<TAlloc, Types...>(mArchetypes);
+    }
 
-        performDelete(entityId);
+    // every entity holding a T, iterated like a system with one component
+    template<class T>
+    inline auto Query() {
+        return View<T>();
     }
 
+    // orders the sparse set of T by entity, views driven by it then walk entities in creation order
     template<class T>
-    inline EntityComponentMap *Query() {
-        CComponentId id = ECSInternals::GetComponentTypeId<TAlloc, T>();
-        const auto &found = mComponents.Get(id);
-        if (found == nullptr) return nullptr;
-        return (*found);
+    inline void SortComponents() {
+        static_assert(ECSInternals::IsSparse<T>, "only sparse components are kept in a set of their own");
+        CComponentPool<TAlloc> *pool = mPools[ECSInternals::GetComponentTypeId<TAlloc, T>()];
+        if (pool != nullptr) pool->Sort();
     }
 
+    template<class T>
+    inline T *GetComponent(CEntityId entityId) {
+        CEntity<TAlloc> *entity = mEntities.Get(entityId);
+        if (entity == nullptr) return nullptr;
+        return entity->template GetComponent<T>();
+    }
+
+    // moves the entity to the archetype with T added, pointers to its other components are invalidated. a sparse T
+    // goes to the set of its type instead, which may relocate other components of that type
     template<class T, class... Args>
     inline T *AddComponent(CEntityId entityId, Args &&...args) {
-        const auto &entity = mEntities.Get(entityId);
+        assert(!mRunning && "ECS: components can only be added on the main thread");
+        CEntity<TAlloc> *entity = mEntities.Get(entityId);
         if (entity == nullptr) return nullptr;
-        EntityComponentMap *entityComponents;
-        CComponentId id = ECSInternals::GetComponentTypeId<TAlloc, T>();
-        const auto &found = mComponents.Get(id);
-        if (found != nullptr) {
-            entityComponents = (*found);
-            const auto &component = entityComponents->Get(entityId);
-            if (component != nullptr)
-                return (T *) (*component);
-        } else {
-            entityComponents = AllocNew<TAlloc, EntityComponentMap>();
-            mComponents.Set(id, entityComponents);
-        }
-        T *component = new(slab_alloc(getComponentSlab<T>())) T(std::forward<Args>(args)...);
-        component->SetEntity(this, entityId, (*entity));
-        (*entity)->template AddComponent<T>(component);
-        entityComponents->Set(entityId, component);
+        const ECSInternals::CComponentInfo *info = ECSInternals::GetComponentInfo<TAlloc, T>();
+        void *existing = entity->Component(info->id);
+        if (existing != nullptr) return (T *) existing;
+        T *component = ECSInternals::Construct<T>(place(entity, info), std::forward<Args>(args)...);
+        if constexpr (std::is_base_of_v<CComponent<TAlloc>, T>) component->SetEntity(this, entityId, entity);
+        mOnAdd[info->id](this, entityId, component);
         return component;
     }
 
+    // called with every T added to an entity, after it was constructed and moved in. pass nullptr to clear
+    template<class T>
+    inline void OnAdd(void (*hook)(CDirector *director, CEntityId entity, T *component)) {
+        mOnAdd[ECSInternals::GetComponentTypeId<TAlloc, T>()] = makeHook<T>(hook);
+    }
+
+    // called with every T removed from an entity, or destroyed with it, before its destructor runs
+    template<class T>
+    inline void OnRemove(void (*hook)(CDirector *director, CEntityId entity, T *component)) {
+        mOnRemove[ECSInternals::GetComponentTypeId<TAlloc, T>()] = makeHook<T>(hook);
+    }
+
+    // moves the entity to the archetype without T, pointers to its other components are invalidated
+    template<class T>
+    inline bool RemoveComponent(CEntityId entityId) {
+        assert(!mRunning && "ECS: components can only be removed on the main thread");
+        CEntity<TAlloc> *entity = mEntities.Get(entityId);
+        if (entity == nullptr) return false;
+        return removeComponent(entity, ECSInternals::GetComponentInfo<TAlloc, T>());
+    }
+
+    // makes the entity visible to systems
     inline void Commit(CEntityId entityId) {
-        const auto &entity = mEntities.Get(entityId);
+        CEntity<TAlloc> *entity = mEntities.Get(entityId);
         assert(entity != nullptr && "ECS: entity not found");
-        for (const auto &sys: mSystems) {
-            sys->value->OnEntityCreated(*entity);
+        assert(!mRunning && "ECS: entities can only be committed on the main thread");
+        commit(entity);
+    }
+
+    // stamps the component as changed with the current tick, see CSystem::Changed. plain data is marked by entity
+    template<class T>
+    inline void MarkChanged(T *component) {
+        static_assert(std::is_base_of_v<CComponent<TAlloc>, T>, "T has no entity, pass its entity id instead");
+        component->mEntity->MarkChanged(ECSInternals::GetComponentTypeId<TAlloc, T>());
+    }
+
+    template<class T>
+    inline void MarkChanged(CEntityId entityId) {
+        CEntity<TAlloc> *entity = mEntities.Get(entityId);
+        if (entity != nullptr) entity->MarkChanged(ECSInternals::GetComponentTypeId<TAlloc, T>());
+    }
+
+    // fn(entityId) for every committed entity that lost a T after tick, logged from the first call on
+    template<class T, class F>
+    inline void Removed(uint32_t tick, F &&fn) {
+        const CComponentId id = ECSInternals::GetComponentTypeId<TAlloc, T>();
+        mTracked.Set(id);
+        for (const auto &removed: mRemoved)
+            if (removed.component == id && removed.tick > tick) fn(removed.entity);
+    }
+
+    [[nodiscard]]
+    inline uint32_t Tick() const { return mTick; }
+
+    // command buffer of the calling thread, which has to be the main thread or a worker of this director's pool
+    inline CCommandBuffer<TAlloc> &Commands() {
+        if (mCommands.Empty()) {
+            assert(!mRunning && "ECS: command buffers are made on Create");
+            mCommands.Add(AllocNew<TAlloc, CCommandBuffer<TAlloc>>());
+        }
+        const unsigned int thread = CJobPool::ThreadIndex();
+        assert(thread < (unsigned int) mCommands.Length() && "ECS: thread does not belong to the director's pool");
+        return *mCommands[thread];
+    }
+
+    // applies what the command buffers recorded, one buffer after the other in thread order. Update plays them back
+    // after every phase, call it when recording outside of Update
+    inline void Playback() {
+        assert(!mRunning && "ECS: command buffers can only be played back on the main thread");
+        for (auto commands: mCommands)
+            if (!commands->Empty()) play(commands);
+    }
+
+    // names Types for Load, a type is known once anything used it with this allocator, a system declaring it will do
+    template<class ...Types>
+    static inline void Register() {
+        (ECSInternals::GetComponentInfo<TAlloc, Types>(), ...);
+    }
+
+    // writes every entity, with its id, and its components to path. components must be plain data and the files
+    // only load in builds of the same compiler and component layouts, call it outside of Update
+    inline bool Save(const char *path) {
+        assert(!mRunning && "ECS: worlds can only be saved on the main thread");
+        for (auto commands: mCommands)
+            assert(commands->Empty() && "ECS: play the command buffers back before saving");
+
+        uint32_t typeOf[ECSInternals::kMaxComponents];
+        TArray<TSnapshotType, TAlloc> types;
+        auto use = [&types, &typeOf](const ECSInternals::CComponentInfo *info) {
+            if (!info->plain) {
+                printf("ECS: save failed, %s is not plain data\n", info->name);
+                return false;
+            }
+            for (uint32_t i = 0; i < (uint32_t) types.Length(); i++)
+                if (types[i].hash == info->hash) return true;
+            typeOf[info->id] = types.Length();
+            types.Add(TSnapshotType{info->hash, info->size, info->alignment});
+            return true;
+        };
+        uint32_t archetypes = 0, pools = 0;
+        for (auto archetype: mArchetypes) {
+            uint32_t used = 0;
+            for (uint32_t c = 0; c < archetype->Chunks(); c++) used += archetype->Chunk(c)->used;
+            if (used == 0) continue;
+            archetypes++;
+            for (uint32_t column = 0; column < archetype->Columns(); column++)
+                if (!use(archetype->Info(column))) return false;
+        }
+        for (auto pool: mPools) {
+            if (pool == nullptr || pool->Length() == 0) continue;
+            pools++;
+            if (!use(pool->Info())) return false;
+        }
+
+        FILE *file = fopen(path, "wb");
+        if (file == nullptr) {
+            printf("ECS: save failed, can't open %s\n", path);
+            return false;
         }
+        TWriter writer{file, false};
+        const TSnapshotHeader header{kSnapshotMagic, kSnapshotVersion, schemaOf(types.Ptr(), types.Length()),
+                                     ECSInternals::kChunkSize, (uint32_t) types.Length(), mEntities.Size(),
+                                     archetypes, pools, 0};
+        writer.Put(&header, sizeof(header));
+        writer.Put(types.Ptr(), types.Length() * sizeof(TSnapshotType));
+
+        TArray<TSnapshotSlot, TAlloc> table(mEntities.Size() + 1);
+        for (uint32_t i = 0; i < mEntities.Size(); i++) {
+            const CEntity<TAlloc> *entity = mEntities.At(i);
+            const uint32_t state = entity == nullptr ? CArchetype<TAlloc>::kRowFree
+                                                     : entity->mCommitted ? CArchetype<TAlloc>::kRowLive
+                                                                          : CArchetype<TAlloc>::kRowPending;
+            table.Add(TSnapshotSlot{mEntities.Generation(i), state});
+        }
+        writer.Put(table.Ptr(), table.Length() * sizeof(TSnapshotSlot));
+
+        for (auto archetype: mArchetypes) {
+            TSnapshotArchetype record{archetype->Columns(), 0};
+            for (uint32_t c = 0; c < archetype->Chunks(); c++)
+                if (archetype->Chunk(c)->used > 0) record.chunks++;
+            if (record.chunks == 0) continue;
+            uint32_t columns[ECSInternals::kMaxComponents];
+            for (uint32_t column = 0; column < record.columns; column++)
+                columns[column] = typeOf[archetype->Info(column)->id];
+            writer.Put(&record, sizeof(record));
+            writer.Put(columns, record.columns * sizeof(uint32_t));
+            for (uint32_t c = 0; c < archetype->Chunks(); c++) {
+                typename CArchetype<TAlloc>::TChunk *chunk = archetype->Chunk(c);
+                if (chunk->used == 0) continue;
+                writer.Put(chunk, sizeof(*chunk));
+                writer.Put(archetype->Ids(chunk), chunk->count * sizeof(CEntityId));
+                writer.Put(archetype->States(chunk), chunk->count);
+                for (uint32_t column = 0; column < record.columns; column++)
+                    writer.Put(archetype->Column(chunk, column), (size_t) chunk->count * archetype->Info(column)->size);
+            }
+        }
+
+        for (auto pool: mPools) {
+            if (pool == nullptr || pool->Length() == 0) continue;
+            const TSnapshotPool record{typeOf[pool->Info()->id], pool->Length()};
+            writer.Put(&record, sizeof(record));
+            writer.Put(pool->Ids(), pool->Length() * sizeof(CEntityId));
+            writer.Put(pool->At(0), (size_t) pool->Length() * pool->Info()->size);
+        }
+
+        if (fclose(file) != 0) writer.failed = true;
+        if (writer.failed) printf("ECS: save failed, can't write %s\n", path);
+        return !writer.failed;
+    }
+
+    // replaces every entity with the ones of a snapshot made by Save, entity ids stay what they were when saved.
+    // the world is left alone when the snapshot's types or entity table do not fit it and left empty when its rows
+    // turn out damaged, loaded components count as added on this tick
+    inline bool Load(const void *data, size_t size) {
+        assert(!mRunning && "ECS: worlds can only be loaded on the main thread");
+        if (!readSnapshot(data, size)) return false;
+        loaded();
+        return true;
+    }
+
+    // maps the file instead of reading it, chunks are copied straight out of the page cache
+    inline bool Load(const char *path) {
+        size_t size = 0;
+        const void *data = page_map_file(path, &size);
+        if (data == nullptr) return false;
+        const bool result = Load(data, size);
+        page_unmap_file(data, size);
+        return result;
     }
 
     inline void Fit() {
-        for (const auto &entity: mEntities) entity->value->mComponents.Fit();
         mEntities.Fit();
         for (const auto &sys: mSystems) {
             sys->value->Fit();
         }
         mSystems.Fit();
-        for (const auto &p: mComponents) p->value->Fit();
-        mComponents.Fit();
+        mOrder.Fit();
+        mSchedule.Fit();
+        mPhases.Fit();
+        for (auto archetype: mArchetypes) archetype->Fit();
+        mArchetypes.Fit();
+        mRoots.Fit();
+        mRemoved.Fit();
+        for (auto pool: mPools)
+            if (pool != nullptr) pool->Fit();
+        for (auto commands: mCommands) commands->Fit();
+        mCommands.Fit();
+        mPlaced.Fit();
 
         slab_fit(mEntitySlab);
-        for (const auto &p: mComponentsSlab) slab_fit(p->value);
         for (const auto &p: mSystemsSlab) slab_fit(p->value);
     }
 
@@ -458,20 +2430,51 @@ public:
         T *sys = new(slab_alloc(getSystemSlab<T>())) T(std::forward<Args>(args)...);
         sys->mDirector = this;
         mSystems.Set(id, sys);
+        mOrder.Add(sys);
+        mScheduled = false;
+        CBaseSystem<TAlloc> *base = sys;
+        for (auto archetype: mArchetypes) {
+            if (matches(base, archetype)) {
+                archetype->mSystems.Add(base);
+                base->OnLengthChanged();
+            }
+        }
         return sys;
     }
 
+    // runs every phase on the calling thread in schedule order, the results match a parallel run
+    inline void SetParallel(bool parallel) { mParallel = parallel; }
+
+    // worker threads next to the calling one, 0 picks one less than the hardware threads, takes effect on Create
+    inline void SetThreads(unsigned int threads) { mThreads = threads; }
+
     inline void Create() {
-        for (auto sys: mSystems) { sys->value->Create(); }
+        for (auto sys: mOrder) { sys->Create(); }
+        if (mPool == nullptr && mParallel)
+            mPool = mThreads > 0 ? AllocNew<TAlloc, CJobPool>(mThreads) : AllocNew<TAlloc, CJobPool>();
+        const unsigned int threads = mPool != nullptr ? mPool->Threads() : 1;
+        while ((unsigned int) mCommands.Length() < threads)
+            mCommands.Add(AllocNew<TAlloc, CCommandBuffer<TAlloc>>());
     }
 
     inline void Update() {
         debug_origin(vec2_zero);
-        debug_stringf(Vec2{10, 100}, "entities: %d / %d", mEntities.Length(), mEntities.Capacity());
-
-        for (auto sys: mSystems) {
-            if (sys->value->mShouldUpdate)
-                sys->value->Update();
+        debug_stringf(Vec2{10, 100}, "entities: %d / %d, archetypes: %d", mEntities.Length(), mEntities.Capacity(),
+                      mArchetypes.Length());
+
+        // removals stay logged for a whole Update, every system running once per Update has seen them by then
+        int kept = 0;
+        for (int i = 0; i < mRemoved.Length(); i++)
+            if (mRemoved[i].tick >= mFrame) mRemoved[kept++] = mRemoved[i];
+        while (mRemoved.Length() > kept) mRemoved.Pop();
+        mFrame = mTick;
+
+        if (!mScheduled) schedule();
+        for (uint32_t phase = 0; phase + 1 < (uint32_t) mPhases.Length(); phase++) {
+            mTick++;
+            runPhase(phase);
+            mTick++;
+            Playback();
         }
     }
 };
@@ -5,6 +5,8 @@
 #include <cstring>
 #include <utility>
 #include <typeinfo>
+#include <new>
+#include <memory_resource>
 
 extern "C" {
 #include "mem/alloc.h"
@@ -13,10 +15,88 @@ extern "C" {
 #include "mem/arena.h"
 #include "mem/slab.h"
 #include "mem/p2slab.h"
+#include "mem/frame.h"
+#include "mem/stats.h"
+#include "mem/trace.h"
 }
 
 class StringMemory;
 
+// tags allocations made by this thread while in scope, only recorded with MEM_STATS_MODE
+class CMemoryTag {
+public:
+    explicit CMemoryTag(const char *tag) {
+#if MEM_STATS_MODE
+        mPrevious = mem_stats_tag(tag);
+#else
+        (void) tag;
+#endif
+    }
+
+    ~CMemoryTag() {
+#if MEM_STATS_MODE
+        mem_stats_tag(mPrevious);
+#endif
+    }
+
+    CMemoryTag(const CMemoryTag &) = delete;
+
+    CMemoryTag &operator=(const CMemoryTag &) = delete;
+
+private:
+    const char *mPrevious = nullptr;
+};
+
+// records every allocator call made while in scope to path, only with MEM_TRACE_MODE
+class CMemoryTrace {
+public:
+    explicit CMemoryTrace(const char *path) {
+#if MEM_TRACE_MODE
+        mRecording = mem_trace_start(path);
+#else
+        (void) path;
+#endif
+    }
+
+    ~CMemoryTrace() {
+#if MEM_TRACE_MODE
+        if (mRecording) mem_trace_stop();
+#endif
+    }
+
+    CMemoryTrace(const CMemoryTrace &) = delete;
+
+    CMemoryTrace &operator=(const CMemoryTrace &) = delete;
+
+private:
+    bool mRecording = false;
+};
+
+// rewinds the stack to where it was on construction, anything allocated from it in between needs no free
+class TScratchScope {
+public:
+    explicit TScratchScope(StackMemory *stack = alloc->stack) : mStack(stack), mMark(stack_mark(stack)) {}
+
+    ~TScratchScope() { stack_rewind(mStack, mMark); }
+
+    TScratchScope(const TScratchScope &) = delete;
+
+    TScratchScope &operator=(const TScratchScope &) = delete;
+
+    inline void *Alloc(size_t size, unsigned int alignment = sizeof(size_t)) {
+        return stack_bump(mStack, size, alignment);
+    }
+
+    template<typename C>
+    inline C *Alloc(unsigned int length = 1) {
+        return (C *) stack_bump(mStack, length * sizeof(C), alignof(C) > sizeof(size_t) ? alignof(C) : sizeof(size_t));
+    }
+
+private:
+    StackMemory *mStack;
+    StackMark mMark;
+};
+
 template<class T, bool Clean = false>
 inline void *Alloc(size_t size = -1, unsigned int alignment = sizeof(size_t)) {
     void *m = nullptr;
@@ -30,10 +110,12 @@ inline void *Alloc(size_t size = -1, unsigned int alignment = sizeof(size_t)) {
         m = stack_alloc(alloc->stack, size, alignment);
     } else if constexpr (std::is_same_v<T, ArenaMemory>) {
         m = arena_alloc(alloc->global, size, alignment);
+    } else if constexpr (std::is_same_v<T, FrameMemory>) {
+        m = frame_alloc(alloc->frame, size, alignment);
     } else if constexpr (std::is_same_v<T, BuddyMemory>) {
         m = buddy_alloc(alloc->buddy, size);
     } else if constexpr (std::is_same_v<T, SlabMemory>) {
-        m = p2slab_alloc(alloc->slab, size);
+        m = p2slab_alloc_cached(alloc->slab, size);
     } else {
         m = T::Alloc(size, alignment);
     }
@@ -70,9 +152,9 @@ inline void Free(void **ptr) {
         buddy_free(alloc->buddy, ptr);
         return;
     } else if constexpr (std::is_same_v<T, SlabMemory>) {
-        p2slab_free(alloc->slab, ptr);
+        p2slab_free_cached(alloc->slab, ptr);
         return;
-    } else if constexpr (std::is_same_v<T, ArenaMemory>) {
+    } else if constexpr (std::is_same_v<T, ArenaMemory> || std::is_same_v<T, FrameMemory>) {
         return;
     } else {
         T::Free(ptr);
@@ -85,4 +167,82 @@ template<class T, class C>
 inline void Free(C **ptr) {
     (*ptr)->~C();
     Free<T>((void **) ptr);
-}
\ No newline at end of file
+}
+
+// std::pmr adapter for one of the allocator tags above, so containers draw from MemoryLayout and show up in its stats.
+// StackMemory hands out bump memory for a TScratchScope to take back, ArenaMemory and FrameMemory never free,
+// BuddyMemory and SlabMemory payloads are only 8 byte aligned, wider alignments are served by FreeListMemory instead
+template<class T>
+class TMemoryResource : public std::pmr::memory_resource {
+    static constexpr bool kNarrow = std::is_same_v<T, BuddyMemory> || std::is_same_v<T, SlabMemory>;
+
+public:
+    explicit TMemoryResource(const char *tag = nullptr) : mTag(tag) {}
+
+    static TMemoryResource *Get() {
+        static TMemoryResource resource;
+        return &resource;
+    }
+
+protected:
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        CMemoryTag tag(mTag);
+        if (bytes == 0) bytes = 1;
+        void *m;
+        if constexpr (std::is_same_v<T, StackMemory>)
+            m = stack_bump(alloc->stack, bytes, alignment);
+        else if (kNarrow && alignment > sizeof(size_t))
+            m = Alloc<FreeListMemory>(bytes, alignment);
+        else
+            m = Alloc<T>(bytes, alignment);
+        if (m == nullptr)
+            throw std::bad_alloc();
+        return m;
+    }
+
+    // callers hand back the alignment they allocated with, so it picks the same allocator again
+    void do_deallocate(void *p, size_t, size_t alignment) override {
+        if (kNarrow && alignment > sizeof(size_t))
+            Free<FreeListMemory>(&p);
+        else if constexpr (!std::is_same_v<T, StackMemory>)
+            Free<T>(&p);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return dynamic_cast<const TMemoryResource *>(&other) != nullptr;
+    }
+
+private:
+    const char *mTag;
+};
+
+// STL allocator over the shared TMemoryResource of an allocator tag, e.g. std::vector<int, TAllocator<FreeListMemory, int>>
+template<class T, typename C>
+class TAllocator {
+public:
+    using value_type = C;
+
+    template<typename U>
+    struct rebind {
+        using other = TAllocator<T, U>;
+    };
+
+    TAllocator() noexcept = default;
+
+    template<typename U>
+    TAllocator(const TAllocator<T, U> &) noexcept {}
+
+    inline C *allocate(size_t n) {
+        return (C *) TMemoryResource<T>::Get()->allocate(n * sizeof(C), alignof(C));
+    }
+
+    inline void deallocate(C *p, size_t n) {
+        TMemoryResource<T>::Get()->deallocate(p, n * sizeof(C), alignof(C));
+    }
+
+    template<typename U>
+    inline bool operator==(const TAllocator<T, U> &) const noexcept { return true; }
+
+    template<typename U>
+    inline bool operator!=(const TAllocator<T, U> &) const noexcept { return false; }
+};
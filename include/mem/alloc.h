@@ -11,8 +11,31 @@
 #include "mem/freelist.h"
 #include "mem/buddy.h"
 #include "mem/p2slab.h"
+#include "mem/frame.h"
+#include "mem/stats.h"
+#include "mem/trace.h"
+#include "mem/page.h"
+#include "mem/guard.h"
 #include "mem/utils.h"
 
+typedef enum {
+    ALLOC_BOOT,
+    ALLOC_GLOBAL,
+    ALLOC_STACK,
+    ALLOC_FREELIST,
+    ALLOC_STRING,
+    ALLOC_BUDDY,
+    ALLOC_FRAME,
+    ALLOC_SLAB,
+    ALLOC_REGIONS
+} AllocRegion;
+
+// PAGE_HUGE and/or PAGE_NUMA with the node to bind to, a zeroed backing keeps the region inside boot
+typedef struct {
+    unsigned char flags;
+    unsigned char node;
+} MemoryBacking;
+
 typedef struct {
     unsigned int boot;
     unsigned int global;
@@ -20,6 +43,9 @@ typedef struct {
     unsigned int freelist;
     unsigned int string;
     unsigned int buddy;
+    unsigned int frame;
+    unsigned int slab; // slab pages come from the system heap unless backing[ALLOC_SLAB] gives them a region
+    MemoryBacking backing[ALLOC_REGIONS];
 } MemoryMetadata;
 
 typedef struct {
@@ -31,8 +57,14 @@ typedef struct {
     FreeListMemory *string;
     BuddyMemory *buddy;
     P2SlabMemory *slab;
+    FrameMemory *frame;
+    FreeListMemory *slabPages;
+    void *_regions[ALLOC_REGIONS]; // mappings of regions with their own backing
+    size_t _sizes[ALLOC_REGIONS];
 } MemoryLayout;
 
+#define ALLOC_FRAME_BUFFERS 2
+
 extern MemoryLayout *alloc;
 
 void alloc_create(MemoryMetadata meta);
@@ -42,3 +74,4 @@ void alloc_terminate();
 void alloc_debug();
 
 #define alloc_global(Type, size) ((Type *)arena_alloc(alloc->global, size, sizeof(size_t)))
+#define alloc_frame(Type, size) ((Type *)frame_alloc(alloc->frame, size, sizeof(size_t)))
@@ -4,14 +4,26 @@
 
 #include "mem/utils.h"
 
+#define ARENA_VIRTUAL 1
+#define ARENA_HUGEPAGES 2
+
+// virtual arenas commit their reservation in granules as usage grows
+#define ARENA_COMMIT_GRANULE (64 * KILOBYTES)
+#define ARENA_HUGEPAGE_GRANULE (2 * MEGABYTES)
+
 typedef struct __attribute__((aligned(16), packed)) {
     unsigned int _padding;
+    unsigned int _committed;
+    unsigned int _flags;
     unsigned int total;
     unsigned int usage;
 } ArenaMemory;
 
 ArenaMemory *make_arena(unsigned int size);
 
+// reserves address space only, pages are committed on demand and released again on reset
+ArenaMemory *make_arena_virtual(unsigned int reserve, char hugePages);
+
 ArenaMemory *arena_create(void *m, unsigned int size);
 
 void arena_destroy(ArenaMemory **self);
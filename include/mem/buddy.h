@@ -2,9 +2,15 @@
 
 #include <stddef.h>
 
+#define BUDDY_MIN_ORDER 5
+#define BUDDY_MAX_ORDER 32
+
 typedef struct __attribute__((aligned(32), packed)) {
     void *_head;
     void *_tail;
+    unsigned char *_bitmap;
+    void *_free[BUDDY_MAX_ORDER];
+    unsigned int _order;
     unsigned int _padding;
     unsigned int total;
     unsigned int usage;
@@ -20,4 +26,7 @@ unsigned int buddy_size(unsigned int order);
 
 void *buddy_alloc(BuddyMemory *self, unsigned int size);
 
-char buddy_free(BuddyMemory *self, void **ptr);
\ No newline at end of file
+char buddy_free(BuddyMemory *self, void **ptr);
+
+// size of the largest free block, used for fragmentation stats
+unsigned int buddy_largest(BuddyMemory *self);
\ No newline at end of file
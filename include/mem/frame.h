@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "mem/arena.h"
+#include "mem/utils.h"
+
+#define FRAME_MAX_BUFFERS 4
+
+// n arenas used round robin, one per frame: memory from frame_alloc stays valid for n - 1 further frame_next calls
+typedef struct __attribute__((aligned(16), packed)) {
+    ArenaMemory *_arenas[FRAME_MAX_BUFFERS];
+    unsigned int _n;
+    unsigned int _current;
+    unsigned int _padding;
+    unsigned int frame;
+    unsigned int total;
+    unsigned int usage;
+    unsigned int last;
+    unsigned int peak;
+} FrameMemory;
+
+unsigned int frame_size(unsigned int size, unsigned int n);
+
+FrameMemory *frame_create(void *m, unsigned int size, unsigned int n);
+
+FrameMemory *make_frame(unsigned int size, unsigned int n);
+
+void frame_destroy(FrameMemory **self);
+
+void *frame_alloc(FrameMemory *self, unsigned int size, unsigned int alignment);
+
+void frame_next(FrameMemory *self);
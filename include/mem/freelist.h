@@ -5,14 +5,21 @@
 
 typedef struct __attribute__((aligned(16), packed)) {
     void *_next;
+    void *_tlsf;
     unsigned int _padding;
     unsigned int total;
+    unsigned int usage;
 } FreeListMemory;
 
 FreeListMemory *make_freelist(unsigned int size);
 
 FreeListMemory *freelist_create(void *m, unsigned int size);
 
+// two-level segregated fit mode, O(1) alloc and free at the cost of a ~6KB control block
+FreeListMemory *make_freelist_tlsf(unsigned int size);
+
+FreeListMemory *freelist_create_tlsf(void *m, unsigned int size);
+
 void freelist_destroy(FreeListMemory **self);
 
 void freelist_reset(FreeListMemory *self);
@@ -23,4 +30,7 @@ char freelist_free(FreeListMemory *self, void **ptr);
 
 unsigned int freelist_usage(FreeListMemory *self);
 
+// size of the largest free block, used for fragmentation stats
+unsigned int freelist_largest(FreeListMemory *self);
+
 
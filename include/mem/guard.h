@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "mem/utils.h"
+#include "mem/stats.h"
+
+// guarded block: MemGuardHeader, front canary ending in the link word, user bytes, back canary
+#define MEM_GUARD_LIVE 0xA110CA7EU
+#define MEM_GUARD_FREED 0xF7EEB10CU
+#define MEM_GUARD_CANARY 0xFDFDFDFDFDFDFDFDULL
+#define MEM_GUARD_FILL 0xFD
+#define MEM_GUARD_POISON 0xDD
+#define MEM_GUARD_TAIL 16
+#define MEM_GUARD_ALLOCATORS 32
+#define MEM_GUARD_QUARANTINE 64
+
+typedef struct __attribute__((aligned(8), packed)) {
+    void *prev;
+    void *next;
+    const void *allocator;
+    unsigned int size;
+    unsigned int front; // raw block to user address, the link word before the user bytes holds it xor the canary
+    unsigned int state;
+    unsigned int _padding;
+} MemGuardHeader;
+
+#define MEM_GUARD_ALIGNMENT(alignment) ((alignment) > 16 ? (alignment) : 16)
+#define MEM_GUARD_FRONT(alignment) \
+    MEMORY_SPACE((sizeof(MemGuardHeader) + sizeof(unsigned long long)), MEM_GUARD_ALIGNMENT(alignment))
+
+#if MEM_GUARD_MODE
+
+// raw size to request from the allocator for size user bytes, and the reverse for fixed size allocators
+#define MEM_GUARD_SIZE(size, alignment) ((size) + MEM_GUARD_FRONT(alignment) + MEM_GUARD_TAIL)
+#define MEM_GUARD_USABLE(size) ((size) - MEM_GUARD_FRONT(0) - MEM_GUARD_TAIL)
+
+// writes the header and canaries around a raw block and returns the user address
+void *mem_guard_alloc(const void *allocator, void *raw, unsigned int size, unsigned int alignment);
+
+// checks and poisons the block behind *ptr, then swaps *ptr for the raw block the allocator has to release:
+// 0 the block is corrupt or not ours, 1 release *ptr now, 2 the block went to quarantine and nothing is released.
+// stack blocks are released right away, anything else waits in a per allocator quarantine
+char mem_guard_free(const void *allocator, MemStatsKind kind, void **ptr);
+
+// checks and poisons a raw block the allocator drops on its own (stack pop and rewind), returns its user address
+void *mem_guard_drop(void *raw);
+
+// detaches a raw block about to be resized and returns its front, mem_guard_move attaches it again
+unsigned int mem_guard_detach(void *raw);
+
+void *mem_guard_move(const void *allocator, void *raw, unsigned int size, unsigned int front);
+
+// user size of a live raw block
+unsigned int mem_guard_length(const void *raw);
+
+// checks and forgets every block of the allocator, for reset and destroy
+void mem_guard_reset(const void *allocator);
+
+#else
+
+#define MEM_GUARD_SIZE(size, alignment) (size)
+#define MEM_GUARD_USABLE(size) (size)
+
+#endif
+
+// checks the canaries of every live block and the poison of every quarantined one,
+// returns the number of corrupt blocks, always 0 unless MEM_GUARD_MODE is on
+unsigned int alloc_validate();
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "mem/stats.h"
+#include "mem/trace.h"
+#include "mem/guard.h"
+
+// wraps the public alloc/free of every allocator, a plain call unless MEM_STATS_MODE, MEM_TRACE_MODE or
+// MEM_GUARD_MODE is on. call has to request MEM_GUARD_SIZE(size, alignment) bytes from the allocator
+
+#define MEM_HOOK_TOTAL(self) ((self) ? __atomic_load_n(&(self)->total, __ATOMIC_RELAXED) : 0)
+
+#if MEM_STATS_MODE
+#define MEM_HOOK_NOW() mem_stats_now()
+#define MEM_HOOK_STATS_ALLOC(kind, self, size, ptr, start) \
+    mem_stats_alloc(self, kind, size, ptr, start, MEM_STATS_USAGE(self), MEM_HOOK_TOTAL(self))
+#define MEM_HOOK_STATS_FREE(kind, self, ok, start) mem_stats_free(self, kind, ok, start, MEM_STATS_USAGE(self))
+#define MEM_HOOK_STATS_RELEASE(self) mem_stats_release(self)
+#else
+#define MEM_HOOK_NOW() 0ULL
+#define MEM_HOOK_STATS_ALLOC(kind, self, size, ptr, start) (void) (start)
+#define MEM_HOOK_STATS_FREE(kind, self, ok, start) (void) (start)
+#define MEM_HOOK_STATS_RELEASE(self)
+#endif
+
+#if MEM_TRACE_MODE
+#define MEM_HOOK_TRACE_ALLOC(kind, self, size, alignment, ptr) \
+    mem_trace_alloc(self, kind, size, alignment, ptr, MEM_HOOK_TOTAL(self))
+#define MEM_HOOK_TRACE_FREE(kind, self, ptr) mem_trace_free(self, kind, (ptr) ? *(ptr) : NULL)
+#define MEM_HOOK_TRACE_RELEASE(self) mem_trace_release(self)
+#define MEM_HOOK_TRACE_RESET(kind, self) mem_trace_reset(self, kind)
+#else
+#define MEM_HOOK_TRACE_ALLOC(kind, self, size, alignment, ptr)
+#define MEM_HOOK_TRACE_FREE(kind, self, ptr)
+#define MEM_HOOK_TRACE_RELEASE(self)
+#define MEM_HOOK_TRACE_RESET(kind, self)
+#endif
+
+#if MEM_GUARD_MODE
+#define MEM_HOOK_GUARD_ALLOC(self, size, alignment, raw) mem_guard_alloc(self, raw, size, alignment)
+// anything but a block to release now ends the free here, quarantined blocks count as freed
+#define MEM_HOOK_GUARD_FREE(kind, self, ptr, start) do { \
+    const char guard__ = mem_guard_free(self, kind, (void **) (ptr)); \
+    if (guard__ != 1) { \
+        MEM_HOOK_STATS_FREE(kind, self, guard__ != 0, start); \
+        return guard__ != 0; \
+    } \
+} while (0)
+#define MEM_HOOK_GUARD_RESET(self) mem_guard_reset(self)
+#else
+#define MEM_HOOK_GUARD_ALLOC(self, size, alignment, raw) (raw)
+#define MEM_HOOK_GUARD_FREE(kind, self, ptr, start)
+#define MEM_HOOK_GUARD_RESET(self)
+#endif
+
+#define MEM_HOOK_RESET(kind, self) do { \
+    MEM_HOOK_TRACE_RESET(kind, self); \
+    MEM_HOOK_GUARD_RESET(self); \
+} while (0)
+
+#if MEM_STATS_MODE || MEM_TRACE_MODE || MEM_GUARD_MODE
+
+#define MEM_HOOK_ALLOC(kind, self, size, alignment, call) do { \
+    const unsigned long long start__ = MEM_HOOK_NOW(); \
+    void *ptr__ = MEM_HOOK_GUARD_ALLOC(self, size, alignment, (call)); \
+    MEM_HOOK_STATS_ALLOC(kind, self, size, ptr__, start__); \
+    MEM_HOOK_TRACE_ALLOC(kind, self, size, alignment, ptr__); \
+    return ptr__; \
+} while (0)
+
+#define MEM_HOOK_FREE(kind, self, ptr, call) do { \
+    MEM_HOOK_TRACE_FREE(kind, self, ptr); \
+    const unsigned long long start__ = MEM_HOOK_NOW(); \
+    MEM_HOOK_GUARD_FREE(kind, self, ptr, start__); \
+    const char ok__ = (char) (call); \
+    MEM_HOOK_STATS_FREE(kind, self, ok__, start__); \
+    return ok__; \
+} while (0)
+
+#define MEM_HOOK_RELEASE(self) do { \
+    MEM_HOOK_STATS_RELEASE(self); \
+    MEM_HOOK_TRACE_RELEASE(self); \
+    MEM_HOOK_GUARD_RESET(self); \
+} while (0)
+
+#else
+
+#define MEM_HOOK_ALLOC(kind, self, size, alignment, call) return (call)
+#define MEM_HOOK_FREE(kind, self, ptr, call) return (call)
+#define MEM_HOOK_RELEASE(self)
+
+#endif
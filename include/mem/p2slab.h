@@ -5,25 +5,53 @@
 
 #define P2SLAB_MAX 29
 
+// thread caches hold up to P2SLAB_CACHE_SIZE objects per order for orders below P2SLAB_CACHE_ORDERS,
+// refilled from / flushed to the shared pools in batches of P2SLAB_CACHE_SIZE / 2
+#define P2SLAB_CACHE_ORDERS 12
+#define P2SLAB_CACHE_SIZE 32
+#define P2SLAB_CACHE_SLOTS 4
+
 typedef struct __attribute__((aligned(512), packed)) {
     GeneralAllocator _allocator;
-    char _pools[P2SLAB_MAX * 16];
+    char _pools[P2SLAB_MAX * 32];
     unsigned short _n;
     unsigned short _padding;
+    volatile int _lock;
     unsigned int total;
     unsigned int usage;
 } P2SlabMemory;
 
+typedef struct {
+    size_t allocHits;
+    size_t allocMisses;
+    size_t freeHits;
+    size_t freeMisses;
+} P2SlabCacheStats;
+
 P2SlabMemory *p2slab_create(void *m, unsigned int n);
 
 P2SlabMemory *p2slab_create_alloc(GeneralAllocator allocator, unsigned int n);
 
 P2SlabMemory *make_p2slab(unsigned int n);
 
+// no thread may use the instance while it is destroyed
 void p2slab_destroy(P2SlabMemory **self);
 
+// releases the spare empty page of every order, occupied pages are never scanned
 void p2slab_fit(P2SlabMemory *self);
 
 void *p2slab_alloc(P2SlabMemory *self, unsigned int size);
 
-char p2slab_free(P2SlabMemory *self, void **ptr);
\ No newline at end of file
+char p2slab_free(P2SlabMemory *self, void **ptr);
+
+// thread-safe front end, objects freed here may come from any thread
+void *p2slab_alloc_cached(P2SlabMemory *self, unsigned int size);
+
+char p2slab_free_cached(P2SlabMemory *self, void **ptr);
+
+// returns the calling thread's cached objects to the shared pools, a thread that exits does so for every instance
+void p2slab_cache_flush(P2SlabMemory *self);
+
+P2SlabCacheStats p2slab_cache_stats();
+
+void p2slab_cache_reset_stats();
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "mem/utils.h"
+
+// backing requests for page_alloc, both fall back to regular pages / the default node when unavailable
+#define PAGE_HUGE 1
+#define PAGE_NUMA 2
+
+#define PAGE_HUGE_SIZE (2 * MEGABYTES)
+
+// maps size bytes straight from the system, huge pages try MAP_HUGETLB first and transparent huge pages second
+void *page_alloc(size_t size, unsigned int flags, int node);
+
+// flags must match the ones the mapping was made with
+void page_free(void *m, size_t size, unsigned int flags);
+
+// binds the range to a NUMA node, pages already touched are migrated
+char page_bind(void *m, size_t size, int node);
+
+// page size backing the address, 0 when it can't be told
+size_t page_size_at(const void *m);
+
+// NUMA node of the page holding the address, -1 when unknown or not yet touched
+int page_node_at(const void *m);
+
+// maps a whole file read only, size receives its length. NULL when it can't be opened, is empty or can't be mapped
+const void *page_map_file(const char *path, size_t *size);
+
+void page_unmap_file(const void *m, size_t size);
@@ -8,6 +8,7 @@ typedef struct __attribute__((aligned(8), packed)) {
 
 typedef struct __attribute__((aligned(32), packed)) {
     PoolMemoryNode *_head;
+    size_t _top; // lock-free variant: 4bytes offset of the head node 4bytes aba tag
     unsigned int _padding;
     unsigned int _objectSize;
     unsigned int total;
@@ -25,3 +26,12 @@ void pool_destroy(PoolMemory **self);
 void *pool_alloc(PoolMemory *self);
 
 unsigned char pool_free(PoolMemory *self, void **ptr);
+
+// lock-free variant, pools created here must only be used through pool_alloc_atomic / pool_free_atomic
+PoolMemory *make_pool_atomic(unsigned int size, unsigned int objectSize);
+
+PoolMemory *pool_create_atomic(void *m, unsigned int size, unsigned int objectSize);
+
+void *pool_alloc_atomic(PoolMemory *self);
+
+unsigned char pool_free_atomic(PoolMemory *self, void **ptr);
@@ -3,10 +3,13 @@
 #include <stddef.h>
 #include "mem/utils.h"
 
+// pages move between the partial and full lists as objects come and go, a page that becomes empty is
+// kept as the single spare or handed back to the allocator right away
 typedef struct __attribute__((aligned(64), packed)) {
     GeneralAllocator _allocator;
-    void *_objects;
-    void *_pages;
+    void *_partial;
+    void *_full;
+    void *_empty;
     unsigned int _slabSize;
     unsigned int _objectSize;
     unsigned int _padding;
@@ -22,8 +25,9 @@ SlabMemory *make_slab(unsigned int slabSize, unsigned short objectSize);
 
 void slab_destroy(SlabMemory **self);
 
+// releases the spare empty page, occupied pages are never scanned
 void slab_fit(SlabMemory *self);
 
 void *slab_alloc(SlabMemory *self);
 
-char slab_free(SlabMemory *self, void **ptr);
\ No newline at end of file
+char slab_free(SlabMemory *self, void **ptr);
@@ -3,27 +3,60 @@
 
 #include <stddef.h>
 
+// segmented stacks drop an emptied chunk on the next pop unless they may keep it as a spare
+#define STACK_KEEP_SPARE 1
+
 typedef struct __attribute__((aligned(32), packed)) {
     void *_head;
+    void *_chunk; // current chunk of a segmented stack, NULL for a fixed one
+    void *_spare;
+    unsigned int _chunkSize;
+    unsigned int _flags;
     unsigned int _padding;
+    unsigned int _bumped; // high water mark of stack_bump in a fixed stack, chunks keep their own
     unsigned int total;
     unsigned int usage;
 } StackMemory;
 
+typedef struct {
+    void *head;
+    void *chunk;
+    unsigned int used;
+    unsigned int bumped;
+} StackMark;
+
 StackMemory *stack_create(void *m, unsigned int size);
 
 StackMemory *make_stack(unsigned int size);
 
+// m becomes the first chunk, further chunks of at least size bytes are chained from the system heap
+StackMemory *stack_create_segmented(void *m, unsigned int size, unsigned int flags);
+
+StackMemory *make_stack_segmented(unsigned int size, unsigned int flags);
+
 void stack_reset(StackMemory *self);
 
 void stack_destroy(StackMemory **self);
 
+// releases the spare chunk of a segmented stack
+void stack_fit(StackMemory *self);
+
 
 void *stack_alloc(StackMemory *self, unsigned int size, unsigned int alignment);
 
-char stack_expand(StackMemory *self, unsigned int newSize);
+// resizes the last allocation and returns its address, which moves when a segmented stack changes chunk
+void *stack_expand(StackMemory *self, unsigned int newSize);
 
 char stack_free(StackMemory *self, void **ptr);
 char stack_pop(StackMemory *self);
 
-unsigned int stack_n(StackMemory *self);
\ No newline at end of file
+unsigned int stack_n(StackMemory *self);
+
+StackMark stack_mark(StackMemory *self);
+
+// drops everything allocated since the mark in one go, including chunks chained after it
+void stack_rewind(StackMemory *self, StackMark mark);
+
+// no header and no free, released only by stack_rewind or stack_reset,
+// blocks allocated before it can't be freed until it is
+void *stack_bump(StackMemory *self, unsigned int size, unsigned int alignment);
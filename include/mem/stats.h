@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "mem/utils.h"
+
+#define MEM_STATS_MAX 32
+#define MEM_STATS_TAGS 64
+#define MEM_STATS_BUCKETS 32
+
+#define MEM_STATS_JSON 0
+#define MEM_STATS_CSV 1
+
+typedef enum {
+    MEM_STATS_ARENA,
+    MEM_STATS_STACK,
+    MEM_STATS_FREELIST,
+    MEM_STATS_BUDDY,
+    MEM_STATS_SLAB,
+    MEM_STATS_P2SLAB,
+    MEM_STATS_POOL,
+    MEM_STATS_KINDS
+} MemStatsKind;
+
+typedef struct {
+    const void *allocator;
+    const char *name;
+    MemStatsKind kind;
+    char live;
+    size_t allocs;
+    size_t frees;
+    size_t failures;
+    size_t bytes;
+    size_t histogram[MEM_STATS_BUCKETS]; // bucket i counts requests in [2^i, 2^(i+1))
+    unsigned long long allocNs;
+    unsigned long long allocMaxNs;
+    unsigned long long freeNs;
+    unsigned long long freeMaxNs;
+    unsigned int total;
+    unsigned int usage;
+    unsigned int peak;
+    unsigned int freeBytes; // sampled on dump and destroy
+    unsigned int largestFree;
+    size_t pageSize; // page size and numa node backing the allocator, sampled on dump
+    int node;
+} MemStats;
+
+typedef struct {
+    const char *tag;
+    size_t allocs;
+    size_t bytes;
+} MemStatsTag;
+
+#if MEM_STATS_MODE
+
+unsigned long long mem_stats_now();
+
+void mem_stats_register(const void *allocator, MemStatsKind kind, const char *name);
+
+// takes a last fragmentation sample and detaches the record, call before the allocator memory is released
+void mem_stats_release(const void *allocator);
+
+void mem_stats_alloc(const void *allocator, MemStatsKind kind, unsigned int size, const void *ptr,
+                     unsigned long long start, unsigned int usage, unsigned int total);
+
+void mem_stats_free(const void *allocator, MemStatsKind kind, char ok, unsigned long long start, unsigned int usage);
+
+// call-site tag for allocations made by the calling thread, returns the previous tag
+const char *mem_stats_tag(const char *tag);
+
+MemStats *mem_stats_get(const void *allocator);
+
+#define MEM_STATS_USAGE(self) ((self) ? __atomic_load_n(&(self)->usage, __ATOMIC_RELAXED) : 0)
+
+#endif
+
+// writes every allocator record and call-site tag as MEM_STATS_JSON or MEM_STATS_CSV
+char alloc_stats_dump(const char *path, unsigned int format);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "mem/stats.h"
+
+// binary allocation log: MemTraceHeader, MemTraceRecord * records, MemTraceAllocator * allocators, MemTraceFooter
+#define MEM_TRACE_MAGIC 0x4352544DU
+#define MEM_TRACE_VERSION 1
+#define MEM_TRACE_RING (1 << 16)
+#define MEM_TRACE_ALLOCATORS 64
+#define MEM_TRACE_NAME 32
+
+typedef enum {
+    MEM_TRACE_NONE,
+    MEM_TRACE_ALLOC,
+    MEM_TRACE_FREE,
+    MEM_TRACE_RESET,
+} MemTraceOp;
+
+typedef struct __attribute__((aligned(8), packed)) {
+    unsigned long long time; // ns since mem_trace_start
+    unsigned long long address; // 0 for a failed allocation
+    unsigned int size;
+    unsigned short alignment; // 0 when the allocator picks its own
+    unsigned char allocator; // index into the allocator table
+    unsigned char op;
+} MemTraceRecord;
+
+typedef struct __attribute__((packed)) {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int recordSize;
+    unsigned int padding;
+} MemTraceHeader;
+
+typedef struct __attribute__((packed)) {
+    char name[MEM_TRACE_NAME];
+    unsigned int kind; // MemStatsKind
+    unsigned int total; // largest capacity seen while tracing
+} MemTraceAllocator;
+
+typedef struct __attribute__((packed)) {
+    unsigned long long records;
+    unsigned int allocators;
+    unsigned int magic;
+} MemTraceFooter;
+
+#if MEM_TRACE_MODE
+
+// opens the log and starts recording, allocators registered earlier keep their names
+char mem_trace_start(const char *path);
+
+// flushes the ring and writes the allocator table, no allocator may be in use on other threads
+void mem_trace_stop();
+
+void mem_trace_register(const void *allocator, MemStatsKind kind, const char *name);
+
+// detaches the allocator, a later one at the same address gets a new table entry
+void mem_trace_release(const void *allocator);
+
+void mem_trace_alloc(const void *allocator, MemStatsKind kind, unsigned int size, unsigned int alignment,
+                     const void *ptr, unsigned int total);
+
+// recorded before the free runs so a racing reuse of the address is always logged after it
+void mem_trace_free(const void *allocator, MemStatsKind kind, const void *ptr);
+
+void mem_trace_reset(const void *allocator, MemStatsKind kind);
+
+#endif
@@ -4,6 +4,21 @@
 
 #define MEM_DEBUG_MODE 0
 
+// enabled with -DMEM_STATS=ON, see mem/stats.h
+#ifndef MEM_STATS_MODE
+#define MEM_STATS_MODE 0
+#endif
+
+// enabled with -DMEM_TRACE=ON, see mem/trace.h
+#ifndef MEM_TRACE_MODE
+#define MEM_TRACE_MODE 0
+#endif
+
+// enabled with -DMEM_GUARD=ON, see mem/guard.h
+#ifndef MEM_GUARD_MODE
+#define MEM_GUARD_MODE 0
+#endif
+
 #define PRINT_BITS(x)                                             \
   do {                                                            \
     typeof(x) a__ = (x);                                          \
@@ -18,7 +18,6 @@
 #define BUFFER_OFFSET(x) ((const void *)(x))
 
 enum {
-    max_space = 1 * MEGABYTES,
     max_elements = 4096,
 };
 
@@ -66,8 +65,6 @@ typedef struct {
 
     char enabled;
 
-    ArenaMemory *arena;
-
 } DrawData;
 
 static DrawData *debugData;
@@ -76,8 +73,6 @@ void debug_init() {
     debugData = alloc_global(DrawData, sizeof(DrawData));
     clear(debugData, sizeof(DrawData));
 
-    debugData->arena = arena_create(alloc_global(void, max_space), max_space);
-
     debugData->enabled = 1;
     debugData->origin = vec2_zero;
     debugData->color = color_white;
@@ -295,7 +290,6 @@ void debug_render() {
 
     debugData->count2d = 0;
     debugData->count3d = 0;
-    arena_reset(debugData->arena);
 }
 
 void debug_terminate() {
@@ -323,15 +317,13 @@ void debug_scale(float scale) {
     debugData->scale = scale;
 }
 
-void debug_string(Vec2 pos, const char *str, int n) {
+void debug_push2d(Vec2 pos, const char *text) {
     if (debugData->count2d == max_elements)
         debugData->count2d = 0;
 
-    char *cpy = arena_alloc(debugData->arena, n, sizeof(size_t));
-    memcpy(cpy, str, n);
     Text2DData dt;
     dt.position = pos;
-    dt.text = cpy;
+    dt.text = text;
     dt.scale = debugData->scale;
     dt.origin = debugData->origin;
     dt.color = debugData->color;
@@ -339,15 +331,13 @@ void debug_string(Vec2 pos, const char *str, int n) {
     debugData->data2d[debugData->count2d++] = dt;
 }
 
-void debug_string3d(Vec3 pos, const char *str, int n) {
+void debug_push3d(Vec3 pos, const char *text) {
     if (debugData->count3d == max_elements)
         debugData->count3d = 0;
 
-    char *cpy = arena_alloc(debugData->arena, n, sizeof(size_t));
-    memcpy(cpy, str, n);
     Text3DData dt;
     dt.position = pos;
-    dt.text = cpy;
+    dt.text = text;
     dt.scale = debugData->scale;
     dt.rotation = debugData->rotation;
     dt.origin = debugData->origin;
@@ -356,33 +346,48 @@ void debug_string3d(Vec3 pos, const char *str, int n) {
     debugData->data3d[debugData->count3d++] = dt;
 }
 
-void debug_stringf(Vec2 pos, const char *fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
-    int len = vsnprintf(NULL, 0, fmt, args);
-    char *buffer = (char *) stack_alloc(alloc->stack, len + 1, sizeof(size_t));
+void debug_string(Vec2 pos, const char *str, int n) {
+    char *cpy = alloc_frame(char, n);
+    if (cpy == NULL)
+        return;
+    memcpy(cpy, str, n);
+    debug_push2d(pos, cpy);
+}
+
+void debug_string3d(Vec3 pos, const char *str, int n) {
+    char *cpy = alloc_frame(char, n);
+    if (cpy == NULL)
+        return;
+    memcpy(cpy, str, n);
+    debug_push3d(pos, cpy);
+}
 
-    if (buffer != NULL) {
+char *debug_format(const char *fmt, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+
+    char *buffer = alloc_frame(char, len + 1);
+    if (buffer != NULL)
         vsnprintf(buffer, len + 1, fmt, args);
-        buffer[len] = '\0';
-        debug_string(pos, buffer, len + 1);
-    }
+    return buffer;
+}
 
-    stack_pop(alloc->stack);
+void debug_stringf(Vec2 pos, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    char *buffer = debug_format(fmt, args);
+    if (buffer != NULL)
+        debug_push2d(pos, buffer);
     va_end(args);
 }
 
 void debug_string3df(Vec3 pos, const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    int len = vsnprintf(NULL, 0, fmt, args);
-    char *buffer = (char *) stack_alloc(alloc->stack, len + 1, sizeof(size_t));
-
-    if (buffer != NULL) {
-        vsnprintf(buffer, len + 1, fmt, args);
-        buffer[len] = '\0';
-        debug_string3d(pos, buffer, len + 1);
-    }
-    stack_pop(alloc->stack);
+    char *buffer = debug_format(fmt, args);
+    if (buffer != NULL)
+        debug_push3d(pos, buffer);
     va_end(args);
-}
\ No newline at end of file
+}
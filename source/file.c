@@ -26,14 +26,14 @@ char *readfile_stack(const char *p) {
         fseek(f, 0, SEEK_SET);
         size_t readBytes;
         while ((readBytes = fread(buffer, 1, buffSize, f)) > 0) {
-            stack_expand(alloc->stack, n + readBytes);
+            data = (char *) stack_expand(alloc->stack, n + readBytes);
             memcpy(data + n, buffer, readBytes);
             n += (int) readBytes;
         }
         fclose(f);
     }
 
-    stack_expand(alloc->stack, n + 1);
+    data = (char *) stack_expand(alloc->stack, n + 1);
     data[n] = '\0';
     return data;
 }
@@ -65,13 +65,13 @@ char *readline_stack(void *f, long *cursor) {
                 break;
             }
         }
-        stack_expand(alloc->stack, n + i);
+        data = (char *) stack_expand(alloc->stack, n + i);
         memcpy(data + n, buffer, i);
         n += i;
         lst = 0;
         if (!ctu) break;
     }
-    if (lst) stack_expand(alloc->stack, n++);
+    if (lst) data = (char *) stack_expand(alloc->stack, n++);
     data[n - 1] = '\0';
     *cursor += n;
     return data;
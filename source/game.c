@@ -99,6 +99,7 @@ void calculate_fps() {
 }
 
 char game_loop() {
+    frame_next(alloc->frame);
     calculate_fps();
     glfwSwapBuffers(game->window);
     glfwPollEvents();
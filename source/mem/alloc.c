@@ -3,57 +3,158 @@
 
 #include <math.h>
 #include "mem/std.h"
+#include "mem/hook.h"
 
 MemoryLayout *alloc = NULL;
 
+static volatile int slabLock = 0;
+
+static inline char alloc_in_region(AllocRegion region, void *ptr) {
+    const size_t start = (size_t) alloc->_regions[region];
+    return start != 0 && (size_t) ptr >= start && (size_t) ptr < start + alloc->_sizes[region];
+}
+
+// slab pages may be requested from worker threads through the cached front end, so they come from
+// the system heap, or from their own region under a lock when backing[ALLOC_SLAB] asks for one
 void *global_slab_alloc(size_t size) {
-    return freelist_alloc(alloc->freelist, size, sizeof(size_t));
+    FreeListMemory *pages = alloc->slabPages;
+    if (pages != NULL && size < pages->total - pages->usage) {
+        while (__atomic_exchange_n(&slabLock, 1, __ATOMIC_ACQUIRE));
+        void *m = freelist_alloc(pages, size, sizeof(size_t));
+        __atomic_store_n(&slabLock, 0, __ATOMIC_RELEASE);
+        if (m != NULL)
+            return m;
+    }
+    return std_alloc(size, sizeof(size_t));
 }
 
 void global_slab_free(void *ptr) {
-    freelist_free(alloc->freelist, &ptr);
+    if (alloc_in_region(ALLOC_SLAB, ptr)) {
+        while (__atomic_exchange_n(&slabLock, 1, __ATOMIC_ACQUIRE));
+        freelist_free(alloc->slabPages, &ptr);
+        __atomic_store_n(&slabLock, 0, __ATOMIC_RELEASE);
+        return;
+    }
+    std_free(&ptr);
+}
+
+// regions with a backing of their own get a mapping, the rest are carved from boot
+static void *alloc_region(AllocRegion region, size_t size) {
+    const MemoryBacking backing = alloc->metadata.backing[region];
+    void *m = NULL;
+    if (backing.flags != 0 && (m = page_alloc(size, backing.flags, backing.node)) != NULL) {
+        alloc->_regions[region] = m;
+        alloc->_sizes[region] = size;
+        return m;
+    }
+    return arena_alloc(alloc->boot, size, sizeof(size_t));
 }
 
 void alloc_create(MemoryMetadata meta) {
     alloc = std_alloc(sizeof(MemoryLayout), sizeof(size_t));
+    clear(alloc, sizeof(MemoryLayout));
 
-    meta.boot += sizeof(ArenaMemory);
     meta.boot += sizeof(StackMemory);
     meta.boot += sizeof(FreeListMemory);
     meta.boot += sizeof(FreeListMemory);
     meta.boot += sizeof(BuddyMemory);
     meta.boot += sizeof(P2SlabMemory);
+    meta.boot += sizeof(FrameMemory);
 
     alloc->metadata = meta;
-    alloc->boot = make_arena(meta.boot);
+    const MemoryBacking boot = meta.backing[ALLOC_BOOT];
+    void *bootRegion = boot.flags ? page_alloc(meta.boot, boot.flags, boot.node) : NULL;
+    if (bootRegion != NULL) {
+        alloc->_regions[ALLOC_BOOT] = bootRegion;
+        alloc->_sizes[ALLOC_BOOT] = meta.boot;
+        alloc->boot = arena_create(bootRegion, meta.boot);
+    } else {
+        alloc->boot = make_arena(meta.boot);
+    }
 
-    alloc->global = arena_create(
-            arena_alloc(alloc->boot, meta.global, sizeof(size_t)),
-            meta.global
-    );
-    alloc->stack = stack_create(
-            arena_alloc(alloc->boot, meta.stack, sizeof(size_t)),
-            meta.stack
+    // global only reserves address space, its budget is a ceiling rather than an upfront cost
+    const MemoryBacking global = meta.backing[ALLOC_GLOBAL];
+    alloc->global = make_arena_virtual(meta.global, global.flags & PAGE_HUGE);
+    if (global.flags & PAGE_NUMA)
+        page_bind((void *) ((size_t) alloc->global - alloc->global->_padding), alloc->global->total, global.node);
+
+    // scratch for asset loading, chains heap chunks past meta.stack so large files still stream through it
+    alloc->stack = stack_create_segmented(
+            alloc_region(ALLOC_STACK, meta.stack),
+            meta.stack,
+            STACK_KEEP_SPARE
     );
-    alloc->freelist = freelist_create(
-            arena_alloc(alloc->boot, meta.freelist, sizeof(size_t)),
+    alloc->freelist = freelist_create_tlsf(
+            alloc_region(ALLOC_FREELIST, meta.freelist),
             meta.freelist
     );
-    alloc->string = freelist_create(
-            arena_alloc(alloc->boot, meta.string, sizeof(size_t)),
+    alloc->string = freelist_create_tlsf(
+            alloc_region(ALLOC_STRING, meta.string),
             meta.string
     );
     unsigned char order = (unsigned char) log2((double) meta.buddy);
     alloc->buddy = buddy_create(
-            arena_alloc(alloc->boot, buddy_size(order), sizeof(size_t)),
+            alloc_region(ALLOC_BUDDY, buddy_size(order)),
             order
     );
+    alloc->frame = frame_create(
+            alloc_region(ALLOC_FRAME, frame_size(meta.frame, ALLOC_FRAME_BUFFERS)),
+            meta.frame,
+            ALLOC_FRAME_BUFFERS
+    );
+    if (meta.slab > 0 && meta.backing[ALLOC_SLAB].flags != 0) {
+        void *pages = alloc_region(ALLOC_SLAB, meta.slab);
+        if (alloc->_regions[ALLOC_SLAB] != NULL)
+            alloc->slabPages = freelist_create_tlsf(pages, meta.slab);
+    }
     GeneralAllocator g = {&global_slab_alloc, &global_slab_free};
     alloc->slab = p2slab_create_alloc(g, 10);
 
+#if MEM_STATS_MODE
+    mem_stats_register(alloc->boot, MEM_STATS_ARENA, "boot");
+    mem_stats_register(alloc->global, MEM_STATS_ARENA, "global");
+    mem_stats_register(alloc->stack, MEM_STATS_STACK, "stack");
+    mem_stats_register(alloc->freelist, MEM_STATS_FREELIST, "freelist");
+    mem_stats_register(alloc->string, MEM_STATS_FREELIST, "string");
+    mem_stats_register(alloc->buddy, MEM_STATS_BUDDY, "buddy");
+    mem_stats_register(alloc->slab, MEM_STATS_P2SLAB, "slab");
+    if (alloc->slabPages != NULL)
+        mem_stats_register(alloc->slabPages, MEM_STATS_FREELIST, "slab_pages");
+    for (unsigned int i = 0; i < alloc->frame->_n; i++)
+        mem_stats_register(alloc->frame->_arenas[i], MEM_STATS_ARENA, "frame");
+#endif
+#if MEM_TRACE_MODE
+    mem_trace_register(alloc->boot, MEM_STATS_ARENA, "boot");
+    mem_trace_register(alloc->global, MEM_STATS_ARENA, "global");
+    mem_trace_register(alloc->stack, MEM_STATS_STACK, "stack");
+    mem_trace_register(alloc->freelist, MEM_STATS_FREELIST, "freelist");
+    mem_trace_register(alloc->string, MEM_STATS_FREELIST, "string");
+    mem_trace_register(alloc->buddy, MEM_STATS_BUDDY, "buddy");
+    mem_trace_register(alloc->slab, MEM_STATS_P2SLAB, "slab");
+    mem_trace_register(alloc->slabPages, MEM_STATS_FREELIST, "slab_pages");
+    for (unsigned int i = 0; i < alloc->frame->_n; i++)
+        mem_trace_register(alloc->frame->_arenas[i], MEM_STATS_ARENA, "frame");
+#endif
+
 }
 
 void alloc_terminate() {
-    arena_destroy(&alloc->boot);
+#if MEM_GUARD_MODE
+    const unsigned int corrupt = alloc_validate();
+    if (corrupt > 0)
+        printf("alloc: terminate found %u corrupt blocks\n", corrupt);
+#endif
+    stack_reset(alloc->stack);
+    stack_fit(alloc->stack);
+    p2slab_destroy(&alloc->slab);
+    arena_destroy(&alloc->global);
+    for (unsigned int i = ALLOC_STACK; i < ALLOC_REGIONS; i++)
+        page_free(alloc->_regions[i], alloc->_sizes[i], alloc->metadata.backing[i].flags);
+    if (alloc->_regions[ALLOC_BOOT] != NULL) {
+        MEM_HOOK_RELEASE(alloc->boot);
+        page_free(alloc->_regions[ALLOC_BOOT], alloc->_sizes[ALLOC_BOOT], alloc->metadata.backing[ALLOC_BOOT].flags);
+    } else {
+        arena_destroy(&alloc->boot);
+    }
     std_free((void **) &alloc);
 }
@@ -1,12 +1,78 @@
-
 #include "mem/arena.h"
 
 #include <malloc.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "mem/hook.h"
 
-void *arena_alloc(ArenaMemory *self, unsigned int size, unsigned int alignment) {
+#if _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define ARENA_GRANULE(self) ((self)->_flags & ARENA_HUGEPAGES ? ARENA_HUGEPAGE_GRANULE : ARENA_COMMIT_GRANULE)
+
+static void *arena_os_reserve(size_t size, char hugePages) {
+#if _WIN32
+    (void) hugePages;
+    return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    void *m = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (m == MAP_FAILED)
+        return NULL;
+#ifdef MADV_HUGEPAGE
+    if (hugePages)
+        madvise(m, size, MADV_HUGEPAGE);
+#else
+    (void) hugePages;
+#endif
+    return m;
+#endif
+}
+
+static char arena_os_commit(void *m, size_t size) {
+#if _WIN32
+    return VirtualAlloc(m, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+    return mprotect(m, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+static void arena_os_decommit(void *m, size_t size) {
+#if _WIN32
+    VirtualFree(m, size, MEM_DECOMMIT);
+#else
+    madvise(m, size, MADV_DONTNEED);
+    mprotect(m, size, PROT_NONE);
+#endif
+}
+
+static void arena_os_release(void *m, size_t size) {
+#if _WIN32
+    (void) size;
+    VirtualFree(m, 0, MEM_RELEASE);
+#else
+    munmap(m, size);
+#endif
+}
+
+static char arena_commit(ArenaMemory *self, size_t required) {
+    if (!(self->_flags & ARENA_VIRTUAL) || required > self->total)
+        return 0;
+    const size_t granule = ARENA_GRANULE(self);
+    size_t committed = MEMORY_SPACE(required, granule);
+    if (committed > self->total)
+        committed = self->total;
+    const size_t start = (size_t) self - self->_padding;
+    if (!arena_os_commit((void *) (start + self->_committed), committed - self->_committed))
+        return 0;
+    self->_committed = committed;
+    return 1;
+}
+
+static inline void *arena_alloc_impl(ArenaMemory *self, unsigned int size, unsigned int alignment) {
 #if MEM_DEBUG_MODE
     if (!ISPOW2(alignment)) {
         printf("arena: alloc failed, invalid alignment\n");
@@ -19,7 +85,8 @@ void *arena_alloc(ArenaMemory *self, unsigned int size, unsigned int alignment)
 #endif
     size_t address = ((size_t) self - self->_padding) + self->usage;
     int padding = MEMORY_PADDING(address, alignment);
-    if (self->usage + size + padding > self->total) {
+    size_t required = (size_t) self->usage + size + padding;
+    if (required > self->_committed && !arena_commit(self, required)) {
         printf("arena: alloc failed, insufficient memory\n");
         return NULL;
     }
@@ -28,6 +95,11 @@ void *arena_alloc(ArenaMemory *self, unsigned int size, unsigned int alignment)
     return (void *) (address);
 }
 
+void *arena_alloc(ArenaMemory *self, unsigned int size, unsigned int alignment) {
+    MEM_HOOK_ALLOC(MEM_STATS_ARENA, self, size, alignment,
+                   arena_alloc_impl(self, MEM_GUARD_SIZE(size, alignment), alignment));
+}
+
 void arena_reset(ArenaMemory *self) {
 #if MEM_DEBUG_MODE
     if (self == NULL) {
@@ -35,8 +107,18 @@ void arena_reset(ArenaMemory *self) {
         return;
     }
 #endif
+    MEM_HOOK_RESET(MEM_STATS_ARENA, self);
     const unsigned int space = MEMORY_SPACE_STD(ArenaMemory);
     self->usage = self->_padding + space;
+    if (self->_flags & ARENA_VIRTUAL) {
+        // keep the granule holding the header, hand everything else back to the system
+        const unsigned int granule = ARENA_GRANULE(self);
+        if (self->_committed > granule) {
+            const size_t start = (size_t) self - self->_padding;
+            arena_os_decommit((void *) (start + granule), self->_committed - granule);
+            self->_committed = granule;
+        }
+    }
 }
 
 void arena_destroy(ArenaMemory **self) {
@@ -44,8 +126,12 @@ void arena_destroy(ArenaMemory **self) {
         printf("arena: destroy failed, invalid instance\n");
         return;
     }
+    MEM_HOOK_RELEASE(*self);
     size_t op = (size_t) (*self) - (*self)->_padding;
-    free((void *) (op));
+    if ((*self)->_flags & ARENA_VIRTUAL)
+        arena_os_release((void *) (op), (*self)->total);
+    else
+        free((void *) (op));
     *self = NULL;
 }
 
@@ -57,6 +143,8 @@ ArenaMemory *arena_create(void *m, unsigned int size) {
     self->total = size;
     self->usage = padding + space;
     self->_padding = padding;
+    self->_committed = size;
+    self->_flags = 0;
     return self;
 }
 
@@ -68,3 +156,22 @@ ArenaMemory *make_arena(unsigned int size) {
     }
     return arena_create(m, size);
 }
+
+ArenaMemory *make_arena_virtual(unsigned int reserve, char hugePages) {
+    const unsigned int granule = hugePages ? ARENA_HUGEPAGE_GRANULE : ARENA_COMMIT_GRANULE;
+    const size_t request = reserve;
+    const size_t size = MEMORY_SPACE(request, granule);
+    if (size > 0xFFFFFFFFULL) {
+        printf("arena: make failed, reservation too large\n");
+        exit(EXIT_FAILURE);
+    }
+    void *m = arena_os_reserve(size, hugePages);
+    if (m == NULL || !arena_os_commit(m, granule)) {
+        printf("arena: make failed, system can't reserve address space\n");
+        exit(EXIT_FAILURE);
+    }
+    ArenaMemory *self = arena_create(m, (unsigned int) size);
+    self->_committed = granule;
+    self->_flags = ARENA_VIRTUAL | (hugePages ? ARENA_HUGEPAGES : 0);
+    return self;
+}
@@ -5,35 +5,85 @@
 #include <stdio.h>
 
 #include "mem/utils.h"
+#include "mem/hook.h"
 
 typedef struct __attribute__((aligned(8), packed)) {
     unsigned int size;
     unsigned int free;
 } BuddyBlock;
 
+typedef struct __attribute__((aligned(8), packed)) {
+    BuddyBlock block;
+    void *next;
+    void *prev;
+} BuddyFreeBlock;
+
+// one bit per block of every order from BUDDY_MIN_ORDER to order, set while the block sits in a free list
+unsigned int buddy_bitmap_size(unsigned int order) {
+    size_t bits = (size_t) 1 << (order - BUDDY_MIN_ORDER + 1);
+    size_t bytes = (bits + 7) >> 3;
+    return MEMORY_SPACE(bytes, sizeof(size_t));
+}
+
 unsigned int buddy_size(unsigned int order) {
-    return sizeof(size_t) + sizeof(BuddyMemory) + (1 << order);
+    if (order < BUDDY_MIN_ORDER) order = BUDDY_MIN_ORDER;
+    return sizeof(size_t) + MEMORY_SPACE_STD(BuddyMemory) + buddy_bitmap_size(order) + (1 << order);
 }
 
-BuddyBlock *buddy_next(BuddyBlock *b) {
-    return (BuddyBlock *) ((size_t) b + b->size);
+static inline size_t buddy_bit(BuddyMemory *self, unsigned int order, size_t offset) {
+    const unsigned int levels = self->_order - BUDDY_MIN_ORDER + 1;
+    return ((size_t) 1 << levels) - ((size_t) 1 << (self->_order - order + 1)) + (offset >> order);
+}
+
+static inline char buddy_test(BuddyMemory *self, unsigned int order, size_t offset) {
+    size_t bit = buddy_bit(self, order, offset);
+    return (char) ((self->_bitmap[bit >> 3] >> (bit & 7)) & 1);
+}
+
+void buddy_push(BuddyMemory *self, BuddyFreeBlock *node, unsigned int order) {
+    node->block.size = 1 << order;
+    node->block.free = 1;
+    node->prev = NULL;
+    node->next = self->_free[order];
+    if (node->next != NULL)
+        ((BuddyFreeBlock *) node->next)->prev = node;
+    self->_free[order] = node;
+
+    size_t bit = buddy_bit(self, order, (size_t) node - (size_t) self->_head);
+    self->_bitmap[bit >> 3] |= (unsigned char) (1 << (bit & 7));
+}
+
+void buddy_remove(BuddyMemory *self, BuddyFreeBlock *node, unsigned int order) {
+    if (node->prev != NULL)
+        ((BuddyFreeBlock *) node->prev)->next = node->next;
+    else
+        self->_free[order] = node->next;
+    if (node->next != NULL)
+        ((BuddyFreeBlock *) node->next)->prev = node->prev;
+
+    size_t bit = buddy_bit(self, order, (size_t) node - (size_t) self->_head);
+    self->_bitmap[bit >> 3] &= (unsigned char) ~(1 << (bit & 7));
 }
 
 BuddyMemory *buddy_create(void *m, unsigned int order) {
     const size_t start = (size_t) m;
     const unsigned int padding = MEMORY_PADDING_STD(start);
     const unsigned int space = MEMORY_SPACE_STD(BuddyMemory);
+    if (order < BUDDY_MIN_ORDER) order = BUDDY_MIN_ORDER;
 
-    unsigned int size = 1 << order;
     BuddyMemory *self = (BuddyMemory *) (start + padding);
-    self->_head = (BuddyBlock *) (start + padding + space);
-    ((BuddyBlock*)self->_head)->size = size;
-    ((BuddyBlock*)self->_head)->free = 1;
+    self->_bitmap = (unsigned char *) (start + padding + space);
+    self->_head = (void *) (start + padding + space + buddy_bitmap_size(order));
+    self->_tail = (void *) ((size_t) self->_head + (1 << order));
+    self->_order = order;
+    self->_padding = padding;
     self->usage = 0;
     self->total = 1 << order;
 
-    self->_tail = buddy_next(self->_head);
-    self->_padding = padding;
+    clear(self->_bitmap, buddy_bitmap_size(order));
+    for (int i = 0; i < BUDDY_MAX_ORDER; i++)
+        self->_free[i] = NULL;
+    buddy_push(self, (BuddyFreeBlock *) self->_head, order);
     return self;
 }
 
@@ -51,89 +101,20 @@ void buddy_destroy(BuddyMemory **self) {
         printf("buddy: destroy failed, invalid instance\n");
         return;
     }
+    MEM_HOOK_RELEASE(*self);
     size_t op = (size_t) (*self) - (*self)->_padding;
     free((void *) (op));
     (*self) = NULL;
 }
 
-BuddyBlock *buddy_split(BuddyBlock *block, unsigned int size) {
-    if (block == NULL || size == 0)
-        return NULL;
-
-    while (size < (block->size >> 1)) {
-        size_t sz = block->size >> 1;
-        block->size = sz;
-        block = buddy_next(block);
-        block->size = sz;
-        block->free = 1;
-    }
-
-    if (size > block->size)
-        return NULL;
-
-    return block;
-}
-
-BuddyBlock *buddy_best(BuddyBlock *head, BuddyBlock *tail, unsigned int size) {
-    BuddyBlock *best_block = NULL;
-    BuddyBlock *block = head;
-    BuddyBlock *buddy = buddy_next(block);
-
-    if (buddy == tail && block->free) return buddy_split(block, size);
-
-    while (block < tail && buddy < tail) {
-        if (block->free && buddy->free && block->size == buddy->size) {
-            block->size <<= 1;
-            if (size <= block->size && (best_block == NULL || block->size <= best_block->size)) best_block = block;
-            block = buddy_next(buddy);
-            if (block < tail) buddy = buddy_next(block);
-            continue;
-        }
-
-        if (block->free && size <= block->size && (best_block == NULL || block->size <= best_block->size)) best_block = block;
-
-        if (buddy->free && size <= buddy->size && (best_block == NULL || buddy->size < best_block->size)) best_block = buddy;
-
-        if (block->size <= buddy->size) {
-            block = buddy_next(buddy);
-            if (block < tail) buddy = buddy_next(block);
-        } else {
-            block = buddy;
-            buddy = buddy_next(buddy);
-        }
-    }
-
-    if (best_block == NULL) return NULL;
-    return buddy_split(best_block, size);
+unsigned int buddy_largest(BuddyMemory *self) {
+    for (int order = (int) self->_order; order >= BUDDY_MIN_ORDER; order--)
+        if (self->_free[order] != NULL)
+            return 1U << order;
+    return 0;
 }
 
-
-void buddy_merge(BuddyBlock *head, BuddyBlock *tail) {
-    while (1) {
-        BuddyBlock *block = head;
-        BuddyBlock *buddy = buddy_next(block);
-        char no_merge = 1;
-        while (block < tail && buddy < tail) {
-            if (block->free && buddy->free && block->size == buddy->size) {
-                block->size <<= 1;
-                block = buddy_next(block);
-                if (block < tail) {
-                    buddy = buddy_next(block);
-                    no_merge = 0;
-                }
-            } else if (block->size < buddy->size) {
-                block = buddy;
-                buddy = buddy_next(buddy);
-            } else {
-                block = buddy_next(buddy);
-                if (block < tail) buddy = buddy_next(block);
-            }
-        }
-        if (no_merge) return;
-    }
-}
-
-void *buddy_alloc(BuddyMemory *self, unsigned int size) {
+static inline void *buddy_alloc_impl(BuddyMemory *self, unsigned int size) {
 #if MEM_DEBUG_MODE
     if (self == NULL) {
         printf("buddy: alloc failed, invalid instance\n");
@@ -147,24 +128,38 @@ void *buddy_alloc(BuddyMemory *self, unsigned int size) {
     const unsigned int space = MEMORY_SPACE_STD(BuddyBlock);
     size += space;
 
-    BuddyBlock *found = buddy_best(self->_head, self->_tail, size);
+    unsigned int order = BUDDY_MIN_ORDER;
+    while (order < self->_order && (1U << order) < size)
+        order++;
 
-    if (found == NULL) {
-        buddy_merge(self->_head, self->_tail);
-        found = buddy_best(self->_head, self->_tail, size);
-    }
+    unsigned int found = order;
+    while (found <= self->_order && self->_free[found] == NULL)
+        found++;
 
-    if (found == NULL) {
+    if ((1U << order) < size || found > self->_order) {
         printf("buddy: out of memory!\n");
         return NULL;
     }
 
-    found->free = 0;
-    self->usage += found->size;
-    return (void *) ((size_t) found + space);
+    BuddyFreeBlock *node = self->_free[found];
+    buddy_remove(self, node, found);
+
+    while (found > order) {
+        found--;
+        buddy_push(self, (BuddyFreeBlock *) ((size_t) node + (1 << found)), found);
+    }
+
+    node->block.size = 1 << order;
+    node->block.free = 0;
+    self->usage += node->block.size;
+    return (void *) ((size_t) node + space);
 }
 
-char buddy_free(BuddyMemory *self, void **ptr) {
+void *buddy_alloc(BuddyMemory *self, unsigned int size) {
+    MEM_HOOK_ALLOC(MEM_STATS_BUDDY, self, size, 0, buddy_alloc_impl(self, MEM_GUARD_SIZE(size, 0)));
+}
+
+static inline char buddy_free_impl(BuddyMemory *self, void **ptr) {
 #if MEM_DEBUG_MODE
     if (self == NULL) {
         printf("buddy: free failed, invalid instance\n");
@@ -184,10 +179,32 @@ char buddy_free(BuddyMemory *self, void **ptr) {
         return 0;
     }
 #endif
-    unsigned int space = MEMORY_SPACE_STD(BuddyBlock);
+    const unsigned int space = MEMORY_SPACE_STD(BuddyBlock);
     BuddyBlock *block = (BuddyBlock *) (ptr_address - space);
-    block->free = 1;
+    if (block->free) {
+        printf("buddy: free failed, already freed\n");
+        return 0;
+    }
     self->usage -= block->size;
 
+    const size_t base = (size_t) self->_head;
+    size_t offset = (size_t) block - base;
+    unsigned int order = __builtin_ctz(block->size);
+
+    while (order < self->_order) {
+        size_t buddy = offset ^ ((size_t) 1 << order);
+        if (!buddy_test(self, order, buddy))
+            break;
+        buddy_remove(self, (BuddyFreeBlock *) (base + buddy), order);
+        offset &= ~((size_t) 1 << order);
+        order++;
+    }
+
+    buddy_push(self, (BuddyFreeBlock *) (base + offset), order);
+    *ptr = NULL;
     return 1;
 }
+
+char buddy_free(BuddyMemory *self, void **ptr) {
+    MEM_HOOK_FREE(MEM_STATS_BUDDY, self, ptr, buddy_free_impl(self, ptr));
+}
@@ -0,0 +1,93 @@
+
+#include "mem/frame.h"
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "mem/hook.h"
+
+#define FRAME_ARENA_BASE(arena) ((arena)->_padding + MEMORY_SPACE_STD(ArenaMemory))
+
+unsigned int frame_size(unsigned int size, unsigned int n) {
+    return sizeof(size_t) + MEMORY_SPACE_STD(FrameMemory) + n * size;
+}
+
+void *frame_alloc(FrameMemory *self, unsigned int size, unsigned int alignment) {
+#if MEM_DEBUG_MODE
+    if (self == NULL) {
+        printf("frame: alloc failed, invalid instance\n");
+        return NULL;
+    }
+#endif
+    ArenaMemory *arena = self->_arenas[self->_current];
+    void *ptr = arena_alloc(arena, size, alignment);
+    self->usage = arena->usage - FRAME_ARENA_BASE(arena);
+    return ptr;
+}
+
+void frame_next(FrameMemory *self) {
+#if MEM_DEBUG_MODE
+    if (self == NULL) {
+        printf("frame: next failed, invalid instance\n");
+        return;
+    }
+#endif
+    self->last = self->usage;
+    if (self->usage > self->peak)
+        self->peak = self->usage;
+
+    self->frame++;
+    self->_current = self->frame % self->_n;
+    arena_reset(self->_arenas[self->_current]);
+    self->usage = 0;
+}
+
+FrameMemory *frame_create(void *m, unsigned int size, unsigned int n) {
+    if (n == 0 || n > FRAME_MAX_BUFFERS) {
+        printf("frame: create failed, invalid number of buffers\n");
+        exit(EXIT_FAILURE);
+    }
+    const size_t start = (size_t) m;
+    const unsigned int padding = MEMORY_PADDING_STD(start);
+    const unsigned int space = MEMORY_SPACE_STD(FrameMemory);
+
+    FrameMemory *self = (FrameMemory *) (start + padding);
+    size_t cursor = start + padding + space;
+    for (unsigned int i = 0; i < n; i++) {
+        self->_arenas[i] = arena_create((void *) cursor, size);
+        cursor += size;
+    }
+    self->_n = n;
+    self->_current = 0;
+    self->_padding = padding;
+    self->frame = 0;
+    self->total = n * size;
+    self->usage = 0;
+    self->last = 0;
+    self->peak = 0;
+    return self;
+}
+
+FrameMemory *make_frame(unsigned int size, unsigned int n) {
+    void *m = malloc(frame_size(size, n));
+    if (m == NULL) {
+        printf("frame: make failed, system can't provide free memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return frame_create(m, size, n);
+}
+
+void frame_destroy(FrameMemory **self) {
+    if (self == NULL || *self == NULL) {
+        printf("frame: destroy failed, invalid instance\n");
+        return;
+    }
+#if MEM_STATS_MODE || MEM_TRACE_MODE || MEM_GUARD_MODE
+    for (unsigned int i = 0; i < (*self)->_n; i++)
+        MEM_HOOK_RELEASE((*self)->_arenas[i]);
+#endif
+    size_t op = (size_t) (*self) - (*self)->_padding;
+    free((void *) (op));
+    *self = NULL;
+}
@@ -6,19 +6,59 @@
 #include <stdio.h>
 
 #include "mem/utils.h"
-
-#define NODE_LOWER(node) ((size_t)(node) + MEMORY_SPACE_STD(FreeListMemory) - (node)->_padding)
-#define NODE_HIGHER(node) ((size_t)(node) + MEMORY_SPACE_STD(FreeListMemory))
+#include "mem/hook.h"
+
+typedef struct __attribute__((aligned(16), packed)) {
+    void *_next;
+    unsigned int _padding;
+    unsigned int total;
+} FreeListNode;
+
+#define NODE_LOWER(node) ((size_t)(node) + MEMORY_SPACE_STD(FreeListNode) - (node)->_padding)
+#define NODE_HIGHER(node) ((size_t)(node) + MEMORY_SPACE_STD(FreeListNode))
+#define SELF_LOWER(self) ((size_t)(self) + MEMORY_SPACE_STD(FreeListMemory) - (self)->_padding)
+#define SELF_HIGHER(self) ((size_t)(self) + MEMORY_SPACE_STD(FreeListMemory))
+
+// tlsf: first level splits sizes by power of two, second level splits each power of two into TLSF_SL_COUNT ranges
+#define TLSF_SL_LOG2 5
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_ALIGN_LOG2 3
+#define TLSF_ALIGN (1 << TLSF_ALIGN_LOG2)
+#define TLSF_FL_SHIFT (TLSF_SL_LOG2 + TLSF_ALIGN_LOG2)
+#define TLSF_FL_COUNT (32 - TLSF_FL_SHIFT + 1)
+#define TLSF_SMALL (1 << TLSF_FL_SHIFT)
+
+#define TLSF_FREE 1U
+#define TLSF_PREV_FREE 2U
+#define TLSF_SIZE(block) ((block)->size & ~(TLSF_ALIGN - 1U))
+#define TLSF_NEXT(block) ((FreeListTlsfBlock *) ((size_t) (block) + TLSF_SIZE(block)))
+#define TLSF_PREV(block) ((FreeListTlsfBlock *) ((size_t) (block) - (block)->prevSize))
+
+typedef struct __attribute__((aligned(8), packed)) {
+    unsigned int prevSize; // boundary tag of the previous physical block, valid while it is free
+    unsigned int size; // low bits: TLSF_FREE, TLSF_PREV_FREE
+    void *next;
+    void *prev;
+} FreeListTlsfBlock;
+
+#define TLSF_HEADER (sizeof(unsigned int) * 2)
+#define TLSF_MIN_BLOCK (sizeof(FreeListTlsfBlock))
+
+typedef struct {
+    unsigned int fl;
+    unsigned int sl[TLSF_FL_COUNT];
+    FreeListTlsfBlock *heads[TLSF_FL_COUNT][TLSF_SL_COUNT];
+} FreeListTlsf;
 
 void freelist_first(FreeListMemory *self, unsigned int size, unsigned int alignment, unsigned int *outPadding,
-                    FreeListMemory **outPrevNode, FreeListMemory **outNode) {
-    FreeListMemory
+                    FreeListNode **outPrevNode, FreeListNode **outNode) {
+    FreeListNode
             *node = self->_next,
             *prev = NULL;
     unsigned int padding;
     while (node != NULL) {
-        padding = MEMORY_ALIGNMENT(NODE_LOWER(node), sizeof(FreeListMemory), alignment);
-        unsigned int space = size + padding + MEMORY_SPACE_STD(FreeListMemory);
+        padding = MEMORY_ALIGNMENT(NODE_LOWER(node), sizeof(FreeListNode), alignment);
+        unsigned int space = size + padding + MEMORY_SPACE_STD(FreeListNode);
         if (node->total > space)
             break;
 
@@ -31,8 +71,8 @@ void freelist_first(FreeListMemory *self, unsigned int size, unsigned int alignm
 }
 
 void freelist_best(FreeListMemory *self, unsigned int size, unsigned int alignment, unsigned int *outPadding,
-                   FreeListMemory **outPrevNode, FreeListMemory **outNode) {
-    FreeListMemory
+                   FreeListNode **outPrevNode, FreeListNode **outNode) {
+    FreeListNode
             *node = self->_next,
             *best = NULL,
             *prev = NULL,
@@ -40,8 +80,8 @@ void freelist_best(FreeListMemory *self, unsigned int size, unsigned int alignme
     unsigned int padding, bestPad = 0;
     int min = (~(0) - 1);
     while (node != NULL) {
-        padding = MEMORY_ALIGNMENT(NODE_LOWER(node), sizeof(FreeListMemory), alignment);
-        size_t space = size + padding + MEMORY_SPACE_STD(FreeListMemory);
+        padding = MEMORY_ALIGNMENT(NODE_LOWER(node), sizeof(FreeListNode), alignment);
+        size_t space = size + padding + MEMORY_SPACE_STD(FreeListNode);
         if (node->total > space && (node->total - space) < min) {
             best = node;
             bestPrev = prev;
@@ -56,7 +96,7 @@ void freelist_best(FreeListMemory *self, unsigned int size, unsigned int alignme
     *outPadding = bestPad;
 }
 
-void freelist_insert(FreeListMemory *self, FreeListMemory *prevNode, FreeListMemory *newNode) {
+void freelist_insert(FreeListMemory *self, FreeListNode *prevNode, FreeListNode *newNode) {
     if (prevNode == NULL) {
         newNode->_next = self->_next;
         self->_next = newNode;
@@ -66,7 +106,7 @@ void freelist_insert(FreeListMemory *self, FreeListMemory *prevNode, FreeListMem
     prevNode->_next = newNode;
 }
 
-void freelist_remove(FreeListMemory *self, FreeListMemory *prevNode, FreeListMemory *node) {
+void freelist_remove(FreeListMemory *self, FreeListNode *prevNode, FreeListNode *node) {
     if (prevNode == NULL) {
         self->_next = node->_next;
         return;
@@ -74,8 +114,8 @@ void freelist_remove(FreeListMemory *self, FreeListMemory *prevNode, FreeListMem
     prevNode->_next = node->_next;
 }
 
-void freelist_joinnext(FreeListMemory *self, FreeListMemory *previousNode, FreeListMemory *freeNode) {
-    FreeListMemory *next = (FreeListMemory *) freeNode->_next;
+void freelist_joinnext(FreeListMemory *self, FreeListNode *previousNode, FreeListNode *freeNode) {
+    FreeListNode *next = (FreeListNode *) freeNode->_next;
     if (next != NULL && NODE_LOWER(freeNode) + freeNode->total == NODE_LOWER(next)) {
         freeNode->total += next->total;
         freelist_remove(self, freeNode, freeNode->_next);
@@ -88,20 +128,190 @@ void freelist_joinnext(FreeListMemory *self, FreeListMemory *previousNode, FreeL
     }
 }
 
-void *freelist_alloc(FreeListMemory *self, unsigned int size, unsigned int alignment) {
-#if MEM_DEBUG_MODE
-    if (!ISPOW2(alignment)) {
-        printf("freelist: alloc failed, invalid alignment\n");
+static inline void tlsf_mapping(unsigned int size, unsigned int *fl, unsigned int *sl) {
+    if (size < TLSF_SMALL) {
+        *fl = 0;
+        *sl = size >> TLSF_ALIGN_LOG2;
+        return;
+    }
+    unsigned int f = 31 - __builtin_clz(size);
+    *sl = (size >> (f - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+    *fl = f - TLSF_FL_SHIFT + 1;
+}
+
+FreeListTlsfBlock *tlsf_find(FreeListTlsf *tlsf, unsigned int size) {
+    if (size >= TLSF_SMALL) {
+        unsigned int round = (1U << (31 - __builtin_clz(size) - TLSF_SL_LOG2)) - 1;
+        if (size > ~0U - round)
+            return NULL;
+        size += round;
+    }
+    unsigned int fl, sl;
+    tlsf_mapping(size, &fl, &sl);
+
+    unsigned int slMap = tlsf->sl[fl] & (~0U << sl);
+    if (slMap == 0) {
+        unsigned int flMap = fl + 1 < 32 ? tlsf->fl & (~0U << (fl + 1)) : 0;
+        if (flMap == 0)
+            return NULL;
+        fl = __builtin_ctz(flMap);
+        slMap = tlsf->sl[fl];
+    }
+    sl = __builtin_ctz(slMap);
+    return tlsf->heads[fl][sl];
+}
+
+void tlsf_insert(FreeListTlsf *tlsf, FreeListTlsfBlock *block) {
+    unsigned int fl, sl;
+    tlsf_mapping(TLSF_SIZE(block), &fl, &sl);
+    block->prev = NULL;
+    block->next = tlsf->heads[fl][sl];
+    if (block->next != NULL)
+        ((FreeListTlsfBlock *) block->next)->prev = block;
+    tlsf->heads[fl][sl] = block;
+    tlsf->fl |= 1U << fl;
+    tlsf->sl[fl] |= 1U << sl;
+}
+
+void tlsf_remove(FreeListTlsf *tlsf, FreeListTlsfBlock *block) {
+    unsigned int fl, sl;
+    tlsf_mapping(TLSF_SIZE(block), &fl, &sl);
+    if (block->prev != NULL)
+        ((FreeListTlsfBlock *) block->prev)->next = block->next;
+    else
+        tlsf->heads[fl][sl] = block->next;
+    if (block->next != NULL)
+        ((FreeListTlsfBlock *) block->next)->prev = block->prev;
+
+    if (tlsf->heads[fl][sl] == NULL) {
+        tlsf->sl[fl] &= ~(1U << sl);
+        if (tlsf->sl[fl] == 0)
+            tlsf->fl &= ~(1U << fl);
+    }
+}
+
+static inline void tlsf_mark_free(FreeListTlsfBlock *block) {
+    block->size |= TLSF_FREE;
+    FreeListTlsfBlock *next = TLSF_NEXT(block);
+    next->prevSize = TLSF_SIZE(block);
+    next->size |= TLSF_PREV_FREE;
+}
+
+static inline void tlsf_mark_used(FreeListTlsfBlock *block) {
+    block->size &= ~TLSF_FREE;
+    TLSF_NEXT(block)->size &= ~TLSF_PREV_FREE;
+}
+
+// cuts block down to size and returns the remainder as a new free block, block keeps its flags
+FreeListTlsfBlock *tlsf_split(FreeListTlsfBlock *block, unsigned int size) {
+    unsigned int remaining = TLSF_SIZE(block) - size;
+    if (remaining < TLSF_MIN_BLOCK)
         return NULL;
+    block->size = size | (block->size & (TLSF_ALIGN - 1U));
+    FreeListTlsfBlock *rest = TLSF_NEXT(block);
+    rest->size = remaining;
+    // a free block split off the front, as the alignment gap is, stays the free left neighbour of the rest
+    if (block->size & TLSF_FREE) {
+        rest->prevSize = size;
+        rest->size |= TLSF_PREV_FREE;
     }
-    if (self == NULL) {
-        printf("freelist: alloc failed, invalid instance\n");
+    tlsf_mark_free(rest);
+    return rest;
+}
+
+void *freelist_tlsf_alloc(FreeListMemory *self, unsigned int size, unsigned int alignment) {
+    FreeListTlsf *tlsf = self->_tlsf;
+    unsigned int required = MEMORY_SPACE(size, TLSF_ALIGN) + TLSF_HEADER;
+    if (required < TLSF_MIN_BLOCK)
+        required = TLSF_MIN_BLOCK;
+
+    unsigned int search = required;
+    if (alignment > TLSF_ALIGN)
+        search += alignment + TLSF_MIN_BLOCK;
+
+    FreeListTlsfBlock *block = tlsf_find(tlsf, search);
+    if (block == NULL) {
+        printf("freelist: alloc failed, insufficient memory\n");
         return NULL;
     }
-#endif
+    tlsf_remove(tlsf, block);
+
+    if (alignment > TLSF_ALIGN) {
+        size_t payload = (size_t) block + TLSF_HEADER;
+        size_t gap = MEMORY_PADDING(payload, alignment);
+        if (gap != 0 && gap < TLSF_MIN_BLOCK) {
+            payload += TLSF_MIN_BLOCK;
+            gap = TLSF_MIN_BLOCK + MEMORY_PADDING(payload, alignment);
+        }
+        if (gap != 0) {
+            FreeListTlsfBlock *aligned = tlsf_split(block, gap);
+            tlsf_insert(tlsf, block);
+            block = aligned;
+        }
+    }
+
+    FreeListTlsfBlock *rest = tlsf_split(block, required);
+    if (rest != NULL)
+        tlsf_insert(tlsf, rest);
+
+    tlsf_mark_used(block);
+    self->usage += TLSF_SIZE(block);
+    return (void *) ((size_t) block + TLSF_HEADER);
+}
+
+char freelist_tlsf_free(FreeListMemory *self, void **ptr) {
+    FreeListTlsf *tlsf = self->_tlsf;
+    FreeListTlsfBlock *block = (FreeListTlsfBlock *) ((size_t) (*ptr) - TLSF_HEADER);
+    if (block->size & TLSF_FREE) {
+        printf("freelist: free failed, already freed\n");
+        return 0;
+    }
+    self->usage -= TLSF_SIZE(block);
+
+    if (block->size & TLSF_PREV_FREE) {
+        FreeListTlsfBlock *prev = TLSF_PREV(block);
+        tlsf_remove(tlsf, prev);
+        prev->size += TLSF_SIZE(block);
+        block = prev;
+    }
+
+    FreeListTlsfBlock *next = TLSF_NEXT(block);
+    if (next->size & TLSF_FREE) {
+        tlsf_remove(tlsf, next);
+        block->size += TLSF_SIZE(next);
+    }
+
+    tlsf_mark_free(block);
+    tlsf_insert(tlsf, block);
+    *ptr = NULL;
+    return 1;
+}
+
+void freelist_tlsf_reset(FreeListMemory *self) {
+    FreeListTlsf *tlsf = self->_tlsf;
+    clear(tlsf, sizeof(FreeListTlsf));
+
+    const size_t lower = SELF_LOWER(self);
+    const size_t start = (size_t) tlsf + MEMORY_SPACE_STD(FreeListTlsf);
+    const size_t end = (lower + self->total - TLSF_HEADER) & ~(TLSF_ALIGN - 1UL);
+
+    FreeListTlsfBlock *block = (FreeListTlsfBlock *) start;
+    block->prevSize = 0;
+    block->size = (unsigned int) (end - start);
+
+    // zero sized used block closing the region so TLSF_NEXT never runs past it
+    FreeListTlsfBlock *sentinel = (FreeListTlsfBlock *) end;
+    sentinel->size = 0;
+
+    tlsf_mark_free(block);
+    tlsf_insert(tlsf, block);
+    self->usage = self->total - TLSF_SIZE(block);
+}
+
+void *freelist_best_alloc(FreeListMemory *self, unsigned int size, unsigned int alignment) {
     unsigned int padding;
-    FreeListMemory *prevNode;
-    FreeListMemory *node;
+    FreeListNode *prevNode;
+    FreeListNode *node;
     freelist_best(self, size, alignment, &padding, &prevNode, &node);
 
     if (node == NULL) {
@@ -109,48 +319,58 @@ void *freelist_alloc(FreeListMemory *self, unsigned int size, unsigned int align
         return NULL;
     }
 
-    const unsigned int space = MEMORY_SPACE_STD(FreeListMemory);
+    const unsigned int space = MEMORY_SPACE_STD(FreeListNode);
 
     unsigned int requiredSpace = size + padding;
     unsigned int remainingSpace = node->total - requiredSpace;
 
     size_t addr = NODE_LOWER(node);
     void *tmp = node->_next;
-    node = (FreeListMemory *) (addr + padding - space);
+    node = (FreeListNode *) (addr + padding - space);
     node->_padding = padding;
     node->_next = tmp;
 
     node->total = requiredSpace;
 
     if (remainingSpace > 0) {
-        FreeListMemory *newNode = (FreeListMemory *) (addr + requiredSpace);
+        FreeListNode *newNode = (FreeListNode *) (addr + requiredSpace);
         newNode->_padding = space;
         newNode->total = remainingSpace;
         freelist_insert(self, node, newNode);
     }
     freelist_remove(self, prevNode, node);
 
+    self->usage += requiredSpace;
     return (void *) NODE_HIGHER(node);
 }
 
-char freelist_free(FreeListMemory *self, void **ptr) {
+void *freelist_alloc(FreeListMemory *self, unsigned int size, unsigned int alignment) {
 #if MEM_DEBUG_MODE
-    if (self == NULL) {
-        printf("freelist: free failed, invalid instance\n");
-        return 0;
+    if (!ISPOW2(alignment)) {
+        printf("freelist: alloc failed, invalid alignment\n");
+        return NULL;
     }
-    if (ptr == NULL || (*ptr) == NULL) {
-        printf("freelist: free failed, invalid pointer\n");
-        return 0;
+    if (self == NULL) {
+        printf("freelist: alloc failed, invalid instance\n");
+        return NULL;
     }
 #endif
-    unsigned int space = MEMORY_SPACE_STD(FreeListMemory);
+    if (self->_tlsf != NULL)
+        MEM_HOOK_ALLOC(MEM_STATS_FREELIST, self, size, alignment,
+                       freelist_tlsf_alloc(self, MEM_GUARD_SIZE(size, alignment), alignment));
+    MEM_HOOK_ALLOC(MEM_STATS_FREELIST, self, size, alignment,
+                   freelist_best_alloc(self, MEM_GUARD_SIZE(size, alignment), alignment));
+}
+
+char freelist_best_free(FreeListMemory *self, void **ptr) {
+    unsigned int space = MEMORY_SPACE_STD(FreeListNode);
 
-    FreeListMemory *freeedNode = (FreeListMemory *) ((size_t) (*ptr) - space);
+    FreeListNode *freeedNode = (FreeListNode *) ((size_t) (*ptr) - space);
     freeedNode->_next = NULL;
+    self->usage -= freeedNode->total;
 
-    FreeListMemory *prevNode = NULL;
-    FreeListMemory *node = self->_next;
+    FreeListNode *prevNode = NULL;
+    FreeListNode *node = self->_next;
 
     while (node != NULL) {
         if (*ptr < (void *) node) {
@@ -168,7 +388,7 @@ char freelist_free(FreeListMemory *self, void **ptr) {
         void *tmp = freeedNode->_next;
         unsigned int size = freeedNode->total;
 
-        node = (FreeListMemory *) (lower);
+        node = (FreeListNode *) (lower);
         node->_padding = space;
         node->total = size;
         node->_next = tmp;
@@ -179,34 +399,71 @@ char freelist_free(FreeListMemory *self, void **ptr) {
     return 1;
 }
 
+char freelist_free(FreeListMemory *self, void **ptr) {
+#if MEM_DEBUG_MODE
+    if (self == NULL) {
+        printf("freelist: free failed, invalid instance\n");
+        return 0;
+    }
+    if (ptr == NULL || (*ptr) == NULL) {
+        printf("freelist: free failed, invalid pointer\n");
+        return 0;
+    }
+#endif
+    if (self->_tlsf != NULL)
+        MEM_HOOK_FREE(MEM_STATS_FREELIST, self, ptr, freelist_tlsf_free(self, ptr));
+    MEM_HOOK_FREE(MEM_STATS_FREELIST, self, ptr, freelist_best_free(self, ptr));
+}
+
 void freelist_destroy(FreeListMemory **self) {
     if (self == NULL || *self == NULL) {
         printf("freelist: destroy failed, invalid instance\n");
         return;
     }
-    free((void *) NODE_LOWER(*self));
+    MEM_HOOK_RELEASE(*self);
+    free((void *) SELF_LOWER(*self));
     *self = NULL;
 }
 
 void freelist_reset(FreeListMemory *self) {
-    size_t start = NODE_HIGHER(self);
-    const unsigned int padding = MEMORY_ALIGNMENT_STD(start, FreeListMemory);
-    FreeListMemory *node = (FreeListMemory *) start;
+    MEM_HOOK_RESET(MEM_STATS_FREELIST, self);
+    if (self->_tlsf != NULL) {
+        freelist_tlsf_reset(self);
+        return;
+    }
+    size_t start = SELF_HIGHER(self);
+    const unsigned int padding = MEMORY_ALIGNMENT_STD(start, FreeListNode);
+    FreeListNode *node = (FreeListNode *) start;
     self->_next = NULL;
     node->_padding = padding;
     node->total = self->total - (self->_padding);
     node->_next = NULL;
     freelist_insert(self, NULL, node);
+    self->usage = self->_padding;
 }
 
 unsigned int freelist_usage(FreeListMemory *self) {
-    unsigned int sum = 0;
-    FreeListMemory *node = self->_next;
-    while (node != NULL) {
-        sum += node->total;
-        node = node->_next;
+    return self->usage;
+}
+
+unsigned int freelist_largest(FreeListMemory *self) {
+    unsigned int largest = 0;
+    if (self->_tlsf != NULL) {
+        FreeListTlsf *tlsf = self->_tlsf;
+        if (tlsf->fl == 0)
+            return 0;
+        // only the highest non empty class can hold the largest block, its blocks still differ in size
+        const unsigned int fl = 31 - __builtin_clz(tlsf->fl);
+        const unsigned int sl = 31 - __builtin_clz(tlsf->sl[fl]);
+        for (FreeListTlsfBlock *block = tlsf->heads[fl][sl]; block != NULL; block = block->next)
+            if (TLSF_SIZE(block) - TLSF_HEADER > largest)
+                largest = TLSF_SIZE(block) - TLSF_HEADER;
+        return largest;
     }
-    return self->total - sum;
+    for (FreeListNode *node = self->_next; node != NULL; node = node->_next)
+        if (node->total > largest)
+            largest = node->total;
+    return largest;
 }
 
 FreeListMemory *freelist_create(void *m, unsigned int size) {
@@ -216,6 +473,26 @@ FreeListMemory *freelist_create(void *m, unsigned int size) {
     FreeListMemory *self = (FreeListMemory *) (address + padding - space);
     self->total = size;
     self->_padding = padding;
+    self->_tlsf = NULL;
+
+    freelist_reset(self);
+    return self;
+}
+
+FreeListMemory *freelist_create_tlsf(void *m, unsigned int size) {
+    size_t address = (size_t) m;
+    const unsigned int space = MEMORY_SPACE_STD(FreeListMemory);
+    const unsigned int padding = MEMORY_ALIGNMENT_STD(address, FreeListMemory);
+    FreeListMemory *self = (FreeListMemory *) (address + padding - space);
+    self->total = size;
+    self->_padding = padding;
+    self->_next = NULL;
+    self->_tlsf = (void *) SELF_HIGHER(self);
+
+    if (padding + MEMORY_SPACE_STD(FreeListTlsf) + TLSF_MIN_BLOCK + TLSF_HEADER > size) {
+        printf("freelist: create failed, region too small for tlsf\n");
+        exit(EXIT_FAILURE);
+    }
 
     freelist_reset(self);
     return self;
@@ -228,4 +505,13 @@ FreeListMemory *make_freelist(unsigned int size) {
         exit(EXIT_FAILURE);
     }
     return freelist_create(m, size);
-}
\ No newline at end of file
+}
+
+FreeListMemory *make_freelist_tlsf(unsigned int size) {
+    void *m = malloc(size);
+    if (m == NULL) {
+        printf("freelist: make failed, system can't provide free memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return freelist_create_tlsf(m, size);
+}
@@ -0,0 +1,257 @@
+#include "mem/guard.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if MEM_GUARD_MODE
+
+typedef struct {
+    const void *allocator;
+    void *blocks[MEM_GUARD_QUARANTINE]; // raw blocks in free order, oldest at head
+    unsigned int head;
+    unsigned int n;
+} MemGuardQuarantine;
+
+// every live block is linked here, the lock also covers the quarantine so any thread may free
+static MemGuardHeader *_live = NULL;
+static MemGuardQuarantine _quarantine[MEM_GUARD_ALLOCATORS];
+static volatile int _lock = 0;
+
+static inline void mem_guard_lock() {
+    while (__atomic_exchange_n(&_lock, 1, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(&_lock, __ATOMIC_RELAXED));
+}
+
+static inline void mem_guard_unlock() {
+    __atomic_store_n(&_lock, 0, __ATOMIC_RELEASE);
+}
+
+static inline unsigned char *mem_guard_user(MemGuardHeader *header) {
+    return (unsigned char *) header + header->front;
+}
+
+static inline unsigned long long *mem_guard_link(MemGuardHeader *header) {
+    return (unsigned long long *) (mem_guard_user(header) - sizeof(unsigned long long));
+}
+
+static inline unsigned int mem_guard_filled(const unsigned char *m, size_t n, unsigned char value) {
+    for (size_t i = 0; i < n; i++)
+        if (m[i] != value)
+            return (unsigned int) i;
+    return (unsigned int) n;
+}
+
+// the link word decodes to the header, anything implausible is not a guarded block
+static MemGuardHeader *mem_guard_header(void *ptr) {
+    const unsigned long long front = *(unsigned long long *) ((size_t) ptr - sizeof(unsigned long long)) ^ MEM_GUARD_CANARY;
+    if (front < MEM_GUARD_FRONT(0) || front > 0xFFFF || front % 16 != 0)
+        return NULL;
+    MemGuardHeader *header = (MemGuardHeader *) ((size_t) ptr - front);
+    if (header->front != front || (header->state != MEM_GUARD_LIVE && header->state != MEM_GUARD_FREED))
+        return NULL;
+    return header;
+}
+
+static char mem_guard_check(MemGuardHeader *header) {
+    const unsigned char *user = mem_guard_user(header);
+    const unsigned char *fill = (const unsigned char *) header + sizeof(MemGuardHeader);
+    const size_t n = (size_t) mem_guard_link(header) - (size_t) fill;
+    if (mem_guard_filled(fill, n, MEM_GUARD_FILL) != n || *mem_guard_link(header) != (MEM_GUARD_CANARY ^ header->front)) {
+        printf("guard: block %p of %u bytes, front canary broken\n", user, header->size);
+        return 0;
+    }
+    const unsigned int at = mem_guard_filled(user + header->size, MEM_GUARD_TAIL, MEM_GUARD_FILL);
+    if (at != MEM_GUARD_TAIL) {
+        printf("guard: block %p of %u bytes, back canary broken %u bytes past the end\n", user, header->size, at);
+        return 0;
+    }
+    return 1;
+}
+
+static char mem_guard_check_poison(MemGuardHeader *header) {
+    const unsigned char *user = mem_guard_user(header);
+    const unsigned int at = mem_guard_filled(user, header->size, MEM_GUARD_POISON);
+    if (at != header->size) {
+        printf("guard: block %p of %u bytes, written after free at offset %u\n", user, header->size, at);
+        return 0;
+    }
+    return 1;
+}
+
+static void mem_guard_link_live(MemGuardHeader *header) {
+    header->prev = NULL;
+    header->next = _live;
+    if (_live != NULL)
+        _live->prev = header;
+    _live = header;
+}
+
+static void mem_guard_unlink(MemGuardHeader *header) {
+    if (header->prev != NULL)
+        ((MemGuardHeader *) header->prev)->next = header->next;
+    else
+        _live = (MemGuardHeader *) header->next;
+    if (header->next != NULL)
+        ((MemGuardHeader *) header->next)->prev = header->prev;
+    header->prev = NULL;
+    header->next = NULL;
+}
+
+static void *mem_guard_place(const void *allocator, void *raw, unsigned int size, unsigned int front) {
+    MemGuardHeader *header = (MemGuardHeader *) raw;
+    header->allocator = allocator;
+    header->size = size;
+    header->front = front;
+    header->state = MEM_GUARD_LIVE;
+    header->_padding = 0;
+    unsigned char *fill = (unsigned char *) raw + sizeof(MemGuardHeader);
+    memset(fill, MEM_GUARD_FILL, (size_t) mem_guard_link(header) - (size_t) fill);
+    *mem_guard_link(header) = MEM_GUARD_CANARY ^ front;
+    memset(mem_guard_user(header) + size, MEM_GUARD_FILL, MEM_GUARD_TAIL);
+
+    mem_guard_lock();
+    mem_guard_link_live(header);
+    mem_guard_unlock();
+    return mem_guard_user(header);
+}
+
+static MemGuardQuarantine *mem_guard_quarantine(const void *allocator, char insert) {
+    MemGuardQuarantine *empty = NULL;
+    for (unsigned int i = 0; i < MEM_GUARD_ALLOCATORS; i++) {
+        if (_quarantine[i].allocator == allocator)
+            return &_quarantine[i];
+        if (empty == NULL && _quarantine[i].allocator == NULL)
+            empty = &_quarantine[i];
+    }
+    if (!insert || empty == NULL)
+        return NULL;
+    empty->allocator = allocator;
+    empty->head = 0;
+    empty->n = 0;
+    return empty;
+}
+
+void *mem_guard_alloc(const void *allocator, void *raw, unsigned int size, unsigned int alignment) {
+    if (raw == NULL)
+        return NULL;
+    return mem_guard_place(allocator, raw, size, MEM_GUARD_FRONT(alignment));
+}
+
+char mem_guard_free(const void *allocator, MemStatsKind kind, void **ptr) {
+    if (ptr == NULL || *ptr == NULL)
+        return 1;
+    MemGuardHeader *header = mem_guard_header(*ptr);
+    if (header == NULL) {
+        printf("guard: free failed, %p is not a guarded block or its front canary is broken\n", *ptr);
+        return 0;
+    }
+    mem_guard_lock();
+    if (header->state == MEM_GUARD_FREED) {
+        mem_guard_unlock();
+        printf("guard: free failed, double free of %p\n", *ptr);
+        return 0;
+    }
+    if (header->allocator != allocator) {
+        mem_guard_unlock();
+        printf("guard: free failed, %p belongs to allocator %p\n", *ptr, header->allocator);
+        return 0;
+    }
+    // a broken canary is reported but the block is still released so soak tests keep running
+    mem_guard_check(header);
+    mem_guard_unlink(header);
+    header->state = MEM_GUARD_FREED;
+    memset(mem_guard_user(header), MEM_GUARD_POISON, header->size);
+
+    MemGuardQuarantine *q = kind == MEM_STATS_STACK ? NULL : mem_guard_quarantine(allocator, 1);
+    if (q == NULL) {
+        mem_guard_unlock();
+        *ptr = header;
+        return 1;
+    }
+    if (q->n < MEM_GUARD_QUARANTINE) {
+        q->blocks[(q->head + q->n++) % MEM_GUARD_QUARANTINE] = header;
+        mem_guard_unlock();
+        *ptr = NULL;
+        return 2;
+    }
+    MemGuardHeader *oldest = (MemGuardHeader *) q->blocks[q->head];
+    q->blocks[q->head] = header;
+    q->head = (q->head + 1) % MEM_GUARD_QUARANTINE;
+    mem_guard_check_poison(oldest);
+    mem_guard_unlock();
+    *ptr = oldest;
+    return 1;
+}
+
+void *mem_guard_drop(void *raw) {
+    MemGuardHeader *header = (MemGuardHeader *) raw;
+    mem_guard_lock();
+    mem_guard_check(header);
+    mem_guard_unlink(header);
+    header->state = MEM_GUARD_FREED;
+    mem_guard_unlock();
+    memset(mem_guard_user(header), MEM_GUARD_POISON, header->size);
+    return mem_guard_user(header);
+}
+
+unsigned int mem_guard_detach(void *raw) {
+    MemGuardHeader *header = (MemGuardHeader *) raw;
+    mem_guard_lock();
+    mem_guard_check(header);
+    mem_guard_unlink(header);
+    mem_guard_unlock();
+    return header->front;
+}
+
+void *mem_guard_move(const void *allocator, void *raw, unsigned int size, unsigned int front) {
+    if (raw == NULL)
+        return NULL;
+    return mem_guard_place(allocator, raw, size, front);
+}
+
+unsigned int mem_guard_length(const void *raw) {
+    return ((const MemGuardHeader *) raw)->size;
+}
+
+void mem_guard_reset(const void *allocator) {
+    mem_guard_lock();
+    for (MemGuardHeader *header = _live; header != NULL;) {
+        MemGuardHeader *next = (MemGuardHeader *) header->next;
+        if (header->allocator == allocator) {
+            mem_guard_check(header);
+            mem_guard_unlink(header);
+        }
+        header = next;
+    }
+    MemGuardQuarantine *q = mem_guard_quarantine(allocator, 0);
+    if (q != NULL) {
+        for (unsigned int i = 0; i < q->n; i++)
+            mem_guard_check_poison((MemGuardHeader *) q->blocks[(q->head + i) % MEM_GUARD_QUARANTINE]);
+        q->allocator = NULL;
+        q->n = 0;
+    }
+    mem_guard_unlock();
+}
+
+unsigned int alloc_validate() {
+    unsigned int bad = 0;
+    mem_guard_lock();
+    for (MemGuardHeader *header = _live; header != NULL; header = (MemGuardHeader *) header->next)
+        bad += !mem_guard_check(header);
+    for (unsigned int i = 0; i < MEM_GUARD_ALLOCATORS; i++) {
+        const MemGuardQuarantine *q = &_quarantine[i];
+        if (q->allocator == NULL) continue;
+        for (unsigned int j = 0; j < q->n; j++)
+            bad += !mem_guard_check_poison((MemGuardHeader *) q->blocks[(q->head + j) % MEM_GUARD_QUARANTINE]);
+    }
+    mem_guard_unlock();
+    return bad;
+}
+
+#else
+
+unsigned int alloc_validate() {
+    return 0;
+}
+
+#endif
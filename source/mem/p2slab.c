@@ -4,52 +4,130 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#if _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
 #include "mem/utils.h"
+#include "mem/hook.h"
 
 
+// pages with free slots, pages without, and at most one empty spare kept to absorb alloc/free churn
 typedef struct __attribute__((aligned(16), packed)) {
-    void *objects;
-    void *pages;
+    void *partial;
+    void *full;
+    void *empty;
 } P2SlabPool;
 
 typedef struct __attribute__((aligned(8), packed)) {
-    size_t next;
+    size_t next; // 6bytes page 1byte state 1byte order
 } P2SlabObject;
 
 typedef struct __attribute__((aligned(16), packed)) {
     void *next;
+    void *prev;
+    unsigned int live;
+    unsigned int capacity;
+    unsigned int hint; // no free slot below this bitmap word
     unsigned int size;
     unsigned int padding;
 } P2SlabPage;
 
+// page layout: header, occupancy bitmap, objects of P2SLAB_STRIDE bytes each
+#define P2SLAB_WORD_BITS 64
+#define P2SLAB_WORDS(capacity) (((capacity) + P2SLAB_WORD_BITS - 1) / P2SLAB_WORD_BITS)
+#define P2SLAB_STRIDE(order) (MEMORY_SPACE((1UL << (order)), sizeof(size_t)) + MEMORY_SPACE_STD(P2SlabObject))
+#define P2SLAB_BITMAP(page) ((unsigned long long *) ((size_t) (page) + MEMORY_SPACE_STD(P2SlabPage)))
+#define P2SLAB_OBJECTS(page) ((size_t) P2SLAB_BITMAP(page) + P2SLAB_WORDS((page)->capacity) * sizeof(unsigned long long))
+#define P2SLAB_PAGE(node) ((P2SlabPage *) BYTE6AB_GET_6((node)->next))
+
+typedef struct {
+    P2SlabMemory *owner;
+    unsigned int n[P2SLAB_CACHE_ORDERS];
+    P2SlabObject *objects[P2SLAB_CACHE_ORDERS][P2SLAB_CACHE_SIZE];
+} P2SlabCache;
+
+// a thread's cache slots, heap allocated and linked into the registry so p2slab_destroy can reach the slots of
+// every live thread, a thread that exits flushes and unlinks its own
+typedef struct P2SlabCaches {
+    P2SlabCache slots[P2SLAB_CACHE_SLOTS];
+    struct P2SlabCaches *next;
+} P2SlabCaches;
+
 
 #define P2SLAB_POOL(pools) ((P2SlabPool *) (&pools))
 
-void p2slab_enqueue(P2SlabPool *pool, P2SlabObject *node, unsigned char order) {
-    node->next = BYTE6AB((size_t) pool->objects, 0, order);
-    pool->objects = node;
+// object states kept in the A byte of P2SlabObject::next
+#define P2SLAB_FREE 0
+#define P2SLAB_USED 1
+#define P2SLAB_CACHED 2
+
+// slots change owner under the registry lock, a thread reads its own slots without it
+static P2SlabCaches *_registry = NULL;
+static volatile int _registryLock = 0;
+static _Thread_local P2SlabCaches *_caches = NULL;
+static _Thread_local P2SlabCacheStats _cacheStats;
+
+// only there for its destructor, which runs p2slab_cache_exit when a thread holding slots exits
+#if _WIN32
+static DWORD _exitKey = FLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t _exitKey;
+#endif
+static char _exitKeyed = 0;
+
+#if _WIN32
+static void WINAPI p2slab_cache_exit(void *data);
+#else
+static void p2slab_cache_exit(void *data);
+#endif
+
+static inline void p2slab_lock(P2SlabMemory *self) {
+    while (__atomic_exchange_n(&self->_lock, 1, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(&self->_lock, __ATOMIC_RELAXED));
 }
 
-P2SlabObject *p2slab_dequeue(P2SlabPool *pool) {
-    if (pool->objects == NULL)
-        return NULL;
+static inline void p2slab_unlock(P2SlabMemory *self) {
+    __atomic_store_n(&self->_lock, 0, __ATOMIC_RELEASE);
+}
 
-    P2SlabObject *node = pool->objects;
-    node->next = BYTE6AB_SET_A(node->next, 1);
-    pool->objects = (P2SlabObject *) (BYTE6AB_GET_6(node->next));
-    return node;
+static inline void p2slab_registry_lock() {
+    while (__atomic_exchange_n(&_registryLock, 1, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(&_registryLock, __ATOMIC_RELAXED));
+}
+
+static inline void p2slab_registry_unlock() {
+    __atomic_store_n(&_registryLock, 0, __ATOMIC_RELEASE);
+}
+
+static inline void p2slab_link(void **list, P2SlabPage *page) {
+    page->prev = NULL;
+    page->next = *list;
+    if (*list != NULL)
+        ((P2SlabPage *) *list)->prev = page;
+    *list = page;
+}
+
+static inline void p2slab_unlink(void **list, P2SlabPage *page) {
+    if (page->prev != NULL)
+        ((P2SlabPage *) page->prev)->next = page->next;
+    else
+        *list = page->next;
+    if (page->next != NULL)
+        ((P2SlabPage *) page->next)->prev = page->prev;
 }
 
 P2SlabPage *create_p2slab(P2SlabMemory *self, unsigned int order) {
-    unsigned int objectSize = 1 << order;
+    const unsigned int capacity = self->_n;
+    const unsigned int words = P2SLAB_WORDS(capacity);
 
-    unsigned int size = self->_n * objectSize;
-    size += MEMORY_SPACE_STD(P2SlabPage);
-    size += self->_n * MEMORY_SPACE_STD(P2SlabObject);
+    unsigned int size = MEMORY_SPACE_STD(P2SlabPage);
+    size += words * sizeof(unsigned long long);
+    size += capacity * P2SLAB_STRIDE(order);
     size += sizeof(size_t);
 
-    self->total += size;
-
     void *m = NULL;
     if (self->_allocator.alloc != NULL)
         m = self->_allocator.alloc(size);
@@ -59,27 +137,26 @@ P2SlabPage *create_p2slab(P2SlabMemory *self, unsigned int order) {
         printf("p2slab create slab failed, system can't provide free memory\n");
         return NULL;
     }
+    // read without the lock by the stats and trace hooks
+    __atomic_fetch_add(&self->total, size, __ATOMIC_RELAXED);
+
     const size_t start = (size_t) m;
-    unsigned int space = MEMORY_SPACE_STD(P2SlabPage);
-    unsigned int padding = MEMORY_PADDING_STD(start);
+    const unsigned int padding = MEMORY_PADDING_STD(start);
 
     P2SlabPage *slab = (P2SlabPage *) (start + padding);
     slab->next = NULL;
+    slab->prev = NULL;
+    slab->live = 0;
+    slab->capacity = capacity;
+    slab->hint = 0;
     slab->size = size;
     slab->padding = padding;
 
-    size_t cursor = padding + space;
-    space = MEMORY_SPACE_STD(P2SlabObject);
-    while (1) {
-        size_t address = start + cursor;
-        padding = MEMORY_ALIGNMENT_STD(address, P2SlabObject);
-        cursor += padding + objectSize;
-        if (cursor > size)
-            break;
-
-        P2SlabPool *pools = P2SLAB_POOL(self->_pools);
-        p2slab_enqueue(&pools[order], (P2SlabObject *) (address + padding - space), order);
-    }
+    unsigned long long *bitmap = P2SLAB_BITMAP(slab);
+    clear(bitmap, words * sizeof(unsigned long long));
+    // slots past the capacity are marked used so the bit scan never hands them out
+    if (capacity % P2SLAB_WORD_BITS)
+        bitmap[words - 1] = ~0ULL << (capacity % P2SLAB_WORD_BITS);
     return slab;
 }
 
@@ -90,15 +167,18 @@ P2SlabMemory *p2slab_create(void *m, unsigned int n) {
     P2SlabMemory *self = (P2SlabMemory *) (start + padding);
     self->_allocator.alloc = NULL;
     self->_allocator.free = NULL;
+    if (n == 0) n = 1;
     self->_n = n;
     self->_padding = padding;
+    self->_lock = 0;
     self->usage = 0;
     self->total = padding + sizeof(P2SlabMemory);
 
     for (int i = 0; i < P2SLAB_MAX; i++) {
         P2SlabPool *pools = P2SLAB_POOL(self->_pools);
-        pools[i].objects = NULL;
-        pools[i].pages = NULL;
+        pools[i].partial = NULL;
+        pools[i].full = NULL;
+        pools[i].empty = NULL;
     }
     return self;
 }
@@ -124,6 +204,7 @@ P2SlabMemory *make_p2slab(unsigned int n) {
 }
 
 void destroy_p2slab(P2SlabMemory *self, P2SlabPage *slab) {
+    __atomic_fetch_sub(&self->total, slab->size, __ATOMIC_RELAXED);
     size_t op = (size_t) slab - slab->padding;
     if (self->_allocator.free != NULL)
         self->_allocator.free((void *) (op));
@@ -131,20 +212,39 @@ void destroy_p2slab(P2SlabMemory *self, P2SlabPage *slab) {
         free((void *) (op));
 }
 
+void destroy_p2slabs(P2SlabMemory *self, P2SlabPage *slab) {
+    while (slab != NULL) {
+        P2SlabPage *next = slab->next;
+        destroy_p2slab(self, slab);
+        slab = next;
+    }
+}
+
 void p2slab_destroy(P2SlabMemory **self) {
     if (self == NULL || *self == NULL) {
         printf("p2slab destroy failed, invalid instance\n");
         return;
     }
+    MEM_HOOK_RELEASE(*self);
+
+    // cached objects live in the pages freed below, every thread's slots for this instance are dropped with them
+    p2slab_registry_lock();
+    for (P2SlabCaches *caches = _registry; caches != NULL; caches = caches->next) {
+        for (int i = 0; i < P2SLAB_CACHE_SLOTS; i++) {
+            P2SlabCache *cache = &caches->slots[i];
+            if (__atomic_load_n(&cache->owner, __ATOMIC_RELAXED) != *self)
+                continue;
+            clear(cache->n, sizeof(cache->n));
+            __atomic_store_n(&cache->owner, NULL, __ATOMIC_RELAXED);
+        }
+    }
+    p2slab_registry_unlock();
 
+    P2SlabPool *pools = P2SLAB_POOL((*self)->_pools);
     for (int i = 0; i < P2SLAB_MAX; i++) {
-        P2SlabPool *pools = P2SLAB_POOL((*self)->_pools);
-        P2SlabPage *slab = pools[i].pages;
-        while (slab != NULL) {
-            void *next = slab->next;
-            destroy_p2slab(*self, slab);
-            slab = next;
-        }
+        destroy_p2slabs(*self, pools[i].partial);
+        destroy_p2slabs(*self, pools[i].full);
+        destroy_p2slabs(*self, pools[i].empty);
     }
 
     size_t op = (size_t) (*self) - (*self)->_padding;
@@ -170,40 +270,101 @@ int p2slab_next(int num) {
     return num + 1;
 }
 
-void *p2slab_alloc(P2SlabMemory *self, unsigned int size) {
-#if MEM_DEBUG_MODE
-    if (self == NULL) {
-        printf("p2slab alloc failed, invalid instance\n");
-        return NULL;
-    }
-#endif
+unsigned int p2slab_order(unsigned int size) {
     unsigned int order = 0;
     size = p2slab_next((int) size);
     while (size > 1) {
         size >>= 1;
         order++;
     }
+    return order;
+}
 
+// both expect the lock to be held
+P2SlabObject *p2slab_take(P2SlabMemory *self, unsigned int order) {
     P2SlabPool *pools = P2SLAB_POOL(self->_pools);
     P2SlabPool *pool = &pools[order];
 
-    if (pool->objects == NULL) {
-        P2SlabPage *slab = create_p2slab(self, order);
-        if (slab == NULL) {
+    P2SlabPage *slab = pool->partial;
+    if (slab == NULL) {
+        if (pool->empty != NULL) {
+            slab = pool->empty;
+            pool->empty = NULL;
+        } else if ((slab = create_p2slab(self, order)) == NULL) {
             printf("p2slab alloc failed, cannot create new slab\n");
             return NULL;
         }
-        slab->next = pool->pages;
-        pool->pages = slab;
+        p2slab_link(&pool->partial, slab);
+    }
+
+    unsigned long long *bitmap = P2SLAB_BITMAP(slab);
+    unsigned int word = slab->hint;
+    while (bitmap[word] == ~0ULL)
+        word++;
+    const unsigned int bit = __builtin_ctzll(~bitmap[word]);
+    bitmap[word] |= 1ULL << bit;
+    slab->hint = word;
+    if (++slab->live == slab->capacity) {
+        p2slab_unlink(&pool->partial, slab);
+        p2slab_link(&pool->full, slab);
+    }
+
+    P2SlabObject *node = (P2SlabObject *) (P2SLAB_OBJECTS(slab) + (word * P2SLAB_WORD_BITS + bit) * P2SLAB_STRIDE(order));
+    node->next = BYTE6AB((size_t) slab, P2SLAB_USED, order);
+    __atomic_fetch_add(&self->usage, 1U << order, __ATOMIC_RELAXED);
+    return node;
+}
+
+void p2slab_give(P2SlabMemory *self, P2SlabObject *node, unsigned int order) {
+    P2SlabPool *pools = P2SLAB_POOL(self->_pools);
+    P2SlabPool *pool = &pools[order];
+    P2SlabPage *slab = P2SLAB_PAGE(node);
+    node->next = BYTE6AB((size_t) slab, P2SLAB_FREE, order);
+
+    const unsigned int index = ((size_t) node - P2SLAB_OBJECTS(slab)) / P2SLAB_STRIDE(order);
+    const unsigned int word = index / P2SLAB_WORD_BITS;
+    P2SLAB_BITMAP(slab)[word] &= ~(1ULL << (index % P2SLAB_WORD_BITS));
+    if (word < slab->hint)
+        slab->hint = word;
+    __atomic_fetch_sub(&self->usage, 1U << order, __ATOMIC_RELAXED);
+
+    if (slab->live-- == slab->capacity) {
+        p2slab_unlink(&pool->full, slab);
+        p2slab_link(&pool->partial, slab);
+    }
+    if (slab->live == 0) {
+        p2slab_unlink(&pool->partial, slab);
+        if (pool->empty == NULL)
+            p2slab_link(&pool->empty, slab);
+        else
+            destroy_p2slab(self, slab);
     }
+}
+
+static inline void *p2slab_alloc_impl(P2SlabMemory *self, unsigned int size) {
+#if MEM_DEBUG_MODE
+    if (self == NULL) {
+        printf("p2slab alloc failed, invalid instance\n");
+        return NULL;
+    }
+#endif
+    unsigned int order = p2slab_order(size);
+
+    p2slab_lock(self);
+    P2SlabObject *node = p2slab_take(self, order);
+    p2slab_unlock(self);
 
-    P2SlabObject *node = p2slab_dequeue(pool);
+    if (node == NULL)
+        return NULL;
     const unsigned int space = MEMORY_SPACE_STD(P2SlabObject);
-    self->usage += 1 << order;
     return (void *) ((size_t) node + space);
 }
 
-char p2slab_free(P2SlabMemory *self, void **ptr) {
+void *p2slab_alloc(P2SlabMemory *self, unsigned int size) {
+    MEM_HOOK_ALLOC(MEM_STATS_P2SLAB, self, size, 0, p2slab_alloc_impl(self, MEM_GUARD_SIZE(size, 0)));
+}
+
+static inline char p2slab_free_impl(P2SlabMemory *self, void **ptr) {
 #if MEM_DEBUG_MODE
     if (self == NULL) {
         printf("p2slab free failed, invalid instance\n");
@@ -217,84 +378,233 @@ char p2slab_free(P2SlabMemory *self, void **ptr) {
     const unsigned int space = MEMORY_SPACE_STD(P2SlabObject);
     P2SlabObject *node = (P2SlabObject *) ((size_t) (*ptr) - space);
 
-    if (!BYTE6AB_GET_A(node->next)) {
+    if (BYTE6AB_GET_A(node->next) != P2SLAB_USED) {
         printf("p2slab free failed, already freed\n");
         return 0;
     }
     unsigned int order = BYTE6AB_GET_B(node->next);
-    P2SlabPool *pools = P2SLAB_POOL(self->_pools);
-    p2slab_enqueue(&pools[order], node, order);
-    self->usage -= (1 << order);
+
+    p2slab_lock(self);
+    p2slab_give(self, node, order);
+    p2slab_unlock(self);
     return 1;
 }
 
-char p2slab_is_free(P2SlabPage *slab, unsigned int objectSize) {
-    unsigned int space = MEMORY_SPACE_STD(P2SlabPage);
-    const size_t start = (size_t) slab - slab->padding;
-    size_t cursor = slab->padding + space;
-    while (1) {
-        size_t address = start + cursor;
-        space = MEMORY_SPACE_STD(P2SlabObject);
-        unsigned int padding = MEMORY_ALIGNMENT_STD(address, P2SlabObject);
-        cursor += padding + objectSize;
-        if (cursor > slab->size)
+char p2slab_free(P2SlabMemory *self, void **ptr) {
+    MEM_HOOK_FREE(MEM_STATS_P2SLAB, self, ptr, p2slab_free_impl(self, ptr));
+}
+
+P2SlabCache *p2slab_cache(P2SlabMemory *self) {
+    P2SlabCaches *caches = _caches;
+    if (caches == NULL) {
+        caches = (P2SlabCaches *) calloc(1, sizeof(P2SlabCaches));
+        if (caches == NULL) {
+            printf("p2slab cache failed, system can't provide free memory\n");
+            return NULL;
+        }
+        p2slab_registry_lock();
+        if (!_exitKeyed) {
+#if _WIN32
+            _exitKey = FlsAlloc(p2slab_cache_exit);
+            _exitKeyed = _exitKey != FLS_OUT_OF_INDEXES;
+#else
+            _exitKeyed = pthread_key_create(&_exitKey, p2slab_cache_exit) == 0;
+#endif
+            if (!_exitKeyed)
+                printf("p2slab cache failed, can't register the thread exit hook\n");
+        }
+        caches->next = _registry;
+        _registry = caches;
+        p2slab_registry_unlock();
+        _caches = caches;
+#if _WIN32
+        if (_exitKeyed)
+            FlsSetValue(_exitKey, caches);
+#else
+        if (_exitKeyed)
+            pthread_setspecific(_exitKey, caches);
+#endif
+    }
+    for (int i = 0; i < P2SLAB_CACHE_SLOTS; i++) {
+        if (__atomic_load_n(&caches->slots[i].owner, __ATOMIC_RELAXED) == self)
+            return &caches->slots[i];
+    }
+
+    // owners checked under the lock are alive, a destroyed one has already cleared its slots
+    p2slab_registry_lock();
+    P2SlabCache *empty = NULL;
+    for (int i = 0; i < P2SLAB_CACHE_SLOTS && empty == NULL; i++) {
+        if (caches->slots[i].owner == NULL)
+            empty = &caches->slots[i];
+    }
+    if (empty == NULL) {
+        empty = &caches->slots[P2SLAB_CACHE_SLOTS - 1];
+        p2slab_cache_flush(empty->owner);
+    }
+    __atomic_store_n(&empty->owner, self, __ATOMIC_RELAXED);
+    p2slab_registry_unlock();
+    return empty;
+}
+
+unsigned int p2slab_refill(P2SlabMemory *self, P2SlabCache *cache, unsigned int order) {
+    p2slab_lock(self);
+    while (cache->n[order] < (P2SLAB_CACHE_SIZE >> 1)) {
+        P2SlabObject *node = p2slab_take(self, order);
+        if (node == NULL)
             break;
-        P2SlabObject *obj = (P2SlabObject *) (address + padding - space);
-        if (BYTE6AB_GET_A(obj->next)) return 0;
+        node->next = BYTE6AB(BYTE6AB_GET_6(node->next), P2SLAB_CACHED, order);
+        cache->objects[order][cache->n[order]++] = node;
     }
-    return 1;
+    p2slab_unlock(self);
+    return cache->n[order];
 }
 
-void p2slab_fit_pool(P2SlabMemory *self, P2SlabPool *pool, unsigned int order) {
-    if (pool->pages == NULL)
-        return;
-    unsigned int objectSize = 1 << order;
-    P2SlabPage *slab = pool->pages;
-    pool->pages = NULL;
-    pool->objects = NULL;
-    while (slab != NULL) {
-        P2SlabPage *next = slab->next;
+void p2slab_drain(P2SlabMemory *self, P2SlabCache *cache, unsigned int order, unsigned int keep) {
+    p2slab_lock(self);
+    while (cache->n[order] > keep)
+        p2slab_give(self, cache->objects[order][--cache->n[order]], order);
+    p2slab_unlock(self);
+}
 
-        if (p2slab_is_free(slab, objectSize)) {
+static inline void *p2slab_alloc_cached_impl(P2SlabMemory *self, unsigned int size) {
+#if MEM_DEBUG_MODE
+    if (self == NULL) {
+        printf("p2slab alloc failed, invalid instance\n");
+        return NULL;
+    }
+#endif
+    unsigned int order = p2slab_order(size);
+    if (order >= P2SLAB_CACHE_ORDERS)
+        return p2slab_alloc_impl(self, size);
+
+    P2SlabCache *cache = p2slab_cache(self);
+    if (cache == NULL)
+        return p2slab_alloc_impl(self, size);
+    if (cache->n[order] == 0) {
+        _cacheStats.allocMisses++;
+        if (p2slab_refill(self, cache, order) == 0)
+            return NULL;
+    } else {
+        _cacheStats.allocHits++;
+    }
+
+    P2SlabObject *node = cache->objects[order][--cache->n[order]];
+    node->next = BYTE6AB(BYTE6AB_GET_6(node->next), P2SLAB_USED, order);
+    const unsigned int space = MEMORY_SPACE_STD(P2SlabObject);
+    return (void *) ((size_t) node + space);
+}
 
-            unsigned int size = self->_n * objectSize;
-            size += MEMORY_SPACE_STD(P2SlabPage);
-            size += self->_n * MEMORY_SPACE_STD(P2SlabObject);
-            size += sizeof(size_t);
+void *p2slab_alloc_cached(P2SlabMemory *self, unsigned int size) {
+    MEM_HOOK_ALLOC(MEM_STATS_P2SLAB, self, size, 0, p2slab_alloc_cached_impl(self, MEM_GUARD_SIZE(size, 0)));
+}
 
-            self->total -= size;
-            destroy_p2slab(self, slab);
+static inline char p2slab_free_cached_impl(P2SlabMemory *self, void **ptr) {
+#if MEM_DEBUG_MODE
+    if (self == NULL) {
+        printf("p2slab free failed, invalid instance\n");
+        return 0;
+    }
+    if (ptr == NULL || (*ptr) == NULL) {
+        printf("p2slab free failed, invalid pointer\n");
+        return 0;
+    }
+#endif
+    const unsigned int space = MEMORY_SPACE_STD(P2SlabObject);
+    P2SlabObject *node = (P2SlabObject *) ((size_t) (*ptr) - space);
+
+    if (BYTE6AB_GET_A(node->next) != P2SLAB_USED) {
+        printf("p2slab free failed, already freed\n");
+        return 0;
+    }
+    unsigned int order = BYTE6AB_GET_B(node->next);
+    if (order >= P2SLAB_CACHE_ORDERS)
+        return p2slab_free_impl(self, ptr);
+
+    P2SlabCache *cache = p2slab_cache(self);
+    if (cache == NULL)
+        return p2slab_free_impl(self, ptr);
+    if (cache->n[order] == P2SLAB_CACHE_SIZE) {
+        _cacheStats.freeMisses++;
+        p2slab_drain(self, cache, order, P2SLAB_CACHE_SIZE >> 1);
+    } else {
+        _cacheStats.freeHits++;
+    }
+
+    node->next = BYTE6AB(BYTE6AB_GET_6(node->next), P2SLAB_CACHED, order);
+    cache->objects[order][cache->n[order]++] = node;
+    *ptr = NULL;
+    return 1;
+}
+
+char p2slab_free_cached(P2SlabMemory *self, void **ptr) {
+    MEM_HOOK_FREE(MEM_STATS_P2SLAB, self, ptr, p2slab_free_cached_impl(self, ptr));
+}
 
-        } else {
-            unsigned int space = MEMORY_SPACE_STD(P2SlabPage);
-            const size_t start = (size_t) slab - slab->padding;
-            size_t cursor = slab->padding + space;
-            while (1) {
-                size_t address = start + cursor;
-                space = MEMORY_SPACE_STD(P2SlabObject);
-                unsigned int padding = MEMORY_ALIGNMENT_STD(address, P2SlabObject);
-                cursor += padding + objectSize;
-                if (cursor > slab->size)
-                    break;
-
-                P2SlabObject *obj = (P2SlabObject *) (address + padding - space);
-                if (!BYTE71_GET_1(obj->next)) { // is free
-                    p2slab_enqueue(pool, obj, order);
-                } else {
-                    self->usage += objectSize;
-                }
-            }
-            slab->next = pool->pages;
-            pool->pages = slab;
+void p2slab_cache_flush(P2SlabMemory *self) {
+    if (self == NULL || _caches == NULL)
+        return;
+    for (int i = 0; i < P2SLAB_CACHE_SLOTS; i++) {
+        P2SlabCache *cache = &_caches->slots[i];
+        if (__atomic_load_n(&cache->owner, __ATOMIC_RELAXED) != self)
+            continue;
+        for (unsigned int order = 0; order < P2SLAB_CACHE_ORDERS; order++) {
+            if (cache->n[order] > 0)
+                p2slab_drain(self, cache, order, 0);
         }
-        slab = next;
+        __atomic_store_n(&cache->owner, NULL, __ATOMIC_RELAXED);
     }
 }
 
+static void p2slab_cache_release(P2SlabCaches *caches) {
+    // under the lock so an owner can't be destroyed while its slot is drained
+    p2slab_registry_lock();
+    for (int i = 0; i < P2SLAB_CACHE_SLOTS; i++) {
+        P2SlabCache *cache = &caches->slots[i];
+        P2SlabMemory *owner = cache->owner;
+        if (owner == NULL)
+            continue;
+        for (unsigned int order = 0; order < P2SLAB_CACHE_ORDERS; order++) {
+            if (cache->n[order] > 0)
+                p2slab_drain(owner, cache, order, 0);
+        }
+    }
+    P2SlabCaches **link = &_registry;
+    while (*link != caches)
+        link = &(*link)->next;
+    *link = caches->next;
+    p2slab_registry_unlock();
+    if (_caches == caches)
+        _caches = NULL;
+    free(caches);
+}
+
+#if _WIN32
+static void WINAPI p2slab_cache_exit(void *data) {
+    if (data != NULL)
+        p2slab_cache_release((P2SlabCaches *) data);
+}
+#else
+static void p2slab_cache_exit(void *data) {
+    p2slab_cache_release((P2SlabCaches *) data);
+}
+#endif
+
+P2SlabCacheStats p2slab_cache_stats() {
+    return _cacheStats;
+}
+
+void p2slab_cache_reset_stats() {
+    clear(&_cacheStats, sizeof(P2SlabCacheStats));
+}
+
 void p2slab_fit(P2SlabMemory *self) {
-    self->usage = 0;
+    p2slab_lock(self);
     P2SlabPool *pools = P2SLAB_POOL(self->_pools);
     for (int i = 0; i < P2SLAB_MAX; i++) {
-        p2slab_fit_pool(self, &pools[i], i);
+        if (pools[i].empty != NULL) {
+            destroy_p2slab(self, pools[i].empty);
+            pools[i].empty = NULL;
+        }
     }
-}
\ No newline at end of file
+    p2slab_unlock(self);
+}
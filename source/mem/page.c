@@ -0,0 +1,241 @@
+#include "mem/page.h"
+
+#include <stdio.h>
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+// from linux/mempolicy.h, the raw syscalls avoid a libnuma dependency
+#define PAGE_MPOL_BIND 2
+#define PAGE_MPOL_MF_MOVE (1 << 1)
+#define PAGE_MPOL_F_NODE (1 << 0)
+#define PAGE_MPOL_F_ADDR (1 << 1)
+#define PAGE_MAX_NODES 64
+
+#if _WIN32
+
+void *page_alloc(size_t size, unsigned int flags, int node) {
+    void *m = NULL;
+    if (flags & PAGE_HUGE) {
+        const size_t large = GetLargePageMinimum();
+        if (large != 0)
+            m = VirtualAlloc(NULL, MEMORY_SPACE(size, large), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                             PAGE_READWRITE);
+    }
+    if (m == NULL && (flags & PAGE_NUMA))
+        m = VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE,
+                               (DWORD) node);
+    if (m == NULL)
+        m = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    return m;
+}
+
+void page_free(void *m, size_t size, unsigned int flags) {
+    (void) size;
+    (void) flags;
+    if (m != NULL)
+        VirtualFree(m, 0, MEM_RELEASE);
+}
+
+char page_bind(void *m, size_t size, int node) {
+    (void) m;
+    (void) size;
+    (void) node;
+    return 0;
+}
+
+size_t page_size_at(const void *m) {
+    (void) m;
+    return 0;
+}
+
+int page_node_at(const void *m) {
+    (void) m;
+    return -1;
+}
+
+const void *page_map_file(const char *path, size_t *size) {
+    *size = 0;
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        printf("page: map failed, can't open %s\n", path);
+        return NULL;
+    }
+    LARGE_INTEGER length;
+    if (!GetFileSizeEx(file, &length) || length.QuadPart == 0) {
+        printf("page: map failed, %s is empty\n", path);
+        CloseHandle(file);
+        return NULL;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const void *m = mapping != NULL ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    // the view keeps the file mapped after both handles are closed
+    if (mapping != NULL) CloseHandle(mapping);
+    CloseHandle(file);
+    if (m == NULL) {
+        printf("page: map failed, can't map %s\n", path);
+        return NULL;
+    }
+    *size = (size_t) length.QuadPart;
+    return m;
+}
+
+void page_unmap_file(const void *m, size_t size) {
+    (void) size;
+    if (m != NULL)
+        UnmapViewOfFile(m);
+}
+
+#else
+
+static size_t page_map_size(size_t size, unsigned int flags) {
+    return flags & PAGE_HUGE ? MEMORY_SPACE(size, (size_t) PAGE_HUGE_SIZE) : size;
+}
+
+void *page_alloc(size_t size, unsigned int flags, int node) {
+    const size_t length = page_map_size(size, flags);
+    void *m = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (flags & PAGE_HUGE)
+        m = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (m == MAP_FAILED && (flags & PAGE_HUGE)) {
+        // transparent huge pages only back 2MB aligned extents, so over-map and trim
+        void *raw = mmap(NULL, length + PAGE_HUGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) {
+            printf("page: alloc failed, system can't provide free memory\n");
+            return NULL;
+        }
+        const size_t start = (size_t) raw;
+        const size_t aligned = MEMORY_SPACE(start, (size_t) PAGE_HUGE_SIZE);
+        if (aligned > start)
+            munmap(raw, aligned - start);
+        munmap((void *) (aligned + length), PAGE_HUGE_SIZE - (aligned - start));
+        m = (void *) aligned;
+#ifdef MADV_HUGEPAGE
+        madvise(m, length, MADV_HUGEPAGE);
+#endif
+    } else if (m == MAP_FAILED) {
+        m = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (m == MAP_FAILED) {
+            printf("page: alloc failed, system can't provide free memory\n");
+            return NULL;
+        }
+    }
+    if (flags & PAGE_NUMA)
+        page_bind(m, length, node);
+    return m;
+}
+
+void page_free(void *m, size_t size, unsigned int flags) {
+    if (m != NULL)
+        munmap(m, page_map_size(size, flags));
+}
+
+char page_bind(void *m, size_t size, int node) {
+#if __linux__ && defined(SYS_mbind)
+    if (node < 0 || node >= PAGE_MAX_NODES) {
+        printf("page: bind failed, invalid node %d\n", node);
+        return 0;
+    }
+    const size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    const size_t start = (size_t) m & ~(pageSize - 1);
+    unsigned long mask = 1UL << node;
+    if (syscall(SYS_mbind, start, (size_t) m + size - start, PAGE_MPOL_BIND, &mask, PAGE_MAX_NODES + 1,
+                PAGE_MPOL_MF_MOVE) != 0) {
+        printf("page: bind failed, node %d unavailable, keeping the default policy\n", node);
+        return 0;
+    }
+    return 1;
+#else
+    (void) m;
+    (void) size;
+    (void) node;
+    return 0;
+#endif
+}
+
+size_t page_size_at(const void *m) {
+#if __linux__
+    FILE *f = fopen("/proc/self/smaps", "r");
+    if (f == NULL) return 0;
+    const size_t address = (size_t) m;
+    char line[256];
+    char inside = 0;
+    size_t kernelPage = 0, anonHuge = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        unsigned long start, end, value;
+        // mapping headers start with the address range, the fields under them with a name
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            if (inside) break;
+            inside = address >= start && address < end;
+        } else if (inside && sscanf(line, "KernelPageSize: %lu kB", &value) == 1) {
+            kernelPage = value * KILOBYTES;
+        } else if (inside && sscanf(line, "AnonHugePages: %lu kB", &value) == 1) {
+            anonHuge = value * KILOBYTES;
+        }
+    }
+    fclose(f);
+    // transparent huge pages keep the 4kB kernel page size, a non zero AnonHugePages is what tells them apart
+    return anonHuge > 0 && kernelPage < PAGE_HUGE_SIZE ? PAGE_HUGE_SIZE : kernelPage;
+#else
+    (void) m;
+    return (size_t) sysconf(_SC_PAGESIZE);
+#endif
+}
+
+int page_node_at(const void *m) {
+#if __linux__ && defined(SYS_get_mempolicy)
+    int node = -1;
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0, m, PAGE_MPOL_F_NODE | PAGE_MPOL_F_ADDR) != 0)
+        return -1;
+    return node;
+#else
+    (void) m;
+    return -1;
+#endif
+}
+
+const void *page_map_file(const char *path, size_t *size) {
+    *size = 0;
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("page: map failed, can't open %s\n", path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        printf("page: map failed, %s is empty\n", path);
+        close(fd);
+        return NULL;
+    }
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    // readers go through the whole file, faulting it in up front saves a fault per page
+    flags |= MAP_POPULATE;
+#endif
+    void *m = mmap(NULL, (size_t) st.st_size, PROT_READ, flags, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        printf("page: map failed, can't map %s\n", path);
+        return NULL;
+    }
+    *size = (size_t) st.st_size;
+    return m;
+}
+
+void page_unmap_file(const void *m, size_t size) {
+    if (m != NULL)
+        munmap((void *) m, size);
+}
+
+#endif
@@ -6,6 +6,7 @@
 #include <stdio.h>
 
 #include "mem/utils.h"
+#include "mem/hook.h"
 
 void pool_enqueue(PoolMemory *self, PoolMemoryNode *node) {
     node->next = BYTE71((size_t) self->_head, 0);
@@ -22,7 +23,7 @@ PoolMemoryNode *pool_dequeue(PoolMemory *self) {
     return node;
 }
 
-void *pool_alloc(PoolMemory *self) {
+static inline void *pool_alloc_impl(PoolMemory *self) {
 #if MEM_DEBUG_MODE
     if (self == NULL) {
         printf("pool: alloc failed, invalid instance\n");
@@ -39,7 +40,11 @@ void *pool_alloc(PoolMemory *self) {
     return (void *) ((size_t) node + space);
 }
 
-unsigned char pool_free(PoolMemory *self, void **p) {
+void *pool_alloc(PoolMemory *self) {
+    MEM_HOOK_ALLOC(MEM_STATS_POOL, self, MEM_GUARD_USABLE(self->_objectSize), 0, pool_alloc_impl(self));
+}
+
+static inline unsigned char pool_free_impl(PoolMemory *self, void **p) {
 #if MEM_DEBUG_MODE
     if (self == NULL) {
         printf("pool: free failed, invalid instance\n");
@@ -67,22 +72,29 @@ unsigned char pool_free(PoolMemory *self, void **p) {
     return 1;
 }
 
+unsigned char pool_free(PoolMemory *self, void **p) {
+    MEM_HOOK_FREE(MEM_STATS_POOL, self, p, pool_free_impl(self, p));
+}
+
 void pool_destroy(PoolMemory **self) {
     if (self == NULL || *self == NULL) {
         printf("pool: destroy failed, invalid instance\n");
         return;
     }
+    MEM_HOOK_RELEASE(*self);
     size_t op = (size_t) (*self) - (*self)->_padding;
     free((void *) (op));
     (*self) = NULL;
 }
 
 PoolMemory *pool_create(void *m, unsigned int size, unsigned int objectSize) {
+    objectSize = MEM_GUARD_SIZE(objectSize, 0);
     size_t start = (size_t) m;
     unsigned int space = MEMORY_SPACE_STD(PoolMemory);
     unsigned int padding = MEMORY_PADDING_STD(start);
     PoolMemory *self = (PoolMemory *) (start + padding);
     self->_head = NULL;
+    self->_top = 0;
     self->total = size;
     self->_padding = padding;
     self->_objectSize = objectSize;
@@ -111,6 +123,98 @@ PoolMemory *make_pool(unsigned int size, unsigned int objectSize) {
     return pool_create(m, size, objectSize);
 }
 
+#define POOL_TOP(offset, tag) ((size_t) (offset) | ((size_t) (tag) << 32ULL))
+#define POOL_TOP_OFFSET(top) ((top) & 0xFFFFFFFFULL)
+#define POOL_TOP_TAG(top) ((top) >> 32ULL)
+
+static inline void *pool_alloc_atomic_impl(PoolMemory *self) {
+#if MEM_DEBUG_MODE
+    if (self == NULL) {
+        printf("pool: alloc failed, invalid instance\n");
+        return NULL;
+    }
+#endif
+    const size_t start = (size_t) self - self->_padding;
+    size_t top = __atomic_load_n(&self->_top, __ATOMIC_ACQUIRE);
+    PoolMemoryNode *node;
+    while (1) {
+        if (POOL_TOP_OFFSET(top) == 0) {
+            printf("pool: alloc failed, insufficient memory\n");
+            return NULL;
+        }
+        node = (PoolMemoryNode *) (start + POOL_TOP_OFFSET(top));
+        // node may be popped and reused by another thread meanwhile, the tag makes the exchange fail in that case
+        size_t next = BYTE71_GET_7(__atomic_load_n(&node->next, __ATOMIC_RELAXED));
+        size_t offset = next == 0 ? 0 : next - start;
+        if (__atomic_compare_exchange_n(&self->_top, &top, POOL_TOP(offset, POOL_TOP_TAG(top) + 1),
+                                        1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            break;
+    }
+    __atomic_store_n(&node->next, BYTE71(0, 1), __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&self->usage, self->_objectSize, __ATOMIC_RELAXED);
+    const unsigned int space = MEMORY_SPACE_STD(PoolMemoryNode);
+    return (void *) ((size_t) node + space);
+}
+
+void *pool_alloc_atomic(PoolMemory *self) {
+    MEM_HOOK_ALLOC(MEM_STATS_POOL, self, MEM_GUARD_USABLE(self->_objectSize), 0, pool_alloc_atomic_impl(self));
+}
+
+static inline unsigned char pool_free_atomic_impl(PoolMemory *self, void **p) {
+#if MEM_DEBUG_MODE
+    if (self == NULL) {
+        printf("pool: free failed, invalid instance\n");
+        return 0;
+    }
+    if (p == NULL || (*p) == NULL) {
+        printf("pool: free failed, invalid pointer\n");
+        return 0;
+    }
+#endif
+    const size_t start = (size_t) self - self->_padding;
+    const unsigned int space = MEMORY_SPACE_STD(PoolMemoryNode);
+    PoolMemoryNode *node = (PoolMemoryNode *) ((size_t) (*p) - space);
+
+    // claim the node first so two racing frees of the same pointer can't both push it
+    size_t used = __atomic_load_n(&node->next, __ATOMIC_RELAXED);
+    if (!BYTE71_GET_1(used) || !__atomic_compare_exchange_n(&node->next, &used, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        printf("pool: free failed, already freed\n");
+        return 0;
+    }
+
+    size_t top = __atomic_load_n(&self->_top, __ATOMIC_RELAXED);
+    do {
+        size_t next = POOL_TOP_OFFSET(top) == 0 ? 0 : start + POOL_TOP_OFFSET(top);
+        __atomic_store_n(&node->next, BYTE71(next, 0), __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&self->_top, &top, POOL_TOP((size_t) node - start, POOL_TOP_TAG(top) + 1),
+                                          1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    __atomic_fetch_add(&self->usage, self->_objectSize, __ATOMIC_RELAXED);
+    (*p) = NULL;
+    return 1;
+}
+
+unsigned char pool_free_atomic(PoolMemory *self, void **p) {
+    MEM_HOOK_FREE(MEM_STATS_POOL, self, p, pool_free_atomic_impl(self, p));
+}
+
+PoolMemory *pool_create_atomic(void *m, unsigned int size, unsigned int objectSize) {
+    PoolMemory *self = pool_create(m, size, objectSize);
+    const size_t start = (size_t) self - self->_padding;
+    self->_top = self->_head == NULL ? 0 : POOL_TOP((size_t) self->_head - start, 0);
+    self->_head = NULL;
+    return self;
+}
+
+PoolMemory *make_pool_atomic(unsigned int size, unsigned int objectSize) {
+    void *m = malloc(size);
+    if (m == NULL) {
+        printf("pool: make failed, system can't provide free memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return pool_create_atomic(m, size, objectSize);
+}
+
 unsigned int pool_size(unsigned int size, unsigned int objectSize) {
     unsigned int n = size / objectSize;
     size += MEMORY_SPACE_STD(PoolMemory) + sizeof(size_t);
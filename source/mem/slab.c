@@ -5,42 +5,75 @@
 #include <stdio.h>
 
 #include "mem/utils.h"
+#include "mem/hook.h"
 
 typedef struct {
-    size_t next;
+    size_t next; // 7bytes page 1byte used
 } SlabObject;
 
-typedef struct {
+typedef struct __attribute__((aligned(16), packed)) {
     void *next;
+    void *prev;
+    unsigned int live;
+    unsigned int capacity;
+    unsigned int hint; // no free slot below this bitmap word
     unsigned int size;
     unsigned int padding;
 } SlabPage;
 
-void slab_enqueue(SlabMemory *self, SlabObject *node) {
-    node->next = BYTE71((size_t) self->_objects, 0);
-    self->_objects = node;
+// page layout: header, occupancy bitmap, objects of SLAB_STRIDE bytes each
+#define SLAB_WORD_BITS 64
+#define SLAB_WORDS(capacity) (((capacity) + SLAB_WORD_BITS - 1) / SLAB_WORD_BITS)
+#define SLAB_STRIDE(objectSize) (MEMORY_SPACE((objectSize), sizeof(size_t)) + MEMORY_SPACE_STD(SlabObject))
+#define SLAB_BITMAP(page) ((unsigned long long *) ((size_t) (page) + MEMORY_SPACE_STD(SlabPage)))
+#define SLAB_OBJECTS(page) ((size_t) SLAB_BITMAP(page) + SLAB_WORDS((page)->capacity) * sizeof(unsigned long long))
+
+static inline void slab_link(void **list, SlabPage *page) {
+    page->prev = NULL;
+    page->next = *list;
+    if (*list != NULL)
+        ((SlabPage *) *list)->prev = page;
+    *list = page;
 }
 
-SlabObject *slab_dequeue(SlabMemory *self) {
-    if (self->_objects == NULL)
-        return NULL;
+static inline void slab_unlink(void **list, SlabPage *page) {
+    if (page->prev != NULL)
+        ((SlabPage *) page->prev)->next = page->next;
+    else
+        *list = page->next;
+    if (page->next != NULL)
+        ((SlabPage *) page->next)->prev = page->prev;
+}
+
+static inline unsigned int slab_page_take(SlabPage *page) {
+    unsigned long long *bitmap = SLAB_BITMAP(page);
+    unsigned int word = page->hint;
+    while (bitmap[word] == ~0ULL)
+        word++;
+    const unsigned int bit = __builtin_ctzll(~bitmap[word]);
+    bitmap[word] |= 1ULL << bit;
+    page->hint = word;
+    page->live++;
+    return word * SLAB_WORD_BITS + bit;
+}
 
-    SlabObject *node = self->_objects;
-    node->next = BYTE71_SET_1(node->next, 1);
-    self->_objects = (SlabObject *) (BYTE71_GET_7(node->next));
-    return node;
+static inline void slab_page_give(SlabPage *page, unsigned int index) {
+    const unsigned int word = index / SLAB_WORD_BITS;
+    SLAB_BITMAP(page)[word] &= ~(1ULL << (index % SLAB_WORD_BITS));
+    if (word < page->hint)
+        page->hint = word;
+    page->live--;
 }
 
 SlabPage *create_slab(SlabMemory *self) {
-    unsigned int n = self->_slabSize / self->_objectSize;
+    const unsigned int capacity = self->_slabSize / self->_objectSize;
+    const unsigned int words = SLAB_WORDS(capacity);
 
-    unsigned int size = self->_slabSize;
-    size += MEMORY_SPACE_STD(SlabPage);
-    size += n * MEMORY_SPACE_STD(SlabObject);
+    unsigned int size = MEMORY_SPACE_STD(SlabPage);
+    size += words * sizeof(unsigned long long);
+    size += capacity * SLAB_STRIDE(self->_objectSize);
     size += sizeof(size_t);
 
-    self->total += size;
-
     void *m = NULL;
     if (self->_allocator.alloc != NULL)
         m = self->_allocator.alloc(size);
@@ -50,30 +83,30 @@ SlabPage *create_slab(SlabMemory *self) {
         printf("slab: create slab failed, system can't provide free memory\n");
         return NULL;
     }
+    self->total += size;
+
     const size_t start = (size_t) m;
-    unsigned int space = MEMORY_SPACE_STD(SlabPage);
-    unsigned int padding = MEMORY_PADDING_STD(start);
+    const unsigned int padding = MEMORY_PADDING_STD(start);
 
     SlabPage *slab = (SlabPage *) (start + padding);
     slab->next = NULL;
+    slab->prev = NULL;
+    slab->live = 0;
+    slab->capacity = capacity;
+    slab->hint = 0;
     slab->size = size;
     slab->padding = padding;
 
-    size_t cursor = padding + space;
-    space = MEMORY_SPACE_STD(SlabObject);
-    while (1) {
-        size_t address = start + cursor;
-        padding = MEMORY_ALIGNMENT_STD(address, SlabObject);
-        cursor += padding + self->_objectSize;
-        if (cursor > size)
-            break;
-
-        slab_enqueue(self, (SlabObject *) (address + padding - space));
-    }
+    unsigned long long *bitmap = SLAB_BITMAP(slab);
+    clear(bitmap, words * sizeof(unsigned long long));
+    // slots past the capacity are marked used so the bit scan never hands them out
+    if (capacity % SLAB_WORD_BITS)
+        bitmap[words - 1] = ~0ULL << (capacity % SLAB_WORD_BITS);
     return slab;
 }
 
 void destroy_slab(SlabMemory *self, SlabPage *slab) {
+    self->total -= slab->size;
     size_t op = (size_t) slab - slab->padding;
     if (self->_allocator.free != NULL)
         self->_allocator.free((void *) (op));
@@ -81,6 +114,14 @@ void destroy_slab(SlabMemory *self, SlabPage *slab) {
         free((void *) (op));
 }
 
+void destroy_slabs(SlabMemory *self, SlabPage *slab) {
+    while (slab != NULL) {
+        SlabPage *next = slab->next;
+        destroy_slab(self, slab);
+        slab = next;
+    }
+}
+
 SlabMemory *slab_create(void *m, unsigned int slabSize, unsigned short objectSize) {
     if (slabSize % objectSize != 0) {
         printf("slab: create failed, invalid chunk size\n");
@@ -90,8 +131,9 @@ SlabMemory *slab_create(void *m, unsigned int slabSize, unsigned short objectSiz
     const unsigned int padding = MEMORY_PADDING_STD(start);
 
     SlabMemory *self = (SlabMemory *) (start + padding);
-    self->_pages = NULL;
-    self->_objects = NULL;
+    self->_partial = NULL;
+    self->_full = NULL;
+    self->_empty = NULL;
     self->_allocator.alloc = NULL;
     self->_allocator.free = NULL;
     self->_padding = padding;
@@ -99,7 +141,7 @@ SlabMemory *slab_create(void *m, unsigned int slabSize, unsigned short objectSiz
     self->total = padding + sizeof(SlabMemory);
 
     self->_slabSize = slabSize;
-    self->_objectSize = objectSize;
+    self->_objectSize = MEM_GUARD_SIZE(objectSize, 0);
     return self;
 }
 
@@ -128,13 +170,11 @@ void slab_destroy(SlabMemory **self) {
         printf("slab: destroy failed, invalid instance\n");
         return;
     }
+    MEM_HOOK_RELEASE(*self);
 
-    SlabPage *slab = (*self)->_pages;
-    while (slab != NULL) {
-        void *next = slab->next;
-        destroy_slab(*self, slab);
-        slab = next;
-    }
+    destroy_slabs(*self, (*self)->_partial);
+    destroy_slabs(*self, (*self)->_full);
+    destroy_slabs(*self, (*self)->_empty);
 
     size_t op = (size_t) (*self) - (*self)->_padding;
 
@@ -145,30 +185,43 @@ void slab_destroy(SlabMemory **self) {
     (*self) = NULL;
 }
 
-void *slab_alloc(SlabMemory *self) {
+static inline void *slab_alloc_impl(SlabMemory *self) {
 #if MEM_DEBUG_MODE
     if (self == NULL) {
         printf("slab: alloc failed, invalid instance\n");
         return NULL;
     }
 #endif
-    if (self->_objects == NULL) {
-        SlabPage *slab = create_slab(self);
-        if (slab == NULL) {
+    SlabPage *slab = self->_partial;
+    if (slab == NULL) {
+        if (self->_empty != NULL) {
+            slab = self->_empty;
+            self->_empty = NULL;
+        } else if ((slab = create_slab(self)) == NULL) {
             printf("slab: alloc failed, cannot create new slab\n");
             return NULL;
         }
-        slab->next = self->_pages;
-        self->_pages = slab;
+        slab_link(&self->_partial, slab);
+    }
+
+    const unsigned int index = slab_page_take(slab);
+    if (slab->live == slab->capacity) {
+        slab_unlink(&self->_partial, slab);
+        slab_link(&self->_full, slab);
     }
 
-    SlabObject *node = slab_dequeue(self);
+    SlabObject *node = (SlabObject *) (SLAB_OBJECTS(slab) + index * SLAB_STRIDE(self->_objectSize));
+    node->next = BYTE71((size_t) slab, 1);
     const unsigned int space = MEMORY_SPACE_STD(SlabObject);
     self->usage += self->_objectSize;
     return (void *) ((size_t) node + space);
 }
 
-char slab_free(SlabMemory *self, void **ptr) {
+void *slab_alloc(SlabMemory *self) {
+    MEM_HOOK_ALLOC(MEM_STATS_SLAB, self, MEM_GUARD_USABLE(self->_objectSize), 0, slab_alloc_impl(self));
+}
+
+static inline char slab_free_impl(SlabMemory *self, void **ptr) {
 #if MEM_DEBUG_MODE
     if (self == NULL) {
         printf("slab: free failed, invalid instance\n");
@@ -186,70 +239,32 @@ char slab_free(SlabMemory *self, void **ptr) {
         printf("slab: free failed, already freed\n");
         return 0;
     }
-
-    slab_enqueue(self, node);
+    SlabPage *slab = (SlabPage *) BYTE71_GET_7(node->next);
+    node->next = BYTE71((size_t) slab, 0);
+    slab_page_give(slab, ((size_t) node - SLAB_OBJECTS(slab)) / SLAB_STRIDE(self->_objectSize));
     self->usage -= self->_objectSize;
-    return 1;
-}
 
-char slab_is_free(SlabPage *slab, unsigned int objectSize) {
-    unsigned int space = MEMORY_SPACE_STD(SlabPage);
-    const size_t start = (size_t) slab - slab->padding;
-    size_t cursor = slab->padding + space;
-    while (1) {
-        size_t address = start + cursor;
-        space = MEMORY_SPACE_STD(SlabObject);
-        unsigned int padding = MEMORY_ALIGNMENT_STD(address, SlabObject);
-        cursor += padding + objectSize;
-        if (cursor > slab->size)
-            break;
-        SlabObject *obj = (SlabObject *) (address + padding - space);
-        if (BYTE71_GET_1(obj->next)) return 0;
+    if (slab->live + 1 == slab->capacity) {
+        slab_unlink(&self->_full, slab);
+        slab_link(&self->_partial, slab);
+    }
+    if (slab->live == 0) {
+        slab_unlink(&self->_partial, slab);
+        if (self->_empty == NULL)
+            slab_link(&self->_empty, slab);
+        else
+            destroy_slab(self, slab);
     }
     return 1;
 }
 
-void slab_fit(SlabMemory *self) {
-
-    SlabPage *slab = self->_pages;
-    self->_pages = NULL;
-    self->_objects = NULL;
-    self->usage = 0;
-
-    while (slab != NULL) {
-        SlabPage *next = slab->next;
-
-        if (slab_is_free( slab, self->_objectSize)) {
-            unsigned int n = self->_slabSize / self->_objectSize;
-            unsigned int size = self->_slabSize;
-            size += MEMORY_SPACE_STD(SlabPage);
-            size += n * MEMORY_SPACE_STD(SlabObject);
-            size += sizeof(size_t);
-            self->total -= size;
-            destroy_slab(self, slab);
+char slab_free(SlabMemory *self, void **ptr) {
+    MEM_HOOK_FREE(MEM_STATS_SLAB, self, ptr, slab_free_impl(self, ptr));
+}
 
-        } else {
-            unsigned int space = MEMORY_SPACE_STD(SlabPage);
-            const size_t start = (size_t) slab - slab->padding;
-            size_t cursor = slab->padding + space;
-            while (1) {
-                size_t address = start + cursor;
-                space = MEMORY_SPACE_STD(SlabObject);
-                unsigned int padding = MEMORY_ALIGNMENT_STD(address, SlabObject);
-                cursor += padding + self->_objectSize;
-                if (cursor > slab->size)
-                    break;
-
-                SlabObject *obj = (SlabObject *) (address + padding - space);
-                if (!BYTE71_GET_1(obj->next)) { // is free
-                    slab_enqueue(self, obj);
-                } else {
-                    self->usage += self->_objectSize;
-                }
-            }
-            slab->next = self->_pages;
-            self->_pages = slab;
-        }
-        slab = next;
+void slab_fit(SlabMemory *self) {
+    if (self->_empty != NULL) {
+        destroy_slab(self, self->_empty);
+        self->_empty = NULL;
     }
-}
\ No newline at end of file
+}
@@ -4,14 +4,108 @@
 #include <malloc.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "mem/utils.h"
+#include "mem/hook.h"
 
 typedef struct {
     size_t next; // 7bytes offset 1byte padding
 } StackMemoryNode;
 
-void *stack_alloc(StackMemory *self, unsigned int size, unsigned int alignment) {
+typedef struct {
+    void *prev; // NULL for the first chunk, which lives in the stack's own block
+    unsigned int size;
+    unsigned int used; // offset of the first free byte from the chunk
+    unsigned int bumped; // offset past the last bumped byte, blocks below it can't be freed
+} StackChunk;
+
+#define STACK_CHUNK_SPACE MEMORY_SPACE_STD(StackChunk)
+
+// allocations are carved from the whole block of a fixed stack or from the current chunk of a segmented one,
+// the head node always lives in that region
+static inline size_t stack_base(StackMemory *self) {
+    return self->_chunk != NULL ? (size_t) self->_chunk : (size_t) self - self->_padding;
+}
+
+static inline unsigned int *stack_used(StackMemory *self) {
+    return self->_chunk != NULL ? &((StackChunk *) self->_chunk)->used : &self->usage;
+}
+
+static inline unsigned int stack_limit(StackMemory *self) {
+    return self->_chunk != NULL ? ((StackChunk *) self->_chunk)->size : self->total;
+}
+
+static inline unsigned int *stack_bumped(StackMemory *self) {
+    return self->_chunk != NULL ? &((StackChunk *) self->_chunk)->bumped : &self->_bumped;
+}
+
+// bumped memory sits above the head node either in its own region or by pushing the stack on to a newer chunk
+static inline char stack_under_bump(StackMemory *self, void *node) {
+    if (self->_chunk != NULL) {
+        const size_t base = (size_t) self->_chunk;
+        if ((size_t) node < base || (size_t) node >= base + ((StackChunk *) self->_chunk)->size)
+            return 1;
+    }
+    return (size_t) node - stack_base(self) < *stack_bumped(self);
+}
+
+// usage of a segmented stack is the sum over its chunks
+static inline void stack_set_used(StackMemory *self, unsigned int *used, unsigned int value) {
+    if (used != &self->usage)
+        self->usage += value - *used;
+    *used = value;
+}
+
+static StackChunk *stack_chunk_push(StackMemory *self, unsigned int need) {
+    StackChunk *chunk = (StackChunk *) self->_spare;
+    self->_spare = NULL;
+    if (chunk != NULL && chunk->size < need) {
+        self->total -= chunk->size;
+        free(chunk);
+        chunk = NULL;
+    }
+    if (chunk == NULL) {
+        const unsigned int size = need > self->_chunkSize ? need : self->_chunkSize;
+        chunk = (StackChunk *) malloc(size);
+        if (chunk == NULL) {
+            printf("stack: alloc failed, system can't provide free memory\n");
+            return NULL;
+        }
+        chunk->size = size;
+        self->total += size;
+    }
+    chunk->prev = self->_chunk;
+    chunk->used = STACK_CHUNK_SPACE;
+    chunk->bumped = 0;
+    self->usage += STACK_CHUNK_SPACE;
+    self->_chunk = chunk;
+    return chunk;
+}
+
+// an emptied chunk is kept as the spare when allowed, the larger one wins if there already is one
+static void stack_chunk_release(StackMemory *self, StackChunk *chunk) {
+    if (self->_flags & STACK_KEEP_SPARE) {
+        StackChunk *spare = (StackChunk *) self->_spare;
+        if (spare == NULL || spare->size < chunk->size) {
+            self->_spare = chunk;
+            chunk = spare;
+        }
+    }
+    if (chunk == NULL) return;
+    self->total -= chunk->size;
+    free(chunk);
+}
+
+static inline void stack_chunk_pop(StackMemory *self) {
+    StackChunk *chunk = (StackChunk *) self->_chunk;
+    if (chunk->prev == NULL || chunk->used != STACK_CHUNK_SPACE) return;
+    self->_chunk = chunk->prev;
+    self->usage -= STACK_CHUNK_SPACE;
+    stack_chunk_release(self, chunk);
+}
+
+static inline void *stack_alloc_impl(StackMemory *self, unsigned int size, unsigned int alignment) {
 #if MEM_DEBUG_MODE
     if (!ISPOW2(alignment)) {
         printf("stack: alloc failed, invalid alignment\n");
@@ -22,15 +116,23 @@ void *stack_alloc(StackMemory *self, unsigned int size, unsigned int alignment)
         return NULL;
     }
 #endif
-    size_t start = (size_t) self - self->_padding;
-    size_t address = start + self->usage;
-    const unsigned int padding = MEMORY_ALIGNMENT(address, sizeof(StackMemoryNode), alignment);
+    unsigned int *used = stack_used(self);
+    size_t address = stack_base(self) + *used;
+    unsigned int padding = MEMORY_ALIGNMENT(address, sizeof(StackMemoryNode), alignment);
     const unsigned int space = MEMORY_SPACE(sizeof(StackMemoryNode), sizeof(size_t));
-    if (self->usage + padding + size > self->total) {
-        printf("stack: alloc failed, insufficient memory\n");
-        return NULL;
+    if (*used + padding + size > stack_limit(self)) {
+        if (self->_chunk == NULL) {
+            printf("stack: alloc failed, insufficient memory\n");
+            return NULL;
+        }
+        StackChunk *chunk = stack_chunk_push(self, STACK_CHUNK_SPACE + size + 2 * alignment + space);
+        if (chunk == NULL)
+            return NULL;
+        used = &chunk->used;
+        address = (size_t) chunk + *used;
+        padding = MEMORY_ALIGNMENT(address, sizeof(StackMemoryNode), alignment);
     }
-    self->usage += padding + size;
+    stack_set_used(self, used, *used + padding + size);
 
     StackMemoryNode *node = (StackMemoryNode *) (address + padding - space);
     node->next = BYTE71((size_t) self->_head, padding);
@@ -39,7 +141,12 @@ void *stack_alloc(StackMemory *self, unsigned int size, unsigned int alignment)
     return (void *) (address + padding);
 }
 
-char stack_free(StackMemory *self, void **p) {
+void *stack_alloc(StackMemory *self, unsigned int size, unsigned int alignment) {
+    MEM_HOOK_ALLOC(MEM_STATS_STACK, self, size, alignment,
+                   stack_alloc_impl(self, MEM_GUARD_SIZE(size, alignment), alignment));
+}
+
+static inline char stack_free_impl(StackMemory *self, void **p) {
 #if MEM_DEBUG_MODE
     if (self == NULL) {
         printf("stack: free failed, invalid instance\n");
@@ -50,7 +157,6 @@ char stack_free(StackMemory *self, void **p) {
         return 0;
     }
 #endif
-    size_t start = (size_t) self - self->_padding;
     size_t address = (size_t) (*p);
 
     const unsigned int space = MEMORY_SPACE_STD(StackMemoryNode);
@@ -59,16 +165,26 @@ char stack_free(StackMemory *self, void **p) {
         printf("stack: free failed, you must free the stack in order\n");
         return 0;
     }
+    if (stack_under_bump(self, node)) {
+        printf("stack: free failed, bumped memory sits above this block\n");
+        return 0;
+    }
 
     void *next = (void *) BYTE71_GET_7(node->next);
     unsigned char padding = BYTE71_GET_1(node->next);
 
-    self->usage = (address - padding) - start;
+    stack_set_used(self, stack_used(self), (address - padding) - stack_base(self));
     self->_head = next;
+    if (self->_chunk != NULL)
+        stack_chunk_pop(self);
     *p = NULL;
     return 1;
 }
 
+char stack_free(StackMemory *self, void **p) {
+    MEM_HOOK_FREE(MEM_STATS_STACK, self, p, stack_free_impl(self, p));
+}
+
 char stack_pop(StackMemory *self) {
 #if MEM_DEBUG_MODE
     if (self == NULL) {
@@ -82,16 +198,30 @@ char stack_pop(StackMemory *self) {
 #endif
     const unsigned int space = MEMORY_SPACE_STD(StackMemoryNode);
     StackMemoryNode *node = (StackMemoryNode *) self->_head;
+    if (stack_under_bump(self, node)) {
+        printf("stack: free failed, bumped memory sits above this block\n");
+        return 0;
+    }
 
-
-    size_t start = (size_t) self - self->_padding;
     size_t address = (size_t) node + space;
+#if MEM_TRACE_MODE || MEM_GUARD_MODE
+    void *block = (void *) address;
+#if MEM_GUARD_MODE
+    block = mem_guard_drop(block);
+#endif
+#if MEM_TRACE_MODE
+    mem_trace_free(self, MEM_STATS_STACK, block);
+#endif
+    (void) block;
+#endif
 
     void *next = (void *) BYTE71_GET_7(node->next);
     unsigned char padding = BYTE71_GET_1(node->next);
 
-    self->usage = (address - padding) - start;
+    stack_set_used(self, stack_used(self), (address - padding) - stack_base(self));
     self->_head = next;
+    if (self->_chunk != NULL)
+        stack_chunk_pop(self);
     return 1;
 }
 
@@ -102,9 +232,23 @@ void stack_reset(StackMemory *self) {
         return;
     }
 #endif
+    MEM_HOOK_RESET(MEM_STATS_STACK, self);
     const unsigned int space = MEMORY_SPACE_STD(StackMemory);
     self->usage = self->_padding + space;
     self->_head = NULL;
+    self->_bumped = 0;
+    if (self->_chunk == NULL)
+        return;
+    StackChunk *chunk = (StackChunk *) self->_chunk;
+    while (chunk->prev != NULL) {
+        StackChunk *prev = (StackChunk *) chunk->prev;
+        stack_chunk_release(self, chunk);
+        chunk = prev;
+    }
+    chunk->used = STACK_CHUNK_SPACE;
+    chunk->bumped = 0;
+    self->_chunk = chunk;
+    self->usage += STACK_CHUNK_SPACE;
 }
 
 void stack_destroy(StackMemory **self) {
@@ -112,23 +256,59 @@ void stack_destroy(StackMemory **self) {
         printf("stack: destroy failed, invalid instance\n");
         return;
     }
+    MEM_HOOK_RELEASE(*self);
+    StackChunk *chunk = (StackChunk *) (*self)->_chunk;
+    while (chunk != NULL && chunk->prev != NULL) {
+        StackChunk *prev = (StackChunk *) chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+    free((*self)->_spare);
     size_t op = (size_t) (*self) - (*self)->_padding;
     free((void *) (op));
     *self = NULL;
 }
 
+void stack_fit(StackMemory *self) {
+    StackChunk *spare = (StackChunk *) self->_spare;
+    if (spare == NULL)
+        return;
+    self->total -= spare->size;
+    self->_spare = NULL;
+    free(spare);
+}
+
 StackMemory *stack_create(void *m, unsigned int size) {
     size_t address = (size_t) m;
     const unsigned int space = MEMORY_SPACE_STD(StackMemory);
     const unsigned int padding = MEMORY_PADDING_STD(address);
     StackMemory *self = (StackMemory *) (address + padding);
     self->_head = NULL;
+    self->_chunk = NULL;
+    self->_spare = NULL;
+    self->_chunkSize = size;
+    self->_flags = 0;
+    self->_bumped = 0;
     self->total = size;
     self->usage = padding + space;
     self->_padding = padding;
     return self;
 }
 
+StackMemory *stack_create_segmented(void *m, unsigned int size, unsigned int flags) {
+    StackMemory *self = stack_create(m, size);
+    const unsigned int space = MEMORY_SPACE_STD(StackMemory);
+    StackChunk *chunk = (StackChunk *) ((size_t) self + space);
+    chunk->prev = NULL;
+    chunk->size = size - self->_padding - space;
+    chunk->used = STACK_CHUNK_SPACE;
+    chunk->bumped = 0;
+    self->_chunk = chunk;
+    self->_flags = flags;
+    self->usage += STACK_CHUNK_SPACE;
+    return self;
+}
+
 StackMemory *make_stack(unsigned int size) {
     void *m = malloc(size);
     if (m == NULL) {
@@ -138,26 +318,153 @@ StackMemory *make_stack(unsigned int size) {
     return stack_create(m, size);
 }
 
-char stack_expand(StackMemory *self, unsigned int newSize) {
+StackMemory *make_stack_segmented(unsigned int size, unsigned int flags) {
+    void *m = malloc(size);
+    if (m == NULL) {
+        printf("stack: make failed, system can't provide free memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return stack_create_segmented(m, size, flags);
+}
+
+static void *stack_expand_impl(StackMemory *self, unsigned int newSize) {
     if (self == NULL) {
         printf("stack: expand failed, invalid instance\n");
-        return 0;
+        return NULL;
     }
     if (self->_head == NULL) {
         printf("stack: expand failed, no prior alloc\n");
-        return 0;
+        return NULL;
+    }
+    if (stack_under_bump(self, self->_head)) {
+        printf("stack: expand failed, bumped memory sits above this block\n");
+        return NULL;
     }
     const unsigned int space = MEMORY_SPACE_STD(StackMemoryNode);
-    size_t start = (size_t) self - self->_padding;
-    unsigned int prevSize = self->usage - ((size_t) self->_head + space - start);
-    self->usage += (newSize - prevSize);
-    return 1;
+    unsigned int *used = stack_used(self);
+    const size_t address = (size_t) self->_head + space;
+    const unsigned int offset = address - stack_base(self);
+    if (offset + newSize <= stack_limit(self)) {
+        stack_set_used(self, used, offset + newSize);
+        return (void *) address;
+    }
+    if (self->_chunk == NULL) {
+        printf("stack: expand failed, insufficient memory\n");
+        return NULL;
+    }
+
+    // move the block into a new chunk with room to double, keeping whatever alignment it had
+    StackMemoryNode *node = (StackMemoryNode *) self->_head;
+    const size_t next = BYTE71_GET_7(node->next);
+    const unsigned char padding = BYTE71_GET_1(node->next);
+    const unsigned int size = *used - offset;
+    unsigned int alignment = (unsigned int) (address & (~address + 1));
+    if (alignment > 64) alignment = 64;
+
+    StackChunk *previous = (StackChunk *) self->_chunk;
+    StackChunk *chunk = stack_chunk_push(self, STACK_CHUNK_SPACE + 2 * newSize + 2 * alignment + space);
+    if (chunk == NULL)
+        return NULL;
+    const size_t to = (size_t) chunk + chunk->used;
+    const unsigned int move = MEMORY_ALIGNMENT(to, sizeof(StackMemoryNode), alignment);
+    memcpy((void *) (to + move), (void *) address, size);
+
+    node = (StackMemoryNode *) (to + move - space);
+    node->next = BYTE71(next, move);
+    self->_head = node;
+    stack_set_used(self, &chunk->used, chunk->used + move + newSize);
+    stack_set_used(self, &previous->used, offset - padding);
+
+    // nothing else lived in the chunk it left
+    if (previous->prev != NULL && previous->used == STACK_CHUNK_SPACE) {
+        chunk->prev = previous->prev;
+        self->usage -= STACK_CHUNK_SPACE;
+        stack_chunk_release(self, previous);
+    }
+    return (void *) (to + move);
+}
+
+void *stack_expand(StackMemory *self, unsigned int newSize) {
+#if MEM_GUARD_MODE
+    // the guarded block grows and moves as a whole, header and canaries included
+    if (self != NULL && self->_head != NULL) {
+        void *raw = (void *) ((size_t) self->_head + MEMORY_SPACE_STD(StackMemoryNode));
+        const unsigned int size = mem_guard_length(raw);
+        const unsigned int front = mem_guard_detach(raw);
+        void *m = stack_expand_impl(self, newSize + front + MEM_GUARD_TAIL);
+        void *user = mem_guard_move(self, m != NULL ? m : raw, m != NULL ? newSize : size, front);
+        return m != NULL ? user : NULL;
+    }
+#endif
+    return stack_expand_impl(self, newSize);
 }
 
 unsigned int stack_n(StackMemory *self) {
     if (self->_head == NULL)
         return 0;
     const unsigned int space = MEMORY_SPACE_STD(StackMemoryNode);
-    size_t start = (size_t) self - self->_padding;
-    return self->usage - ((size_t) self->_head + space - start);
+#if MEM_GUARD_MODE
+    return mem_guard_length((void *) ((size_t) self->_head + space));
+#endif
+    return *stack_used(self) - ((size_t) self->_head + space - stack_base(self));
+}
+
+StackMark stack_mark(StackMemory *self) {
+    StackMark mark = {self->_head, self->_chunk, *stack_used(self), *stack_bumped(self)};
+    return mark;
+}
+
+void stack_rewind(StackMemory *self, StackMark mark) {
+#if MEM_TRACE_MODE || MEM_GUARD_MODE
+    // blocks dropped here would look leaked to mem_replay and the guard otherwise
+    const unsigned int space = MEMORY_SPACE_STD(StackMemoryNode);
+    for (size_t node = (size_t) self->_head; node != 0 && node != (size_t) mark.head;) {
+        void *block = (void *) (node + space);
+#if MEM_GUARD_MODE
+        block = mem_guard_drop(block);
+#endif
+#if MEM_TRACE_MODE
+        mem_trace_free(self, MEM_STATS_STACK, block);
+#endif
+        (void) block;
+        const size_t next = ((StackMemoryNode *) node)->next;
+        node = BYTE71_GET_7(next);
+    }
+#endif
+    while (self->_chunk != mark.chunk) {
+        StackChunk *chunk = (StackChunk *) self->_chunk;
+#if MEM_DEBUG_MODE
+        if (chunk == NULL || chunk->prev == NULL) {
+            printf("stack: rewind failed, mark belongs to another stack\n");
+            return;
+        }
+#endif
+        self->_chunk = chunk->prev;
+        self->usage -= chunk->used;
+        stack_chunk_release(self, chunk);
+    }
+    stack_set_used(self, stack_used(self), mark.used);
+    *stack_bumped(self) = mark.bumped;
+    self->_head = mark.head;
+}
+
+void *stack_bump(StackMemory *self, unsigned int size, unsigned int alignment) {
+    unsigned int *used = stack_used(self);
+    size_t address = stack_base(self) + *used;
+    unsigned int padding = MEMORY_PADDING(address, alignment);
+    if (*used + padding + size > stack_limit(self)) {
+        if (self->_chunk == NULL) {
+            printf("stack: bump failed, insufficient memory\n");
+            return NULL;
+        }
+        StackChunk *chunk = stack_chunk_push(self, STACK_CHUNK_SPACE + size + alignment);
+        if (chunk == NULL)
+            return NULL;
+        used = &chunk->used;
+        address = (size_t) chunk + *used;
+        padding = MEMORY_PADDING(address, alignment);
+    }
+    stack_set_used(self, used, *used + padding + size);
+    *stack_bumped(self) = *used;
+    return (void *) (address + padding);
 }
@@ -0,0 +1,312 @@
+#include "mem/stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mem/arena.h"
+#include "mem/stack.h"
+#include "mem/freelist.h"
+#include "mem/buddy.h"
+#include "mem/slab.h"
+#include "mem/p2slab.h"
+#include "mem/pool.h"
+#include "mem/page.h"
+
+#if MEM_STATS_MODE
+
+static MemStats _stats[MEM_STATS_MAX];
+static unsigned int _n = 0;
+static MemStatsTag _tags[MEM_STATS_TAGS];
+static unsigned int _nTags = 0;
+static volatile int _lock = 0;
+static _Thread_local const char *_tag = NULL;
+
+static const char *_kinds[MEM_STATS_KINDS] = {
+        "arena", "stack", "freelist", "buddy", "slab", "p2slab", "pool"
+};
+
+static inline void mem_stats_lock() {
+    while (__atomic_exchange_n(&_lock, 1, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(&_lock, __ATOMIC_RELAXED));
+}
+
+static inline void mem_stats_unlock() {
+    __atomic_store_n(&_lock, 0, __ATOMIC_RELEASE);
+}
+
+static inline void mem_stats_max(unsigned long long *target, unsigned long long value) {
+    unsigned long long current = __atomic_load_n(target, __ATOMIC_RELAXED);
+    while (value > current && !__atomic_compare_exchange_n(target, &current, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static inline void mem_stats_peak(unsigned int *target, unsigned int value) {
+    unsigned int current = __atomic_load_n(target, __ATOMIC_RELAXED);
+    while (value > current && !__atomic_compare_exchange_n(target, &current, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+unsigned long long mem_stats_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static MemStats *mem_stats_find(const void *allocator) {
+    const unsigned int n = __atomic_load_n(&_n, __ATOMIC_ACQUIRE);
+    for (unsigned int i = 0; i < n; i++)
+        if (_stats[i].allocator == allocator && __atomic_load_n(&_stats[i].live, __ATOMIC_RELAXED))
+            return &_stats[i];
+    return NULL;
+}
+
+static MemStats *mem_stats_insert(const void *allocator, MemStatsKind kind, const char *name) {
+    mem_stats_lock();
+    MemStats *stats = mem_stats_find(allocator);
+    if (stats == NULL && _n < MEM_STATS_MAX) {
+        stats = &_stats[_n];
+        memset(stats, 0, sizeof(MemStats));
+        stats->allocator = allocator;
+        stats->kind = kind;
+        stats->name = name != NULL ? name : _kinds[kind];
+        stats->live = 1;
+        __atomic_store_n(&_n, _n + 1, __ATOMIC_RELEASE);
+    } else if (stats != NULL && name != NULL) {
+        stats->name = name;
+    }
+    mem_stats_unlock();
+    return stats;
+}
+
+static void mem_stats_count_tag(const char *tag, unsigned int size) {
+    MemStatsTag *entry = NULL;
+    const unsigned int n = __atomic_load_n(&_nTags, __ATOMIC_ACQUIRE);
+    for (unsigned int i = 0; i < n && entry == NULL; i++)
+        if (_tags[i].tag == tag)
+            entry = &_tags[i];
+
+    if (entry == NULL) {
+        mem_stats_lock();
+        for (unsigned int i = 0; i < _nTags && entry == NULL; i++)
+            if (_tags[i].tag == tag || strcmp(_tags[i].tag, tag) == 0)
+                entry = &_tags[i];
+        if (entry == NULL && _nTags < MEM_STATS_TAGS) {
+            entry = &_tags[_nTags];
+            entry->tag = tag;
+            entry->allocs = 0;
+            entry->bytes = 0;
+            __atomic_store_n(&_nTags, _nTags + 1, __ATOMIC_RELEASE);
+        }
+        mem_stats_unlock();
+        if (entry == NULL) return;
+    }
+    __atomic_fetch_add(&entry->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&entry->bytes, size, __ATOMIC_RELAXED);
+}
+
+void mem_stats_register(const void *allocator, MemStatsKind kind, const char *name) {
+    if (allocator == NULL || mem_stats_insert(allocator, kind, name) == NULL)
+        printf("alloc: stats register failed, too many allocators\n");
+}
+
+void mem_stats_alloc(const void *allocator, MemStatsKind kind, unsigned int size, const void *ptr,
+                     unsigned long long start, unsigned int usage, unsigned int total) {
+    const unsigned long long ns = mem_stats_now() - start;
+    if (allocator == NULL) return;
+    MemStats *stats = mem_stats_find(allocator);
+    if (stats == NULL && (stats = mem_stats_insert(allocator, kind, NULL)) == NULL)
+        return;
+
+    if (ptr == NULL) {
+        __atomic_fetch_add(&stats->failures, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    const unsigned int bucket = size == 0 ? 0 : 31 - __builtin_clz(size);
+    __atomic_fetch_add(&stats->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->bytes, size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->histogram[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->allocNs, ns, __ATOMIC_RELAXED);
+    mem_stats_max(&stats->allocMaxNs, ns);
+    __atomic_store_n(&stats->total, total, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->usage, usage, __ATOMIC_RELAXED);
+    mem_stats_peak(&stats->peak, usage);
+
+    const char *tag = _tag;
+    if (tag != NULL)
+        mem_stats_count_tag(tag, size);
+}
+
+void mem_stats_free(const void *allocator, MemStatsKind kind, char ok, unsigned long long start, unsigned int usage) {
+    const unsigned long long ns = mem_stats_now() - start;
+    if (allocator == NULL) return;
+    MemStats *stats = mem_stats_find(allocator);
+    if (stats == NULL && (stats = mem_stats_insert(allocator, kind, NULL)) == NULL)
+        return;
+
+    if (!ok) {
+        __atomic_fetch_add(&stats->failures, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_fetch_add(&stats->frees, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->freeNs, ns, __ATOMIC_RELAXED);
+    mem_stats_max(&stats->freeMaxNs, ns);
+    __atomic_store_n(&stats->usage, usage, __ATOMIC_RELAXED);
+}
+
+const char *mem_stats_tag(const char *tag) {
+    const char *previous = _tag;
+    _tag = tag;
+    return previous;
+}
+
+MemStats *mem_stats_get(const void *allocator) {
+    return mem_stats_find(allocator);
+}
+
+// fixed size allocators have no external fragmentation, their largest free block is all free space
+static void mem_stats_sample(MemStats *stats) {
+    const void *a = stats->allocator;
+    unsigned int total = 0, usage = 0, largest = 0;
+    switch (stats->kind) {
+        case MEM_STATS_ARENA:
+            total = ((const ArenaMemory *) a)->total;
+            usage = ((const ArenaMemory *) a)->usage;
+            largest = total - usage;
+            break;
+        case MEM_STATS_STACK:
+            total = ((const StackMemory *) a)->total;
+            usage = ((const StackMemory *) a)->usage;
+            largest = total - usage;
+            break;
+        case MEM_STATS_FREELIST:
+            total = ((const FreeListMemory *) a)->total;
+            usage = ((const FreeListMemory *) a)->usage;
+            largest = freelist_largest((FreeListMemory *) a);
+            break;
+        case MEM_STATS_BUDDY:
+            total = ((const BuddyMemory *) a)->total;
+            usage = ((const BuddyMemory *) a)->usage;
+            largest = buddy_largest((BuddyMemory *) a);
+            break;
+        case MEM_STATS_SLAB:
+            total = ((const SlabMemory *) a)->total;
+            usage = ((const SlabMemory *) a)->usage;
+            largest = total - usage;
+            break;
+        case MEM_STATS_P2SLAB:
+            total = ((const P2SlabMemory *) a)->total;
+            usage = ((const P2SlabMemory *) a)->usage;
+            largest = total - usage;
+            break;
+        case MEM_STATS_POOL:
+            total = ((const PoolMemory *) a)->total;
+            usage = ((const PoolMemory *) a)->usage;
+            largest = total - usage;
+            break;
+        default:
+            break;
+    }
+    stats->total = total;
+    stats->usage = usage;
+    stats->freeBytes = total - usage;
+    stats->largestFree = largest;
+    if (usage > stats->peak)
+        stats->peak = usage;
+}
+
+void mem_stats_release(const void *allocator) {
+    MemStats *stats = mem_stats_find(allocator);
+    if (stats == NULL) return;
+    mem_stats_sample(stats);
+    __atomic_store_n(&stats->live, 0, __ATOMIC_RELAXED);
+}
+
+static double mem_stats_fragmentation(const MemStats *stats) {
+    return stats->freeBytes == 0 ? 0.0 : 1.0 - (double) stats->largestFree / (double) stats->freeBytes;
+}
+
+static double mem_stats_average(unsigned long long ns, size_t n) {
+    return n == 0 ? 0.0 : (double) ns / (double) n;
+}
+
+static void mem_stats_json(FILE *f, unsigned int n, unsigned int nTags) {
+    fprintf(f, "{\n  \"allocators\": [");
+    for (unsigned int i = 0; i < n; i++) {
+        const MemStats *s = &_stats[i];
+        fprintf(f, "%s\n    {\"name\": \"%s\", \"kind\": \"%s\", \"live\": %s, ", i ? "," : "", s->name,
+                _kinds[s->kind], s->live ? "true" : "false");
+        fprintf(f, "\"allocs\": %zu, \"frees\": %zu, \"failures\": %zu, \"bytes\": %zu, ",
+                s->allocs, s->frees, s->failures, s->bytes);
+        fprintf(f, "\"total\": %u, \"usage\": %u, \"peak\": %u, \"free\": %u, \"largestFree\": %u, \"fragmentation\": %.4f, ",
+                s->total, s->usage, s->peak, s->freeBytes, s->largestFree, mem_stats_fragmentation(s));
+        fprintf(f, "\"pageSize\": %zu, \"node\": %d, ", s->pageSize, s->node);
+        fprintf(f, "\"allocAvgNs\": %.1f, \"allocMaxNs\": %llu, \"freeAvgNs\": %.1f, \"freeMaxNs\": %llu, \"histogram\": [",
+                mem_stats_average(s->allocNs, s->allocs), s->allocMaxNs,
+                mem_stats_average(s->freeNs, s->frees), s->freeMaxNs);
+        for (unsigned int b = 0; b < MEM_STATS_BUCKETS; b++)
+            fprintf(f, "%s%zu", b ? ", " : "", s->histogram[b]);
+        fprintf(f, "]}");
+    }
+    fprintf(f, "\n  ],\n  \"tags\": [");
+    for (unsigned int i = 0; i < nTags; i++)
+        fprintf(f, "%s\n    {\"tag\": \"%s\", \"allocs\": %zu, \"bytes\": %zu}", i ? "," : "",
+                _tags[i].tag, _tags[i].allocs, _tags[i].bytes);
+    fprintf(f, "\n  ]\n}\n");
+}
+
+static void mem_stats_csv(FILE *f, unsigned int n, unsigned int nTags) {
+    fprintf(f, "name,kind,allocs,frees,failures,bytes,total,usage,peak,free,largest_free,fragmentation,"
+               "page_size,node,alloc_avg_ns,alloc_max_ns,free_avg_ns,free_max_ns");
+    for (unsigned int b = 0; b < MEM_STATS_BUCKETS; b++)
+        fprintf(f, ",h%u", b);
+    fprintf(f, "\n");
+    for (unsigned int i = 0; i < n; i++) {
+        const MemStats *s = &_stats[i];
+        fprintf(f, "%s,%s,%zu,%zu,%zu,%zu,%u,%u,%u,%u,%u,%.4f,%zu,%d,%.1f,%llu,%.1f,%llu",
+                s->name, _kinds[s->kind], s->allocs, s->frees, s->failures, s->bytes,
+                s->total, s->usage, s->peak, s->freeBytes, s->largestFree, mem_stats_fragmentation(s),
+                s->pageSize, s->node, mem_stats_average(s->allocNs, s->allocs), s->allocMaxNs,
+                mem_stats_average(s->freeNs, s->frees), s->freeMaxNs);
+        for (unsigned int b = 0; b < MEM_STATS_BUCKETS; b++)
+            fprintf(f, ",%zu", s->histogram[b]);
+        fprintf(f, "\n");
+    }
+    for (unsigned int i = 0; i < nTags; i++)
+        fprintf(f, "%s,tag,%zu,,,%zu\n", _tags[i].tag, _tags[i].allocs, _tags[i].bytes);
+}
+
+char alloc_stats_dump(const char *path, unsigned int format) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        printf("alloc: stats dump failed, can't open %s\n", path);
+        return 0;
+    }
+    mem_stats_lock();
+    const unsigned int n = _n;
+    const unsigned int nTags = _nTags;
+    for (unsigned int i = 0; i < n; i++) {
+        if (!_stats[i].live) continue;
+        mem_stats_sample(&_stats[i]);
+        // reads the process memory map, too slow for release so only dumps pay for it
+        _stats[i].pageSize = page_size_at(_stats[i].allocator);
+        _stats[i].node = page_node_at(_stats[i].allocator);
+    }
+    mem_stats_unlock();
+
+    if (format == MEM_STATS_CSV)
+        mem_stats_csv(f, n, nTags);
+    else
+        mem_stats_json(f, n, nTags);
+    fclose(f);
+    return 1;
+}
+
+#else
+
+char alloc_stats_dump(const char *path, unsigned int format) {
+    (void) path;
+    (void) format;
+    printf("alloc: stats dump failed, built without MEM_STATS_MODE\n");
+    return 0;
+}
+
+#endif
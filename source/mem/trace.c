@@ -0,0 +1,204 @@
+#include "mem/trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if MEM_TRACE_MODE
+
+#define MEM_TRACE_HALF (MEM_TRACE_RING / 2)
+
+typedef struct {
+    const void *allocator;
+    unsigned int total;
+    char live;
+    MemTraceAllocator info;
+} MemTraceEntry;
+
+// writers claim slots in order and commit them by storing op last,
+// whoever fills the last slot of a half writes that half to the file
+static MemTraceRecord _ring[MEM_TRACE_RING];
+static unsigned long long _head = 0;
+static unsigned long long _flushed = 0;
+static MemTraceEntry _entries[MEM_TRACE_ALLOCATORS];
+static unsigned int _n = 0;
+static volatile int _lock = 0;
+static char _active = 0;
+static unsigned int _writers = 0; // pushes in flight, mem_trace_stop waits for them before it closes the file
+static unsigned long long _start = 0;
+static FILE *_file = NULL;
+
+static inline void mem_trace_lock() {
+    while (__atomic_exchange_n(&_lock, 1, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(&_lock, __ATOMIC_RELAXED));
+}
+
+static inline void mem_trace_unlock() {
+    __atomic_store_n(&_lock, 0, __ATOMIC_RELEASE);
+}
+
+// a writer counts itself in before it looks at _active again, so mem_trace_stop either sees it or it sees the stop
+static inline char mem_trace_enter() {
+    if (!__atomic_load_n(&_active, __ATOMIC_RELAXED)) return 0;
+    __atomic_fetch_add(&_writers, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&_active, __ATOMIC_SEQ_CST)) return 1;
+    __atomic_fetch_sub(&_writers, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static inline void mem_trace_leave() {
+    __atomic_fetch_sub(&_writers, 1, __ATOMIC_RELEASE);
+}
+
+static inline void mem_trace_max(unsigned int *target, unsigned int value) {
+    unsigned int current = __atomic_load_n(target, __ATOMIC_RELAXED);
+    while (value > current && !__atomic_compare_exchange_n(target, &current, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static inline unsigned long long mem_trace_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static int mem_trace_find(const void *allocator) {
+    const unsigned int n = __atomic_load_n(&_n, __ATOMIC_ACQUIRE);
+    for (unsigned int i = 0; i < n; i++)
+        if (_entries[i].allocator == allocator && __atomic_load_n(&_entries[i].live, __ATOMIC_RELAXED))
+            return (int) i;
+    return -1;
+}
+
+static int mem_trace_insert(const void *allocator, MemStatsKind kind, const char *name) {
+    mem_trace_lock();
+    int id = mem_trace_find(allocator);
+    if (id < 0 && _n < MEM_TRACE_ALLOCATORS) {
+        MemTraceEntry *entry = &_entries[_n];
+        memset(entry, 0, sizeof(MemTraceEntry));
+        entry->allocator = allocator;
+        entry->live = 1;
+        entry->info.kind = kind;
+        id = (int) _n;
+        __atomic_store_n(&_n, _n + 1, __ATOMIC_RELEASE);
+    }
+    if (id >= 0 && name != NULL)
+        snprintf(_entries[id].info.name, MEM_TRACE_NAME, "%s", name);
+    mem_trace_unlock();
+    if (id < 0)
+        printf("alloc: trace register failed, too many allocators\n");
+    return id;
+}
+
+static inline int mem_trace_id(const void *allocator, MemStatsKind kind) {
+    const int id = mem_trace_find(allocator);
+    return id >= 0 ? id : mem_trace_insert(allocator, kind, NULL);
+}
+
+static void mem_trace_flush(unsigned long long from, unsigned long long to) {
+    while (__atomic_load_n(&_flushed, __ATOMIC_ACQUIRE) != from);
+    for (unsigned long long i = from; i < to; i++)
+        while (__atomic_load_n(&_ring[i & (MEM_TRACE_RING - 1)].op, __ATOMIC_ACQUIRE) == MEM_TRACE_NONE);
+
+    MemTraceRecord *records = &_ring[from & (MEM_TRACE_RING - 1)];
+    if (fwrite(records, sizeof(MemTraceRecord), to - from, _file) != to - from)
+        printf("alloc: trace flush failed, short write\n");
+    for (unsigned long long i = 0; i < to - from; i++)
+        records[i].op = MEM_TRACE_NONE;
+    __atomic_store_n(&_flushed, to, __ATOMIC_RELEASE);
+}
+
+static void mem_trace_push(int id, MemTraceOp op, const void *address, unsigned int size, unsigned int alignment) {
+    if (id < 0) return;
+    const unsigned long long i = __atomic_fetch_add(&_head, 1, __ATOMIC_RELAXED);
+    // the ring is full until the half holding this slot has been written out
+    while (i - __atomic_load_n(&_flushed, __ATOMIC_ACQUIRE) >= MEM_TRACE_RING);
+
+    MemTraceRecord *record = &_ring[i & (MEM_TRACE_RING - 1)];
+    record->time = mem_trace_now() - _start;
+    record->address = (unsigned long long) (size_t) address;
+    record->size = size;
+    record->alignment = (unsigned short) alignment;
+    record->allocator = (unsigned char) id;
+    __atomic_store_n(&record->op, (unsigned char) op, __ATOMIC_RELEASE);
+
+    if (((i + 1) & (MEM_TRACE_HALF - 1)) == 0)
+        mem_trace_flush(i + 1 - MEM_TRACE_HALF, i + 1);
+}
+
+char mem_trace_start(const char *path) {
+    if (_file != NULL) {
+        printf("alloc: trace start failed, already recording\n");
+        return 0;
+    }
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        printf("alloc: trace start failed, can't open %s\n", path);
+        return 0;
+    }
+    MemTraceHeader header = {MEM_TRACE_MAGIC, MEM_TRACE_VERSION, sizeof(MemTraceRecord), 0};
+    fwrite(&header, sizeof(MemTraceHeader), 1, f);
+
+    _file = f;
+    _head = 0;
+    _flushed = 0;
+    _start = mem_trace_now();
+    __atomic_store_n(&_active, 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void mem_trace_stop() {
+    if (_file == NULL) return;
+    __atomic_store_n(&_active, 0, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&_writers, __ATOMIC_SEQ_CST) != 0);
+
+    const unsigned long long head = __atomic_load_n(&_head, __ATOMIC_ACQUIRE);
+    if (head > _flushed)
+        mem_trace_flush(_flushed, head);
+
+    mem_trace_lock();
+    for (unsigned int i = 0; i < _n; i++) {
+        _entries[i].info.total = _entries[i].total;
+        fwrite(&_entries[i].info, sizeof(MemTraceAllocator), 1, _file);
+    }
+    MemTraceFooter footer = {head, _n, MEM_TRACE_MAGIC};
+    fwrite(&footer, sizeof(MemTraceFooter), 1, _file);
+    mem_trace_unlock();
+
+    fclose(_file);
+    _file = NULL;
+}
+
+void mem_trace_register(const void *allocator, MemStatsKind kind, const char *name) {
+    if (allocator != NULL)
+        mem_trace_insert(allocator, kind, name);
+}
+
+void mem_trace_release(const void *allocator) {
+    const int id = mem_trace_find(allocator);
+    if (id >= 0)
+        __atomic_store_n(&_entries[id].live, 0, __ATOMIC_RELAXED);
+}
+
+void mem_trace_alloc(const void *allocator, MemStatsKind kind, unsigned int size, unsigned int alignment,
+                     const void *ptr, unsigned int total) {
+    if (allocator == NULL || !mem_trace_enter()) return;
+    const int id = mem_trace_id(allocator, kind);
+    if (id >= 0)
+        mem_trace_max(&_entries[id].total, total);
+    mem_trace_push(id, MEM_TRACE_ALLOC, ptr, size, alignment);
+    mem_trace_leave();
+}
+
+void mem_trace_free(const void *allocator, MemStatsKind kind, const void *ptr) {
+    if (allocator == NULL || ptr == NULL || !mem_trace_enter()) return;
+    mem_trace_push(mem_trace_id(allocator, kind), MEM_TRACE_FREE, ptr, 0, 0);
+    mem_trace_leave();
+}
+
+void mem_trace_reset(const void *allocator, MemStatsKind kind) {
+    if (allocator == NULL || !mem_trace_enter()) return;
+    mem_trace_push(mem_trace_id(allocator, kind), MEM_TRACE_RESET, NULL, 0, 0);
+    mem_trace_leave();
+}
+
+#endif
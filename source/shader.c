@@ -51,13 +51,13 @@ Shader shader_create(const char *vs, const char *fs) {
 }
 
 Shader shader_load(const char *vs, const char *fs) {
+    StackMark mark = stack_mark(alloc->stack);
     char *vsf = readfile_stack(vs);
     char *fsf = readfile_stack(fs);
 
     Shader sh = shader_create(vsf, fsf);
 
-    stack_pop(alloc->stack);
-    stack_pop(alloc->stack);
+    stack_rewind(alloc->stack, mark);
 
     return sh;
 }
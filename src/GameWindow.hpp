@@ -139,14 +139,17 @@ struct GameWindow {
                                "slab %d / %d\n"
                                "string %d / %d\n"
                                "buddy %d / %d\n"
-                               "stack %d / %d",
+                               "stack %d / %d\n"
+                               "frame %d / %d (last %d, peak %d)",
                           alloc->boot->usage, alloc->boot->total,
                           alloc->global->usage, alloc->global->total,
                           freelist_usage(alloc->freelist), alloc->freelist->total,
                           alloc->slab->usage, alloc->slab->total,
                           freelist_usage(alloc->string), alloc->string->total,
                           alloc->buddy->usage, alloc->metadata.buddy,
-                          alloc->stack->usage, alloc->stack->total
+                          alloc->stack->usage, alloc->stack->total,
+                          alloc->frame->usage, alloc->frame->total / ALLOC_FRAME_BUFFERS,
+                          alloc->frame->last, alloc->frame->peak
             );
         }
     }
@@ -66,7 +66,7 @@ class StartLevel : public CLevel {
     };
 
 
-    struct ProjectileSystem : public CSystem<TAlloc, ProjectileComponent, TransformComponent> {
+    struct ProjectileSystem : public CSystem<TAlloc, const ProjectileComponent, TransformComponent> {
         void Update() override {
             for (auto &compTuple: Components()) {
                 auto bulletTransform = Get<TransformComponent>(compTuple);
@@ -78,7 +78,9 @@ class StartLevel : public CLevel {
         }
     };
 
-    struct MovementSystem : public CSystem<TAlloc, MovementComponent, TransformComponent> {
+    struct MovementSystem : public CSystem<TAlloc, const MovementComponent, TransformComponent> {
+        explicit inline MovementSystem() { SetMainThread(false); }
+
         inline void Update() override {
             Ray inputRay = camera_screenToWorld(input->position);
             Vec3 mousePos = vec3_intersectPlane(inputRay.origin, vec3_add(inputRay.origin, inputRay.direction), vec3_zero, vec3_up);
@@ -87,8 +89,8 @@ class StartLevel : public CLevel {
             float xAxis = input_axis(AXIS_VERTICAL);
 
             for (const auto &bucket: Components()) {
-                auto playerTransform = std::get<TransformComponent *>(bucket);
-                auto movement = std::get<MovementComponent *>(bucket);
+                auto playerTransform = Get<TransformComponent>(bucket);
+                auto movement = Get<MovementComponent>(bucket);
                 Vec3 move{xAxis, yAxis, 0};
                 Rot direction{0, camera->rotation.yaw, 0};
                 playerTransform->position += rot_rotate(direction, move) * gameTime->deltaTime * movement->speed;
@@ -97,7 +99,7 @@ class StartLevel : public CLevel {
         }
     };
 
-    struct ShooterSystem : public CSystem<TAlloc, PlayerComponent, TransformComponent> {
+    struct ShooterSystem : public CSystem<TAlloc, PlayerComponent, const TransformComponent> {
         void Update() override {
             auto down = input_mousepress(MOUSE_LEFT);
             for (auto &components: Components()) {
@@ -115,7 +117,7 @@ class StartLevel : public CLevel {
         }
     };
 
-    struct RenderSystem : public CSystem<TAlloc, ShapeComponent, TransformComponent> {
+    struct RenderSystem : public CSystem<TAlloc, const ShapeComponent, const TransformComponent> {
         inline void Update() override {
             for (const auto &bucket: Components()) {
                 auto pShape = Get<ShapeComponent>(bucket);
@@ -138,12 +140,9 @@ class StartLevel : public CLevel {
         TransformComponent *playerTransform{};
         inline void Update() override {
             if (playerTransform == nullptr) {
-                auto players = mDirector->Query<PlayerComponent>();
-                if (players != nullptr) {
-                    for (const auto &p: *players) {
-                        playerTransform = p->value->GetComponent<TransformComponent>();
-                        break;
-                    }
+                for (const auto &p: mDirector->Query<PlayerComponent>()) {
+                    playerTransform = std::get<PlayerComponent *>(p)->GetComponent<TransformComponent>();
+                    break;
                 }
             }
             float n = (float)Components().Length();
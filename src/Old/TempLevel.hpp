@@ -81,10 +81,9 @@ FreeListMemory *CustomTempAllocator2::slab = nullptr;
 class TempLevel : public CLevel {
     using TAlloc = CustomTempAllocator3;
 
-    struct TransformComponent : public CComponent<TAlloc> {
+    // plain data, packed in its columns without a vtable or entity pointer
+    struct TransformComponent {
         Vec3 position;
-
-        explicit inline TransformComponent(Vec3 position) : position(position) {}
     };
 
     struct MovementComponent : public CComponent<TAlloc> {
@@ -131,7 +130,7 @@ class TempLevel : public CLevel {
         explicit inline EmitterComponent() = default;
     };
 
-    struct RenderSystem : public CSystem<TAlloc, ShapeComponent, TransformComponent> {
+    struct RenderSystem : public CSystem<TAlloc, const ShapeComponent, const TransformComponent> {
         inline void Update() override {
             for (const auto &bucket: Components()) {
                 auto pTransform = Get<TransformComponent>(bucket);
@@ -140,7 +139,7 @@ class TempLevel : public CLevel {
         }
     };
 
-    struct EmitterSystem : public CSystem<TAlloc, EmitterComponent, TransformComponent> {
+    struct EmitterSystem : public CSystem<TAlloc, EmitterComponent, const TransformComponent> {
         inline void Update() override {
             for (const auto &bucket: Components()) {
                 auto pTransform = Get<TransformComponent>(bucket);
@@ -149,9 +148,9 @@ class TempLevel : public CLevel {
 
                     ParticleComponent *particle{nullptr};
                     if (pEmitter->activeParticles < pEmitter->maxParticles) {
-                        auto entityId = mDirector->CreateEntity();
-                        particle = mDirector->AddComponent<ParticleComponent>(entityId);
-                        mDirector->Commit(entityId);
+                        auto entityId = Commands().CreateEntity();
+                        particle = Commands().AddComponent<ParticleComponent>(entityId);
+                        Commands().Commit(entityId);
                         pEmitter->activeParticles++;
                     }
 
@@ -171,7 +170,10 @@ class TempLevel : public CLevel {
         }
     };
 
+    // the emitter a particle points at is only written here and by EmitterSystem, which stays on the main thread
     struct ParticleSystem : public CSystem<TAlloc, ParticleComponent> {
+        explicit inline ParticleSystem() { SetMainThread(false); }
+
         inline void Update() override {
             for (const auto &bucket: Components()) {
                 auto pParticle = Get<ParticleComponent>(bucket);
@@ -182,10 +184,10 @@ class TempLevel : public CLevel {
                 pParticle->size = lerp(pParticle->size, 0, pParticle->damping);
 
                 if ((t > 1 || pParticle->size < 0.5f)) {
-                    mDirector->DestroyEntity(pParticle->mEntityId);
+                    Commands().DestroyEntity(pParticle->EntityId());
                     pParticle->emitter->removeParticles++;
                     if (pParticle->emitter->removeParticles == pParticle->emitter->maxParticles)
-                        mDirector->DestroyEntity(pParticle->emitter->mEntityId);
+                        Commands().DestroyEntity(pParticle->emitter->EntityId());
                 }
             }
         }
@@ -206,13 +208,17 @@ class TempLevel : public CLevel {
                     Vec3 rnd = vec3(cosd(i), sind(i), 0);
                     pMovement->destination = vec3_add(dest, vec3_mulf(rnd, 30.0f));
                 }
-                pTransform->position = vec3_moveTowards(pTransform->position, pMovement->destination, pMovement->speed * gameTime->deltaTime);
+                Vec3 position = vec3_moveTowards(pTransform->position, pMovement->destination, pMovement->speed * gameTime->deltaTime);
+                if (!vec3_eq(position, pTransform->position)) {
+                    pTransform->position = position;
+                    MarkChanged<TransformComponent>(bucket);
+                }
                 i += sp;
             }
         }
     };
 
-    struct ParticleRenderSystem : public CSystem<TAlloc, ParticleComponent> {
+    struct ParticleRenderSystem : public CSystem<TAlloc, const ParticleComponent> {
         inline void Update() override {
             for (const auto &bucket: Components()) {
                 auto pParticle = Get<ParticleComponent>(bucket);
@@ -16,15 +16,19 @@ extern "C" {
 #include "../GameWindow.hpp"
 
 int main(int argc, const char *argv[]) {
-    MemoryMetadata meta;
-    meta.boot = 64 * MEGABYTES;
+    MemoryMetadata meta = {};
+    meta.boot = 32 * MEGABYTES;
 
-    meta.global = 32 * MEGABYTES;
+    meta.global = 512 * MEGABYTES;
     meta.freelist = 8 * MEGABYTES;
     meta.buddy = 8 * MEGABYTES;
     meta.stack = 1 * MEGABYTES;
     meta.string = 1 * MEGABYTES;
+    meta.frame = 1 * MEGABYTES;
 
+#if MEM_TRACE_MODE
+    mem_trace_start("memory_trace.bin");
+#endif
     alloc_create(meta);
 
 
@@ -62,5 +66,11 @@ int main(int argc, const char *argv[]) {
     draw_terminate();
     input_terminate();
     game_terminate();
+#if MEM_STATS_MODE
+    alloc_stats_dump("memory_stats.json", MEM_STATS_JSON);
+#endif
+#if MEM_TRACE_MODE
+    mem_trace_stop();
+#endif
     alloc_terminate();
 }